@@ -0,0 +1,145 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * AcceptingSocket.cpp
+ * A listening TCP socket which may share its port with other sockets.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/AcceptingSocket.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <ola/Logging.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/NetworkUtils.h>
+
+using ola::network::HostToNetwork;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using ola::network::NetworkToHost;
+
+const unsigned int AcceptingSocket::MAX_ACCEPTS_PER_READ;
+
+AcceptingSocket::AcceptingSocket(
+    ola::network::TCPSocketFactoryInterface *factory)
+    : m_sd(-1),
+      m_factory(factory) {
+}
+
+AcceptingSocket::~AcceptingSocket() {
+  Close();
+}
+
+bool AcceptingSocket::Listen(const IPV4SocketAddress &address, int backlog,
+                             bool reuse_port) {
+  if (m_sd != -1) {
+    return false;
+  }
+
+  int sd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sd < 0) {
+    OLA_WARN << "socket() failed: " << strerror(errno);
+    return false;
+  }
+
+  int reuse = 1;
+  if (setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) {
+    OLA_WARN << "Failed to set SO_REUSEADDR: " << strerror(errno);
+    close(sd);
+    return false;
+  }
+
+  if (reuse_port) {
+#ifdef SO_REUSEPORT
+    if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse))) {
+      OLA_WARN << "Failed to set SO_REUSEPORT: " << strerror(errno);
+      close(sd);
+      return false;
+    }
+#else
+    OLA_WARN << "SO_REUSEPORT isn't supported on this platform";
+    close(sd);
+    return false;
+#endif  // SO_REUSEPORT
+  }
+
+  struct sockaddr_in server_address;
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET;
+  server_address.sin_addr.s_addr = address.Host().AsInt();
+  server_address.sin_port = HostToNetwork(address.Port());
+
+  if (bind(sd, reinterpret_cast<struct sockaddr*>(&server_address),
+           sizeof(server_address))) {
+    OLA_WARN << "Failed to bind to " << address << ": " << strerror(errno);
+    close(sd);
+    return false;
+  }
+
+  if (listen(sd, backlog)) {
+    OLA_WARN << "listen() on " << address << " failed: " << strerror(errno);
+    close(sd);
+    return false;
+  }
+
+  if (!ola::io::ConnectedDescriptor::SetNonBlocking(sd)) {
+    close(sd);
+    return false;
+  }
+  m_sd = sd;
+  return true;
+}
+
+IPV4SocketAddress AcceptingSocket::LocalAddress() const {
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  if (m_sd == -1 ||
+      getsockname(m_sd, reinterpret_cast<struct sockaddr*>(&address),
+                  &length) ||
+      address.sin_family != AF_INET) {
+    return IPV4SocketAddress();
+  }
+  return IPV4SocketAddress(IPV4Address(address.sin_addr.s_addr),
+                           NetworkToHost(address.sin_port));
+}
+
+bool AcceptingSocket::Close() {
+  if (m_sd == -1) {
+    return true;
+  }
+  bool ok = close(m_sd) == 0;
+  m_sd = -1;
+  return ok;
+}
+
+void AcceptingSocket::PerformRead() {
+  for (unsigned int i = 0; i < MAX_ACCEPTS_PER_READ; i++) {
+    int sd = accept(m_sd, NULL, NULL);
+    if (sd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        OLA_WARN << "accept() failed: " << strerror(errno);
+      }
+      return;
+    }
+    m_factory->NewTCPSocket(sd);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * AcceptingSocket.h
+ * A listening TCP socket which may share its port with other sockets.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_ACCEPTINGSOCKET_H_
+#define SRC_ACCEPTINGSOCKET_H_
+
+#include <ola/base/Macro.h>
+#include <ola/io/Descriptor.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/network/TCPSocket.h>
+
+/**
+ * @brief A listening TCP socket.
+ *
+ * This is like ola::network::TCPAcceptingSocket, with two differences. It
+ * can set SO_REUSEPORT, so several sockets, each in its own thread, can
+ * listen on the same port and the kernel spreads new connections between
+ * them. It also accepts every pending connection each time it's readable,
+ * rather than one.
+ */
+class AcceptingSocket : public ola::io::ReadFileDescriptor {
+ public:
+  /**
+   * @brief Create a new AcceptingSocket.
+   * @param factory The factory to pass new connections to, not owned.
+   */
+  explicit AcceptingSocket(ola::network::TCPSocketFactoryInterface *factory);
+  ~AcceptingSocket();
+
+  /**
+   * @brief Start listening.
+   * @param address The address to listen on, if the port is 0 one is picked.
+   * @param backlog The maximum length of the pending connection queue.
+   * @param reuse_port Set SO_REUSEPORT. Every socket sharing the port must
+   *   set this.
+   */
+  bool Listen(const ola::network::IPV4SocketAddress &address,
+              int backlog,
+              bool reuse_port);
+
+  /**
+   * @brief The address we're listening on.
+   */
+  ola::network::IPV4SocketAddress LocalAddress() const;
+
+  bool Close();
+
+  ola::io::DescriptorHandle ReadDescriptor() const { return m_sd; }
+
+  void PerformRead();
+
+ private:
+  int m_sd;
+  ola::network::TCPSocketFactoryInterface *m_factory;
+
+  static const unsigned int MAX_ACCEPTS_PER_READ = 256;
+
+  DISALLOW_COPY_AND_ASSIGN(AcceptingSocket);
+};
+#endif  // SRC_ACCEPTINGSOCKET_H_
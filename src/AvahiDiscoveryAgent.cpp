@@ -29,6 +29,7 @@
 
 #include <netinet/in.h>
 #include <ola/Callback.h>
+#include <ola/Clock.h>
 #include <ola/io/Descriptor.h>
 #include <ola/Logging.h>
 #include <ola/network/NetworkUtils.h>
@@ -82,6 +83,11 @@ class MasterResolver {
 
   bool GetMasterEntry(MasterEntry *entry) const;
 
+  /**
+   * @brief True once the resolver has reported a result, or failed.
+   */
+  bool HasResult() const { return m_has_result; }
+
   void ResolveEvent(AvahiResolverEvent event,
                     const AvahiAddress *a,
                     uint16_t port,
@@ -99,9 +105,14 @@ class MasterResolver {
   const std::string m_domain;
 
   uint8_t m_priority;
+  uint32_t m_term;
   ola::network::IPV4SocketAddress m_resolved_address;
   std::string m_scope;
+  bool m_has_result;
 
+  bool UpdateFromResult(const AvahiAddress *address,
+                        uint16_t port,
+                        AvahiStringList *txt);
   bool ExtractString(AvahiStringList *txt_list,
                      const std::string &key,
                      std::string *dest);
@@ -118,6 +129,10 @@ const uint8_t MasterResolver::DEFAULT_PRIORITY = 100;
 
 // MasterRegistration
 // ----------------------------------------------------------------------------
+/*
+ * If another service has the same name, we retry with the alternative name
+ * from avahi_alternative_service_name().
+ */
 class MasterRegistration : public ClientStateChangeListener {
  public:
   explicit MasterRegistration(AvahiOlaClient *client);
@@ -133,14 +148,24 @@ class MasterRegistration : public ClientStateChangeListener {
   AvahiOlaClient *m_client;
   MasterEntry m_master_entry;
   AvahiEntryGroup *m_entry_group;
+  // The name we're registering, this differs from the entry's name after a
+  // conflict.
+  string m_instance_name;
+  // The name conflicts since the group was last established.
+  unsigned int m_conflicts;
+  ola::TimeStamp m_conflict_start;
 
   void PerformRegistration();
-  bool AddGroupEntry(AvahiEntryGroup *group);
+  int AddGroupEntry(AvahiEntryGroup *group);
+  bool RenameAfterConflict();
   void UpdateRegistration(const MasterEntry &new_master);
   void CancelRegistration();
 
   AvahiStringList *BuildTxtRecord(const MasterEntry &master);
 
+  // Give up after this many conflicts in a row.
+  static const unsigned int MAX_NAME_CONFLICTS = 32;
+
   DISALLOW_COPY_AND_ASSIGN(MasterRegistration);
 };
 
@@ -218,7 +243,9 @@ MasterResolver::MasterResolver(ChangeCallback *callback,
       m_protocol(protocol),
       m_service_name(service_name),
       m_type(type),
-      m_domain(domain) {
+      m_domain(domain),
+      m_term(0),
+      m_has_result(false) {
 }
 
 
@@ -265,6 +292,7 @@ bool MasterResolver::GetMasterEntry(MasterEntry *entry) const {
   entry->service_name = m_service_name;
   entry->priority = m_priority;
   entry->scope = m_scope;
+  entry->term = m_term;
   entry->address = m_resolved_address;
   return true;
 }
@@ -273,41 +301,57 @@ void MasterResolver::ResolveEvent(AvahiResolverEvent event,
                                   const AvahiAddress *address,
                                   uint16_t port,
                                   AvahiStringList *txt) {
+  m_has_result = true;
   if (event == AVAHI_RESOLVER_FAILURE) {
     m_resolved_address = IPV4SocketAddress();
     OLA_WARN << "Failed to resolve " << m_service_name << "." << m_type
              << ", proto: " << ProtoToString(m_protocol);
-    if (m_callback.get()) {
-      m_callback->Run(this);
-    }
-    return;
+  } else if (!UpdateFromResult(address, port, txt)) {
+    // Report it like a failure, so the agent can finish the initial browse
+    // and clients drop any address they had for this master.
+    m_resolved_address = IPV4SocketAddress();
   }
 
+  if (m_callback.get()) {
+    m_callback->Run(this);
+  }
+}
+
+/*
+ * Returns false if the result isn't from a master we can use.
+ */
+bool MasterResolver::UpdateFromResult(const AvahiAddress *address,
+                                      uint16_t port,
+                                      AvahiStringList *txt) {
   if (address->proto != AVAHI_PROTO_INET) {
-    return;
+    return false;
   }
 
   if (!CheckVersionMatches(txt,
                            DiscoveryAgentInterface::TXT_VERSION_KEY,
                            DiscoveryAgentInterface::TXT_VERSION)) {
-    return;
+    return false;
   }
 
   unsigned int priority;
   if (!ExtractInt(txt, DiscoveryAgentInterface::PRIORITY_KEY, &priority)) {
-    return;
+    return false;
   }
 
   if (!ExtractString(txt, DiscoveryAgentInterface::SCOPE_KEY, &m_scope)) {
-    return;
+    return false;
   }
 
+  // The term is optional, masters which have never been elected don't set
+  // it.
+  unsigned int term = 0;
+  ExtractInt(txt, DiscoveryAgentInterface::TERM_KEY, &term);
+
   m_priority = static_cast<uint8_t>(priority);
+  m_term = term;
   m_resolved_address = IPV4SocketAddress(
       IPV4Address(address->data.ipv4.address), port);
-  if (m_callback.get()) {
-    m_callback->Run(this);
-  }
+  return true;
 }
 
 bool MasterResolver::ExtractString(AvahiStringList *txt_list,
@@ -373,9 +417,12 @@ bool MasterResolver::CheckVersionMatches(
 
 // MasterRegistration
 // ----------------------------------------------------------------------------
+const unsigned int MasterRegistration::MAX_NAME_CONFLICTS;
+
 MasterRegistration::MasterRegistration(AvahiOlaClient *client)
     : m_client(client),
-      m_entry_group(NULL) {
+      m_entry_group(NULL),
+      m_conflicts(0) {
   m_client->AddStateChangeListener(this);
 }
 
@@ -400,6 +447,11 @@ void MasterRegistration::RegisterOrUpdate(const MasterEntry &master) {
     return;
   }
 
+  if (master.service_name != m_master_entry.service_name) {
+    m_instance_name = master.service_name;
+    m_conflicts = 0;
+  }
+
   if (m_client->GetState() != AVAHI_CLIENT_S_RUNNING) {
     // Store the master info until we change to running.
     m_master_entry = master;
@@ -418,7 +470,20 @@ void MasterRegistration::RegisterOrUpdate(const MasterEntry &master) {
 void MasterRegistration::GroupEvent(AvahiEntryGroupState state) {
   OLA_INFO << GroupStateToString(state);
   if (state == AVAHI_ENTRY_GROUP_COLLISION) {
-    OLA_INFO << "Name collision";
+    if (RenameAfterConflict()) {
+      avahi_entry_group_reset(m_entry_group);
+      PerformRegistration();
+    } else {
+      CancelRegistration();
+    }
+  } else if (state == AVAHI_ENTRY_GROUP_ESTABLISHED && m_conflicts) {
+    ola::Clock clock;
+    ola::TimeStamp now;
+    clock.CurrentTime(&now);
+    OLA_INFO << "Registered as " << m_instance_name << ", resolving "
+             << m_conflicts << " name conflicts took "
+             << (now - m_conflict_start);
+    m_conflicts = 0;
   }
 }
 
@@ -436,34 +501,42 @@ void MasterRegistration::PerformRegistration() {
     }
   }
 
-  if (!AddGroupEntry(group)) {
+  // A local service may already have the name.
+  int ret = AddGroupEntry(group);
+  while (ret == AVAHI_ERR_COLLISION && RenameAfterConflict()) {
+    avahi_entry_group_reset(group);
+    ret = AddGroupEntry(group);
+  }
+
+  if (ret != 0) {
     avahi_entry_group_free(group);
   } else {
     m_entry_group = group;
   }
 }
 
-bool MasterRegistration::AddGroupEntry(AvahiEntryGroup *group) {
+/*
+ * Returns 0 on success, or an Avahi error code.
+ */
+int MasterRegistration::AddGroupEntry(AvahiEntryGroup *group) {
   AvahiStringList *txt_str_list = BuildTxtRecord(m_master_entry);
 
-  OLA_INFO << "Going to register: " << m_master_entry.ServiceName();
+  OLA_INFO << "Going to register: " << m_instance_name;
   int ret = avahi_entry_group_add_service_strlst(
       group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
       static_cast<AvahiPublishFlags>(0),
-      m_master_entry.ServiceName().c_str(),
+      m_instance_name.c_str(),
       DiscoveryAgentInterface::MASTER_SERVICE,
       NULL, NULL, m_master_entry.address.Port(), txt_str_list);
 
   avahi_string_list_free(txt_str_list);
 
   if (ret < 0) {
-    if (ret == AVAHI_ERR_COLLISION) {
-      OLA_INFO << "Name collision";
-    } else {
+    if (ret != AVAHI_ERR_COLLISION) {
       OLA_WARN << "Failed to add " << m_master_entry << " : "
                << avahi_strerror(ret);
     }
-    return false;
+    return ret;
   }
 
   if (!m_master_entry.scope.empty()) {
@@ -474,14 +547,14 @@ bool MasterRegistration::AddGroupEntry(AvahiEntryGroup *group) {
     ret = avahi_entry_group_add_service_subtype(
         group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
         static_cast<AvahiPublishFlags>(0),
-        m_master_entry.ServiceName().c_str(),
+        m_instance_name.c_str(),
         DiscoveryAgentInterface::MASTER_SERVICE,
         NULL, sub_type.str().c_str());
 
     if (ret < 0) {
       OLA_WARN << "Failed to add subtype for " << m_master_entry << " : "
                << avahi_strerror(ret);
-      return false;
+      return ret;
     }
   }
 
@@ -489,8 +562,28 @@ bool MasterRegistration::AddGroupEntry(AvahiEntryGroup *group) {
   if (ret < 0) {
     OLA_WARN << "Failed to commit master " << m_master_entry << " : "
              << avahi_strerror(ret);
+    return ret;
   }
-  return ret == 0;
+  return 0;
+}
+
+bool MasterRegistration::RenameAfterConflict() {
+  if (m_conflicts == 0) {
+    ola::Clock clock;
+    clock.CurrentTime(&m_conflict_start);
+  }
+  m_conflicts++;
+  if (m_conflicts > MAX_NAME_CONFLICTS) {
+    OLA_WARN << "Giving up on registering " << m_master_entry.service_name
+             << " after " << m_conflicts << " name conflicts";
+    return false;
+  }
+
+  char *name = avahi_alternative_service_name(m_instance_name.c_str());
+  OLA_INFO << "Name conflict for " << m_instance_name << ", trying " << name;
+  m_instance_name = name;
+  avahi_free(name);
+  return true;
 }
 
 void MasterRegistration::UpdateRegistration(
@@ -499,7 +592,8 @@ void MasterRegistration::UpdateRegistration(
     return;
   }
 
-  if (new_master.scope != m_master_entry.scope) {
+  if (new_master.scope != m_master_entry.scope ||
+      new_master.service_name != m_master_entry.service_name) {
     // We require a full reset.
     avahi_entry_group_reset(m_entry_group);
     m_master_entry.UpdateFrom(new_master);
@@ -511,12 +605,11 @@ void MasterRegistration::UpdateRegistration(
 
   AvahiStringList *txt_str_list = BuildTxtRecord(m_master_entry);
 
-  OLA_INFO << "updating  " << m_entry_group << " : " <<
-    m_master_entry.ServiceName();
+  OLA_INFO << "updating  " << m_entry_group << " : " << m_instance_name;
   int ret = avahi_entry_group_update_service_txt_strlst(
       m_entry_group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
       static_cast<AvahiPublishFlags>(0),
-      m_master_entry.ServiceName().c_str(),
+      m_instance_name.c_str(),
       DiscoveryAgentInterface::MASTER_SERVICE,
       NULL, txt_str_list);
 
@@ -554,6 +647,12 @@ AvahiStringList *MasterRegistration::BuildTxtRecord(
       DiscoveryAgentInterface::SCOPE_KEY,
       master.scope.c_str());
 
+  if (master.term) {
+    txt_str_list = avahi_string_list_add_printf(
+        txt_str_list, "%s=%u",
+        DiscoveryAgentInterface::TERM_KEY,
+        master.term);
+  }
   return txt_str_list;
 }
 
@@ -561,8 +660,18 @@ AvahiStringList *MasterRegistration::BuildTxtRecord(
 // ----------------------------------------------------------------------------
 AvahiDiscoveryAgent::AvahiDiscoveryAgent(const Options &options)
     : m_scope(options.scope),
+      m_browse_domain(options.browse_domain),
+      m_registration_domain(options.registration_domain),
       m_master_callback(options.master_callback),
-      m_master_browser(NULL) {
+      m_registration_throttle(new RegistrationThrottle(
+          &m_ss,
+          ola::NewCallback(this,
+                           &AvahiDiscoveryAgent::InternalRegisterService),
+          options.registration_limits)),
+      m_master_browser(NULL),
+      m_all_for_now(false),
+      m_browse_gate(options.initial_browse_timeout,
+                    options.browse_complete_callback) {
 }
 
 AvahiDiscoveryAgent::~AvahiDiscoveryAgent() {
@@ -570,11 +679,26 @@ AvahiDiscoveryAgent::~AvahiDiscoveryAgent() {
 }
 
 bool AvahiDiscoveryAgent::Start() {
+  if (!m_registration_domain.empty()) {
+    // Avahi can browse wide-area domains, but can't publish to them. Falling
+    // back to the local domain would leave the master invisible to clients
+    // browsing the one that was asked for.
+    OLA_WARN << "Avahi doesn't support registering in "
+             << m_registration_domain;
+    return false;
+  }
+
+  m_browse_gate.Reset();
+  if (!m_master_callback.get()) {
+    m_browse_gate.Open();
+  }
+
   ola::thread::Future<void> f;
   m_thread.reset(new ola::thread::CallbackThread(ola::NewSingleCallback(
       this, &AvahiDiscoveryAgent::RunThread, &f)));
   m_thread->Start();
   f.Get();
+  m_browse_gate.Wait();
   return true;
 }
 
@@ -588,13 +712,12 @@ bool AvahiDiscoveryAgent::Stop() {
 }
 
 void AvahiDiscoveryAgent::RegisterMaster(const MasterEntry &master) {
-  m_ss.Execute(ola::NewSingleCallback(
-      this,
-      &AvahiDiscoveryAgent::InternalRegisterService, master));
+  m_registration_throttle->Update(master);
 }
 
 void AvahiDiscoveryAgent::DeRegisterMaster(
       const ola::network::IPV4SocketAddress &master_address) {
+  m_registration_throttle->Cancel(master_address);
   m_ss.Execute(ola::NewSingleCallback(
       this, &AvahiDiscoveryAgent::InternalDeRegisterService,
       master_address));
@@ -624,6 +747,7 @@ void AvahiDiscoveryAgent::RunThread(ola::thread::Future<void> *future) {
   m_ss.Run();
 
   m_client->RemoveStateChangeListener(this);
+  m_registration_throttle->Stop();
 
   {
     MutexLocker lock(&m_masters_mu);
@@ -658,6 +782,13 @@ void AvahiDiscoveryAgent::BrowseEvent(AvahiIfIndex interface,
         RemoveMaster(interface, protocol, name, type, domain);
       }
       break;
+    case AVAHI_BROWSER_ALL_FOR_NOW:
+      {
+        MutexLocker lock(&m_masters_mu);
+        m_all_for_now = true;
+        CheckInitialBrowse();
+      }
+      break;
     default:
       {}
   }
@@ -668,6 +799,9 @@ void AvahiDiscoveryAgent::MasterChanged(const MasterResolver *resolver) {
   MasterEntry entry;
   resolver->GetMasterEntry(&entry);
   m_master_callback->Run(MASTER_ADDED, entry);
+
+  MutexLocker lock(&m_masters_mu);
+  CheckInitialBrowse();
 }
 
 void AvahiDiscoveryAgent::StartServiceBrowser() {
@@ -680,7 +814,8 @@ void AvahiDiscoveryAgent::StartServiceBrowser() {
 
   m_master_browser = m_client->CreateServiceBrowser(
       AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC,
-      service.str().c_str(), NULL,
+      service.str().c_str(),
+      m_browse_domain.empty() ? NULL : m_browse_domain.c_str(),
       static_cast<AvahiLookupFlags>(0), browse_callback, this);
   if (!m_master_browser) {
     OLA_WARN << "Failed to start browsing for " << MASTER_SERVICE
@@ -699,6 +834,25 @@ void AvahiDiscoveryAgent::StopResolution() {
   }
 }
 
+/*
+ * The first browse is complete once Avahi has sent ALL_FOR_NOW and each of
+ * the masters it found has been resolved, or failed to resolve.
+ */
+void AvahiDiscoveryAgent::CheckInitialBrowse() {
+  if (!m_all_for_now || m_browse_gate.IsOpen()) {
+    return;
+  }
+  MasterResolverList::const_iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    if (!(*iter)->HasResult()) {
+      return;
+    }
+  }
+  OLA_INFO << "Initial browse complete, found " << m_masters.size()
+           << " masters";
+  m_browse_gate.Open();
+}
+
 void AvahiDiscoveryAgent::AddMaster(AvahiIfIndex interface,
                                     AvahiProtocol protocol,
                                     const std::string &name,
@@ -38,8 +38,10 @@
 #include <string>
 #include <vector>
 
+#include "src/BrowseGate.h"
 #include "src/DiscoveryAgent.h"
 #include "src/AvahiOlaClient.h"
+#include "src/RegistrationThrottle.h"
 
 /**
  * @brief An implementation of DiscoveryAgentInterface that uses the Avahi.
@@ -82,8 +84,13 @@ class AvahiDiscoveryAgent : public DiscoveryAgentInterface,
                    class MasterRegistration*> MasterRegistrationList;
 
   const std::string m_scope;
+  const std::string m_browse_domain;
+  const std::string m_registration_domain;
   std::auto_ptr<MasterEventCallback> m_master_callback;
 
+  // This must outlive m_ss, which runs any queued flushes when it's
+  // destroyed.
+  std::auto_ptr<RegistrationThrottle> m_registration_throttle;
   ola::io::SelectServer m_ss;
   std::auto_ptr<ola::thread::CallbackThread> m_thread;
 
@@ -96,12 +103,16 @@ class AvahiDiscoveryAgent : public DiscoveryAgentInterface,
   // These are shared between the threads and are protected with
   // m_masters_mu
   MasterResolverList m_masters;
+  bool m_all_for_now;
   ola::thread::Mutex m_masters_mu;
 
+  BrowseGate m_browse_gate;
+
   void RunThread(ola::thread::Future<void> *f);
 
   void StartServiceBrowser();
   void StopResolution();  // Required m_masters_mu to be held.
+  void CheckInitialBrowse();  // Required m_masters_mu to be held.
 
   void AddMaster(AvahiIfIndex interface,
                      AvahiProtocol protocol,
@@ -0,0 +1,82 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Backoff.cpp
+ * Reconnect policies for the connections to the masters.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/Backoff.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <ola/Clock.h>
+
+#include <algorithm>
+
+using ola::TimeInterval;
+
+JitteredBackoffPolicy::JitteredBackoffPolicy(const Options &options)
+    : m_options(options),
+      m_last_delay(options.initial.AsInt()),
+      m_fast_retry(false) {
+  // Every process, and every endpoint within it, needs a different sequence.
+  ola::Clock clock;
+  ola::TimeStamp now;
+  clock.CurrentTime(&now);
+  m_state = static_cast<uint32_t>(now.MicroSeconds()) ^
+            (static_cast<uint32_t>(getpid()) << 16) ^
+            static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this));
+  if (m_state == 0) {
+    m_state = 1;
+  }
+}
+
+/*
+ * The connector passes the number of failures since the last successful
+ * connect, so 1 is the first retry of a new run of attempts.
+ */
+TimeInterval JitteredBackoffPolicy::BackOffTime(
+    unsigned int failed_attempts) const {
+  const int64_t initial = m_options.initial.AsInt();
+  const int64_t maximum = std::max(m_options.maximum.AsInt(), initial);
+
+  if (failed_attempts <= 1) {
+    m_last_delay = initial;
+    if (m_fast_retry) {
+      m_fast_retry = false;
+      const int64_t fast_retry = m_options.fast_retry.AsInt();
+      if (fast_retry > 0) {
+        return TimeInterval(RandomBetween(0, fast_retry));
+      }
+    }
+  }
+
+  m_last_delay = std::min(maximum, RandomBetween(initial, m_last_delay * 3));
+  return TimeInterval(m_last_delay);
+}
+
+/*
+ * xorshift32, the quality is more than enough to spread out retries.
+ */
+int64_t JitteredBackoffPolicy::RandomBetween(int64_t low, int64_t high) const {
+  m_state ^= m_state << 13;
+  m_state ^= m_state >> 17;
+  m_state ^= m_state << 5;
+  if (high <= low) {
+    return low;
+  }
+  return low + static_cast<int64_t>(m_state % (high - low + 1));
+}
@@ -0,0 +1,81 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Backoff.h
+ * Reconnect policies for the connections to the masters.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_BACKOFF_H_
+#define SRC_BACKOFF_H_
+
+#include <stdint.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <ola/util/Backoff.h>
+
+/**
+ * @brief Exponential backoff with decorrelated jitter.
+ *
+ * Each delay is picked at random between the initial delay and three times
+ * the previous delay, capped at the maximum. Clients that lose a master at
+ * the same moment quickly drift apart, rather than retrying in lockstep.
+ *
+ * The first retry after a connection is lost uses a short random delay
+ * instead, since the master is likely to still be there.
+ *
+ * The policy holds state, so each endpoint needs its own instance.
+ */
+class JitteredBackoffPolicy : public ola::BackOffPolicy {
+ public:
+  struct Options {
+    Options()
+        : initial(0, 500000),
+          maximum(30, 0),
+          fast_retry(0, 100000) {
+    }
+
+    /** @brief The smallest delay between attempts. */
+    ola::TimeInterval initial;
+    /** @brief The largest delay between attempts. */
+    ola::TimeInterval maximum;
+    /**
+     * @brief The upper bound of the first retry after a lost connection. 0
+     * disables the fast retry.
+     */
+    ola::TimeInterval fast_retry;
+  };
+
+  explicit JitteredBackoffPolicy(const Options &options);
+
+  ola::TimeInterval BackOffTime(unsigned int failed_attempts) const;
+
+  /**
+   * @brief Called when an established connection is lost. The next retry
+   * uses the fast retry delay.
+   */
+  void ConnectionLost() { m_fast_retry = true; }
+
+ private:
+  const Options m_options;
+  mutable uint32_t m_state;
+  mutable int64_t m_last_delay;
+  mutable bool m_fast_retry;
+
+  int64_t RandomBetween(int64_t low, int64_t high) const;
+
+  DISALLOW_COPY_AND_ASSIGN(JitteredBackoffPolicy);
+};
+#endif  // SRC_BACKOFF_H_
@@ -0,0 +1,158 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * BonjourAddressCache.cpp
+ * Shares the host address lookups between Bonjour resolvers.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/BonjourAddressCache.h"
+
+#include <dns_sd.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <ola/Logging.h>
+#include <ola/network/IPV4Address.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "src/BonjourIOAdapter.h"
+#include "src/BonjourResolver.h"
+
+using ola::network::IPV4Address;
+using std::string;
+using std::vector;
+
+// Static callbacks
+static void ResolveAddressCallback(OLA_UNUSED DNSServiceRef sdRef,
+                                   DNSServiceFlags flags,
+                                   OLA_UNUSED uint32_t interface_index,
+                                   DNSServiceErrorType errorCode,
+                                   const char *hostname,
+                                   const struct sockaddr *address,
+                                   uint32_t ttl,
+                                   void *context) {
+  OLA_INFO << "ResolveAddressCallback, hostname: " << hostname
+           << ", flags: " << flags << ", errorCode: " << errorCode
+           << ", ttl:" << ttl;
+  HostLookup *lookup = reinterpret_cast<HostLookup*>(context);
+
+  if (address->sa_family != AF_INET) {
+    OLA_WARN << "Got wrong address family for " << hostname << ", was "
+             << address->sa_family;
+    return;
+  }
+
+  IPV4Address new_address;
+  if (flags & kDNSServiceFlagsAdd) {
+    const struct sockaddr_in *v4_addr =
+        reinterpret_cast<const struct sockaddr_in*>(address);
+    new_address = IPV4Address(v4_addr->sin_addr.s_addr);
+  }
+  lookup->cache->AddressChanged(lookup, new_address);
+}
+
+BonjourAddressCache::BonjourAddressCache(BonjourIOAdapter *io_adapter)
+    : m_io_adapter(io_adapter) {
+}
+
+BonjourAddressCache::~BonjourAddressCache() {
+  if (!m_lookups.empty()) {
+    OLA_WARN << m_lookups.size() << " host lookups still in progress";
+  }
+  LookupMap::iterator iter = m_lookups.begin();
+  for (; iter != m_lookups.end(); ++iter) {
+    HostLookup *lookup = iter->second;
+    if (lookup->service_ref) {
+      m_io_adapter->RemoveDescriptor(lookup->service_ref);
+      DNSServiceRefDeallocate(lookup->service_ref);
+    }
+    delete lookup;
+  }
+}
+
+void BonjourAddressCache::Subscribe(uint32_t interface_index,
+                                    const string &host,
+                                    BonjourResolver *resolver) {
+  const HostKey key(interface_index, host);
+  LookupMap::iterator iter = m_lookups.find(key);
+  HostLookup *lookup;
+  if (iter == m_lookups.end()) {
+    lookup = new HostLookup(this, host);
+    OLA_INFO << "Calling DNSServiceGetAddrInfo for " << host;
+    DNSServiceErrorType error = DNSServiceGetAddrInfo(
+        &lookup->service_ref,
+        0,
+        interface_index,
+        kDNSServiceProtocol_IPv4,
+        host.c_str(),
+        &ResolveAddressCallback,
+        reinterpret_cast<void*>(lookup));
+    if (error != kDNSServiceErr_NoError) {
+      OLA_WARN << "DNSServiceGetAddrInfo for " << host << " failed with "
+               << error;
+      delete lookup;
+      return;
+    }
+    m_io_adapter->AddDescriptor(lookup->service_ref);
+    m_lookups[key] = lookup;
+  } else {
+    lookup = iter->second;
+  }
+
+  lookup->subscribers.push_back(resolver);
+  if (lookup->has_address) {
+    resolver->UpdateAddress(lookup->address);
+  }
+}
+
+void BonjourAddressCache::Unsubscribe(uint32_t interface_index,
+                                      const string &host,
+                                      BonjourResolver *resolver) {
+  LookupMap::iterator iter = m_lookups.find(HostKey(interface_index, host));
+  if (iter == m_lookups.end()) {
+    return;
+  }
+
+  HostLookup *lookup = iter->second;
+  vector<BonjourResolver*>::iterator sub_iter = std::find(
+      lookup->subscribers.begin(), lookup->subscribers.end(), resolver);
+  if (sub_iter != lookup->subscribers.end()) {
+    lookup->subscribers.erase(sub_iter);
+  }
+
+  if (lookup->subscribers.empty()) {
+    OLA_INFO << "Stopping DNSServiceGetAddrInfo for " << host;
+    m_io_adapter->RemoveDescriptor(lookup->service_ref);
+    DNSServiceRefDeallocate(lookup->service_ref);
+    delete lookup;
+    m_lookups.erase(iter);
+  }
+}
+
+void BonjourAddressCache::AddressChanged(HostLookup *lookup,
+                                         const IPV4Address &address) {
+  lookup->address = address;
+  lookup->has_address = true;
+
+  // Copy the list, since the callbacks may change the subscriptions.
+  const vector<BonjourResolver*> subscribers = lookup->subscribers;
+  vector<BonjourResolver*>::const_iterator iter = subscribers.begin();
+  for (; iter != subscribers.end(); ++iter) {
+    (*iter)->UpdateAddress(address);
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * BonjourAddressCache.h
+ * Shares the host address lookups between Bonjour resolvers.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_BONJOURADDRESSCACHE_H_
+#define SRC_BONJOURADDRESSCACHE_H_
+
+#include <dns_sd.h>
+#include <stdint.h>
+
+#include <ola/base/Macro.h>
+#include <ola/network/IPV4Address.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class BonjourIOAdapter;
+class BonjourResolver;
+class HostLookup;
+
+/**
+ * @brief Runs one DNSServiceGetAddrInfo per host, for all the resolvers
+ * with services on that host.
+ *
+ * Each lookup is reference counted by the resolvers subscribed to it, and
+ * stopped once the last one unsubscribes. When the address of a host
+ * changes, every subscriber is updated.
+ *
+ * This must only be used on the Bonjour thread.
+ */
+class BonjourAddressCache {
+ public:
+  explicit BonjourAddressCache(BonjourIOAdapter *io_adapter);
+  ~BonjourAddressCache();
+
+  /**
+   * @brief Start receiving the address of a host.
+   *
+   * If the address is already known, the resolver is updated before this
+   * returns.
+   */
+  void Subscribe(uint32_t interface_index, const std::string &host,
+                 BonjourResolver *resolver);
+
+  /**
+   * @brief Stop receiving the address of a host.
+   */
+  void Unsubscribe(uint32_t interface_index, const std::string &host,
+                   BonjourResolver *resolver);
+
+  /**
+   * @brief The number of lookups in progress.
+   */
+  unsigned int LookupCount() const { return m_lookups.size(); }
+
+  /**
+   * @brief Called by the DNSServiceGetAddrInfo callback.
+   */
+  void AddressChanged(HostLookup *lookup,
+                      const ola::network::IPV4Address &address);
+
+ private:
+  typedef std::pair<uint32_t, std::string> HostKey;
+  typedef std::map<HostKey, HostLookup*> LookupMap;
+
+  BonjourIOAdapter *m_io_adapter;
+  LookupMap m_lookups;
+
+  DISALLOW_COPY_AND_ASSIGN(BonjourAddressCache);
+};
+
+/**
+ * @brief A single DNSServiceGetAddrInfo and the resolvers that use it.
+ */
+class HostLookup {
+ public:
+  HostLookup(BonjourAddressCache *cache, const std::string &host)
+      : cache(cache),
+        host(host),
+        service_ref(NULL),
+        has_address(false) {
+  }
+
+  BonjourAddressCache *cache;
+  const std::string host;
+  DNSServiceRef service_ref;
+  bool has_address;
+  ola::network::IPV4Address address;
+  std::vector<BonjourResolver*> subscribers;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(HostLookup);
+};
+#endif  // SRC_BONJOURADDRESSCACHE_H_
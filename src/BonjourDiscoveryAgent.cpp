@@ -36,6 +36,7 @@
 #include <string>
 #include <utility>
 
+#include "src/BonjourAddressCache.h"
 #include "src/BonjourIOAdapter.h"
 #include "src/BonjourRegistration.h"
 #include "src/BonjourResolver.h"
@@ -72,11 +73,22 @@ static void BrowseServiceCallback(DNSServiceRef service,
 // ----------------------------------------------------------------------------
 BonjourDiscoveryAgent::BonjourDiscoveryAgent(
     const DiscoveryAgentInterface::Options &options)
-    : m_master_callback(options.master_callback),
+    : m_registration_throttle(new RegistrationThrottle(
+          &m_ss,
+          ola::NewCallback(this,
+                           &BonjourDiscoveryAgent::InternalRegisterMaster),
+          options.registration_limits)),
+      m_master_callback(options.master_callback),
       m_io_adapter(new BonjourIOAdapter(&m_ss)),
+      m_address_cache(new BonjourAddressCache(m_io_adapter.get())),
       m_master_service_ref(NULL),
       m_scope(options.scope),
-      m_changing_scope(false) {
+      m_browse_domain(options.browse_domain),
+      m_registration_domain(options.registration_domain),
+      m_changing_scope(false),
+      m_browse_done(false),
+      m_browse_gate(options.initial_browse_timeout,
+                    options.browse_complete_callback) {
 }
 
 BonjourDiscoveryAgent::~BonjourDiscoveryAgent() {
@@ -84,6 +96,11 @@ BonjourDiscoveryAgent::~BonjourDiscoveryAgent() {
 }
 
 bool BonjourDiscoveryAgent::Start() {
+  m_browse_gate.Reset();
+  if (!m_master_callback.get()) {
+    m_browse_gate.Open();
+  }
+
   ola::thread::Future<bool> f;
 
   m_ss.Execute(ola::NewSingleCallback(
@@ -97,8 +114,10 @@ bool BonjourDiscoveryAgent::Start() {
   bool ok = f.Get();
   if (!ok) {
     Stop();
+    return false;
   }
-  return ok;
+  m_browse_gate.Wait();
+  return true;
 }
 
 bool BonjourDiscoveryAgent::Stop() {
@@ -112,13 +131,12 @@ bool BonjourDiscoveryAgent::Stop() {
 
 void BonjourDiscoveryAgent::RegisterMaster(
     const MasterEntry &master) {
-  m_ss.Execute(ola::NewSingleCallback(
-      this,
-      &BonjourDiscoveryAgent::InternalRegisterMaster, master));
+  m_registration_throttle->Update(master);
 }
 
 void BonjourDiscoveryAgent::DeRegisterMaster(
       const ola::network::IPV4SocketAddress &master_address) {
+  m_registration_throttle->Cancel(master_address);
   m_ss.Execute(ola::NewSingleCallback(
       this, &BonjourDiscoveryAgent::InternalDeRegisterMaster,
       master_address));
@@ -138,6 +156,10 @@ void BonjourDiscoveryAgent::BrowseResult(DNSServiceRef service_ref,
 
   if (service_ref == m_master_service_ref) {
     UpdateMaster(flags, interface_index, service_name, regtype, reply_domain);
+    if (!(flags & kDNSServiceFlagsMoreComing)) {
+      m_browse_done = true;
+      CheckInitialBrowse();
+    }
   } else {
     OLA_WARN << "Unknown DNSServiceRef " << service_ref;
   }
@@ -146,6 +168,7 @@ void BonjourDiscoveryAgent::BrowseResult(DNSServiceRef service_ref,
 void BonjourDiscoveryAgent::RunThread() {
   m_ss.Run();
 
+  m_registration_throttle->Stop();
   ola::STLDeleteValues(&m_master_registrations);
 
   {
@@ -170,7 +193,7 @@ void BonjourDiscoveryAgent::TriggerScopeChange(ola::thread::Future<bool> *f) {
         0,
         kDNSServiceInterfaceIndexAny,
         service_type.c_str(),
-        NULL,  // domain
+        m_browse_domain.empty() ? NULL : m_browse_domain.c_str(),
         &BrowseServiceCallback,
         reinterpret_cast<void*>(this));
 
@@ -205,7 +228,8 @@ void BonjourDiscoveryAgent::InternalRegisterMaster(MasterEntry master) {
           MasterRegistrationList::value_type(master.address, NULL));
 
   if (p.first->second == NULL) {
-    p.first->second = new MasterRegistration(m_io_adapter.get());
+    p.first->second = new MasterRegistration(m_io_adapter.get(),
+                                             m_registration_domain);
   }
   MasterRegistration *registration = p.first->second;
   registration->RegisterOrUpdate(master);
@@ -224,6 +248,7 @@ void BonjourDiscoveryAgent::UpdateMaster(DNSServiceFlags flags,
   if (flags & kDNSServiceFlagsAdd) {
     BonjourResolver *master = new BonjourResolver(
         m_io_adapter.get(),
+        m_address_cache.get(),
         ola::NewCallback(
             this,
             &BonjourDiscoveryAgent::MasterChanged),
@@ -242,7 +267,7 @@ void BonjourDiscoveryAgent::UpdateMaster(DNSServiceFlags flags,
       delete master;
     }
   } else {
-    BonjourResolver master(m_io_adapter.get(),
+    BonjourResolver master(m_io_adapter.get(), m_address_cache.get(),
                            NULL, interface_index,
                            service_name, regtype, reply_domain);
     MasterResolverList::iterator iter = m_masters.begin();
@@ -270,6 +295,30 @@ void BonjourDiscoveryAgent::MasterChanged(const BonjourResolver *resolver) {
 
   MutexLocker lock(&m_mutex);
   m_master_callback->Run(MASTER_ADDED, entry);
+  CheckInitialBrowse();
+}
+
+/*
+ * Bonjour doesn't say when a browse is complete, but it clears the
+ * MoreComing flag on the last of a batch of results. Once that happens and
+ * each master is resolved, the first browse is complete.
+ *
+ * If there are no masters at all, the browse doesn't return any results, so
+ * Start() waits for the full timeout. This requires m_mutex to be held.
+ */
+void BonjourDiscoveryAgent::CheckInitialBrowse() {
+  if (!m_browse_done || m_browse_gate.IsOpen()) {
+    return;
+  }
+  MasterResolverList::const_iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    if (!(*iter)->IsResolved()) {
+      return;
+    }
+  }
+  OLA_INFO << "Initial browse complete, found " << m_masters.size()
+           << " masters";
+  m_browse_gate.Open();
 }
 
 void BonjourDiscoveryAgent::RunMasterCallbacks(
@@ -35,7 +35,9 @@
 #include <string>
 #include <vector>
 
+#include "src/BrowseGate.h"
 #include "src/DiscoveryAgent.h"
+#include "src/RegistrationThrottle.h"
 
 /**
  * @brief An implementation of DiscoveryAgentInterface that uses the Apple
@@ -72,10 +74,14 @@ class BonjourDiscoveryAgent : public DiscoveryAgentInterface {
   typedef std::map<ola::network::IPV4SocketAddress,
                    class MasterRegistration*> MasterRegistrationList;
 
+  // This must outlive m_ss, which runs any queued flushes when it's
+  // destroyed.
+  std::auto_ptr<RegistrationThrottle> m_registration_throttle;
   ola::io::SelectServer m_ss;
   std::auto_ptr<MasterEventCallback> m_master_callback;
   std::auto_ptr<ola::thread::CallbackThread> m_thread;
   std::auto_ptr<class BonjourIOAdapter> m_io_adapter;
+  std::auto_ptr<class BonjourAddressCache> m_address_cache;
 
   // Masters
   DNSServiceRef m_master_service_ref;
@@ -85,17 +91,23 @@ class BonjourDiscoveryAgent : public DiscoveryAgentInterface {
   MasterResolverList m_orphaned_masters;
 
   std::string m_scope;
+  const std::string m_browse_domain;
+  const std::string m_registration_domain;
   bool m_watch_masters;
   bool m_changing_scope;
+  // True once a browse result arrives without the MoreComing flag.
+  bool m_browse_done;
   // End protected by m_mutex
 
   ola::thread::Mutex m_mutex;
+  BrowseGate m_browse_gate;
 
   MasterRegistrationList m_master_registrations;
 
   void RunThread();
   void TriggerScopeChange(ola::thread::Future<bool> *f);
   void StopResolution();
+  void CheckInitialBrowse();
 
   void InternalRegisterMaster(MasterEntry master_entry);
   void InternalDeRegisterMaster(ola::network::IPV4SocketAddress master_address);
@@ -22,6 +22,7 @@
 
 #include <dns_sd.h>
 #include <stdint.h>
+#include <ola/Clock.h>
 #include <ola/Logging.h>
 #include <ola/network/NetworkUtils.h>
 #include <ola/strings/Format.h>
@@ -30,6 +31,7 @@
 #include <vector>
 
 #include "src/BonjourIOAdapter.h"
+#include "src/DiscoveryAgent.h"
 
 using ola::network::HostToNetwork;
 using ola::network::IPV4SocketAddress;
@@ -62,8 +64,9 @@ static void RegisterCallback(OLA_UNUSED DNSServiceRef service,
   master_registration->RegisterEvent(error_code, name, type, domain);
 }
 
-// MasterRegistration
+// BonjourRegistration
 // ----------------------------------------------------------------------------
+const unsigned int BonjourRegistration::MAX_NAME_CONFLICTS;
 
 BonjourRegistration::~BonjourRegistration() {
   CancelRegistration();
@@ -92,30 +95,41 @@ bool BonjourRegistration::RegisterOrUpdateInternal(
     CancelRegistration();
   }
 
-  const string sub_service_type = GenerateE133SubType(scope, service_type);
+  // Keep any alternative name we've already settled on.
+  if (service_name != m_requested_name) {
+    m_requested_name = service_name;
+    m_service_name = service_name;
+    m_conflicts = 0;
+  }
+  m_sub_service_type = GenerateE133SubType(scope, service_type);
+  m_port = address.Port();
+  m_last_txt_data = txt_data;
+  m_scope = scope;
+  return StartRegistration();
+}
 
-  OLA_INFO << "Adding " << service_name << " : '"
-           << sub_service_type << "' :" << address.Port();
+bool BonjourRegistration::StartRegistration() {
+  OLA_INFO << "Adding " << m_service_name << " : '"
+           << m_sub_service_type << "' :" << m_port;
   DNSServiceErrorType error = DNSServiceRegister(
       &m_registration_ref,
       kDNSServiceFlagsNoAutoRename,
       0,
-      service_name.c_str(),
-      sub_service_type.c_str(),
-      NULL,  // default domain
+      m_service_name.c_str(),
+      m_sub_service_type.c_str(),
+      m_domain.empty() ? NULL : m_domain.c_str(),
       NULL,  // use default host name
-      HostToNetwork(address.Port()),
-      txt_data.size(), txt_data.c_str(),
+      HostToNetwork(m_port),
+      m_last_txt_data.size(), m_last_txt_data.c_str(),
       &RegisterCallback,  // call back function
       this);
 
   if (error != kDNSServiceErr_NoError) {
     OLA_WARN << "DNSServiceRegister returned " << error;
+    m_registration_ref = NULL;
     return false;
   }
 
-  m_last_txt_data = txt_data;
-  m_scope = scope;
   m_io_adapter->AddDescriptor(m_registration_ref);
   return true;
 }
@@ -125,11 +139,18 @@ void BonjourRegistration::RegisterEvent(
     const std::string &type, const std::string &domain) {
   switch (error_code) {
     case kDNSServiceErr_NameConflict:
-      OLA_INFO << "Name conflict";
-      CancelRegistration();
+      HandleNameConflict();
       break;
     case kDNSServiceErr_NoError:
       OLA_INFO << "Registered: " << name << "." << type << domain;
+      if (m_conflicts) {
+        ola::Clock clock;
+        ola::TimeStamp now;
+        clock.CurrentTime(&now);
+        OLA_INFO << "Resolved " << m_conflicts << " name conflicts in "
+                 << (now - m_conflict_start);
+        m_conflicts = 0;
+      }
       break;
     default:
       OLA_WARN << "DNSServiceRegister for " << name << "." << type << domain
@@ -138,6 +159,30 @@ void BonjourRegistration::RegisterEvent(
   }
 }
 
+/*
+ * We register with kDNSServiceFlagsNoAutoRename so we know the name changed,
+ * and pick the next name ourselves.
+ */
+void BonjourRegistration::HandleNameConflict() {
+  CancelRegistration();
+  if (m_conflicts == 0) {
+    ola::Clock clock;
+    clock.CurrentTime(&m_conflict_start);
+  }
+  m_conflicts++;
+  if (m_conflicts > MAX_NAME_CONFLICTS) {
+    OLA_WARN << "Giving up on registering " << m_requested_name << " after "
+             << m_conflicts << " name conflicts";
+    return;
+  }
+
+  const string name = DiscoveryAgentInterface::AlternativeServiceName(
+      m_service_name);
+  OLA_INFO << "Name conflict for " << m_service_name << ", trying " << name;
+  m_service_name = name;
+  StartRegistration();
+}
+
 void BonjourRegistration::CancelRegistration() {
   if (m_registration_ref) {
     m_io_adapter->RemoveDescriptor(m_registration_ref);
@@ -174,7 +219,7 @@ bool MasterRegistration::RegisterOrUpdate(const MasterEntry &master) {
   return RegisterOrUpdateInternal(
       DiscoveryAgentInterface::MASTER_SERVICE,
       master.scope,
-      master.ServiceName(),
+      master.service_name,
       master.address,
       BuildTxtRecord(master));
 }
@@ -198,5 +243,11 @@ string MasterRegistration::BuildTxtRecord(const MasterEntry &master) {
   records.push_back(str.str());
   str.str("");
 
+  if (master.term) {
+    str << DiscoveryAgentInterface::TERM_KEY << "=" << master.term;
+    records.push_back(str.str());
+    str.str("");
+  }
+
   return BuildTxtString(records);
 }
@@ -22,6 +22,8 @@
 #define SRC_BONJOURREGISTRATION_H_
 
 #include <dns_sd.h>
+#include <stdint.h>
+#include <ola/Clock.h>
 #include <ola/base/Macro.h>
 #include <ola/network/SocketAddress.h>
 #include <string>
@@ -34,11 +36,26 @@ class BonjourIOAdapter;
 std::string GenerateE133SubType(const std::string &scope,
                                 const std::string &service);
 
+/**
+ * @brief A service registration.
+ *
+ * If another service has the same name, we retry with an alternative name,
+ * see DiscoveryAgentInterface::AlternativeServiceName().
+ */
 class BonjourRegistration {
  public:
-  explicit BonjourRegistration(class BonjourIOAdapter *io_adapter)
+  /**
+   * @brief Create a new registration.
+   * @param io_adapter The BonjourIOAdapter to use.
+   * @param domain The domain to register in, empty for the default.
+   */
+  BonjourRegistration(class BonjourIOAdapter *io_adapter,
+                      const std::string &domain)
       : m_io_adapter(io_adapter),
-        m_registration_ref(NULL) {
+        m_domain(domain),
+        m_registration_ref(NULL),
+        m_port(0),
+        m_conflicts(0) {
   }
   virtual ~BonjourRegistration();
 
@@ -58,20 +75,37 @@ class BonjourRegistration {
 
  private:
   class BonjourIOAdapter *m_io_adapter;
+  const std::string m_domain;
   std::string m_scope;
   std::string m_last_txt_data;
   DNSServiceRef m_registration_ref;
 
+  std::string m_sub_service_type;
+  // The name we were asked to use, and the name we're registering.
+  std::string m_requested_name;
+  std::string m_service_name;
+  uint16_t m_port;
+
+  // The name conflicts since the last successful registration.
+  unsigned int m_conflicts;
+  ola::TimeStamp m_conflict_start;
+
+  bool StartRegistration();
+  void HandleNameConflict();
   void CancelRegistration();
   bool UpdateRecord(const std::string &txt_data);
 
+  // Give up after this many conflicts in a row.
+  static const unsigned int MAX_NAME_CONFLICTS = 32;
+
   DISALLOW_COPY_AND_ASSIGN(BonjourRegistration);
 };
 
 class MasterRegistration : public BonjourRegistration {
  public:
-  explicit MasterRegistration(class BonjourIOAdapter *io_adapter)
-      : BonjourRegistration(io_adapter) {
+  MasterRegistration(class BonjourIOAdapter *io_adapter,
+                     const std::string &domain)
+      : BonjourRegistration(io_adapter, domain) {
   }
   ~MasterRegistration() {}
 
@@ -24,128 +24,179 @@
 #include <netinet/in.h>
 #include <stdint.h>
 #include <ola/Logging.h>
-#include <ola/network/NetworkUtils.h>
 #include <ola/StringUtils.h>
 
 #include <string>
 
+#include "src/BonjourAddressCache.h"
 #include "src/BonjourIOAdapter.h"
 
 using ola::network::IPV4Address;
 using ola::network::IPV4SocketAddress;
-using ola::network::NetworkToHost;
 using std::auto_ptr;
 using std::string;
 
 const uint8_t BonjourResolver::DEFAULT_PRIORITY = 100;
 
 // Static callbacks
-static void ResolveServiceCallback(OLA_UNUSED DNSServiceRef sdRef,
-                                   OLA_UNUSED DNSServiceFlags flags,
-                                   OLA_UNUSED uint32_t interface_index,
-                                   DNSServiceErrorType errorCode,
-                                   OLA_UNUSED const char *fullname,
-                                   const char *hosttarget,
-                                   uint16_t port, /* In network byte order */
-                                   uint16_t txt_length,
-                                   const unsigned char *txt_data,
-                                   void *context) {
-  OLA_INFO << "ResolveServiceCallback";
+static void QueryRecordCallback(OLA_UNUSED DNSServiceRef sdRef,
+                                DNSServiceFlags flags,
+                                OLA_UNUSED uint32_t interface_index,
+                                DNSServiceErrorType errorCode,
+                                OLA_UNUSED const char *fullname,
+                                uint16_t rrtype,
+                                OLA_UNUSED uint16_t rrclass,
+                                uint16_t rdlen,
+                                const void *rdata,
+                                OLA_UNUSED uint32_t ttl,
+                                void *context) {
   BonjourResolver *resolver = reinterpret_cast<BonjourResolver*>(context);
-  resolver->ResolveHandler(
-      errorCode, hosttarget, NetworkToHost(port), txt_length, txt_data);
-}
-
-static void ResolveAddressCallback(OLA_UNUSED DNSServiceRef sdRef,
-                                   OLA_UNUSED DNSServiceFlags flags,
-                                   OLA_UNUSED uint32_t interface_index,
-                                   OLA_UNUSED DNSServiceErrorType errorCode,
-                                   const char *hostname,
-                                   OLA_UNUSED const struct sockaddr *address,
-                                   OLA_UNUSED uint32_t ttl,
-                                   void *context) {
-  OLA_INFO << "ResolveAddressCallback, hostname: " << hostname
-           << ", flags: " << flags << ", errorCode: " << errorCode
-           << ", ttl:" << ttl;
-  BonjourResolver *resolver = reinterpret_cast<BonjourResolver*>(context);
-
-  if (address->sa_family != AF_INET) {
-    OLA_WARN << "Got wrong address family for " << hostname << ", was "
-             << address->sa_family;
+  if (errorCode != kDNSServiceErr_NoError) {
+    OLA_WARN << "Failed to resolve " << resolver->ToString() << ", error "
+             << errorCode;
+    return;
+  }
+  if (!(flags & kDNSServiceFlagsAdd)) {
+    // The browse tells us when the service goes away.
     return;
   }
 
-  IPV4Address new_address;
-  if (flags & kDNSServiceFlagsAdd) {
-    const struct sockaddr_in *v4_addr =
-        reinterpret_cast<const struct sockaddr_in*>(address);
-    new_address = IPV4Address(v4_addr->sin_addr.s_addr);
+  const unsigned char *data = reinterpret_cast<const unsigned char*>(rdata);
+  if (rrtype == kDNSServiceType_SRV) {
+    resolver->SRVHandler(rdlen, data);
+  } else if (rrtype == kDNSServiceType_TXT) {
+    resolver->TXTHandler(rdlen, data);
   }
-  resolver->UpdateAddress(new_address);
+}
+
+/*
+ * Convert a name in DNS wire format to the dotted form, with a trailing '.'.
+ */
+static bool UnpackDomainName(const unsigned char *data, unsigned int length,
+                             string *name) {
+  name->clear();
+  unsigned int offset = 0;
+  while (offset < length) {
+    const unsigned int label_length = data[offset++];
+    if (label_length == 0) {
+      return !name->empty();
+    }
+    if (offset + label_length > length) {
+      return false;
+    }
+    for (unsigned int i = 0; i < label_length; i++) {
+      const char c = static_cast<char>(data[offset + i]);
+      if (c == '.' || c == '\\') {
+        name->push_back('\\');
+      }
+      name->push_back(c);
+    }
+    name->push_back('.');
+    offset += label_length;
+  }
+  return false;
 }
 
 BonjourResolver::BonjourResolver(
     BonjourIOAdapter *io_adapter,
+    BonjourAddressCache *address_cache,
     ChangeCallback *callback,
     uint32_t interface_index,
     const string &service_name,
     const string &regtype,
     const string &reply_domain)
     : m_io_adapter(io_adapter),
+      m_address_cache(address_cache),
       m_callback(callback),
-      m_resolve_in_progress(false),
-      to_addr_in_progress(false),
+      m_srv_ref(NULL),
+      m_txt_ref(NULL),
       interface_index(interface_index),
       service_name(service_name),
       regtype(regtype),
-      reply_domain(reply_domain) {
+      reply_domain(reply_domain),
+      m_has_txt(false),
+      m_has_address(false),
+      m_term(0) {
 }
 
 BonjourResolver::~BonjourResolver() {
-  if (m_resolve_in_progress) {
-    m_io_adapter->RemoveDescriptor(m_resolve_ref);
-    DNSServiceRefDeallocate(m_resolve_ref);
-  }
+  StopQuery(&m_srv_ref);
+  StopQuery(&m_txt_ref);
 
-  if (to_addr_in_progress) {
-    m_io_adapter->RemoveDescriptor(m_to_addr_ref);
-    DNSServiceRefDeallocate(m_to_addr_ref);
+  if (!m_host_target.empty()) {
+    m_address_cache->Unsubscribe(interface_index, m_host_target, this);
   }
 }
 
+/*
+ * DNSServiceResolve returns the SRV and TXT records together, and only then
+ * can the address lookup start. Instead we query for the SRV and TXT records
+ * separately, and look up the address as soon as the SRV record arrives, so
+ * the address and TXT queries run in parallel.
+ */
 DNSServiceErrorType BonjourResolver::StartResolution() {
-  if (m_resolve_in_progress) {
+  if (m_srv_ref) {
     return kDNSServiceErr_NoError;
   }
 
-  DNSServiceErrorType error = DNSServiceResolve(
-      &m_resolve_ref,
-      0,
-      interface_index,
-      service_name.c_str(),
-      regtype.c_str(),
-      reply_domain.c_str(),
-      &ResolveServiceCallback,
-      reinterpret_cast<void*>(this));
-  if (error == kDNSServiceErr_NoError) {
-    m_resolve_in_progress = true;
-    m_io_adapter->AddDescriptor(m_resolve_ref);
+  char full_name[kDNSServiceMaxDomainName];
+  DNSServiceErrorType error = DNSServiceConstructFullName(
+      full_name, service_name.c_str(), regtype.c_str(),
+      reply_domain.c_str());
+  if (error != kDNSServiceErr_NoError) {
+    return error;
+  }
+
+  error = StartQuery(full_name, kDNSServiceType_SRV, &m_srv_ref);
+  if (error != kDNSServiceErr_NoError) {
+    return error;
+  }
+
+  error = StartQuery(full_name, kDNSServiceType_TXT, &m_txt_ref);
+  if (error != kDNSServiceErr_NoError) {
+    StopQuery(&m_srv_ref);
   }
   return error;
 }
 
-void BonjourResolver::ResolveHandler(
-    DNSServiceErrorType errorCode,
-    const string &host_target,
-    uint16_t port,
-    uint16_t txt_length,
-    const unsigned char *txt_data) {
-  if (errorCode != kDNSServiceErr_NoError) {
-    OLA_WARN << "Failed to resolve " << this->ToString();
+void BonjourResolver::SRVHandler(uint16_t rdlen, const unsigned char *rdata) {
+  // Priority, weight & port, followed by the target.
+  static const unsigned int SRV_HEADER_SIZE = 6;
+  string host_target;
+  if (rdlen <= SRV_HEADER_SIZE ||
+      !UnpackDomainName(rdata + SRV_HEADER_SIZE, rdlen - SRV_HEADER_SIZE,
+                        &host_target)) {
+    OLA_WARN << "Invalid SRV record for " << ToString();
     return;
   }
+  const uint16_t port = (rdata[4] << 8) + rdata[5];
 
-  OLA_INFO << "Got resolv response " << host_target << ":" << port;
+  OLA_INFO << "Got SRV response " << host_target << ":" << port;
+
+  const bool port_changed = port != m_resolved_address.Port();
+  m_resolved_address.Port(port);
+
+  if (host_target == m_host_target) {
+    if (port_changed && IsResolved()) {
+      RunCallback();
+    }
+    return;
+  }
+
+  // The service moved to a different host. The address from the cache may
+  // arrive before we return.
+  if (!m_host_target.empty()) {
+    m_address_cache->Unsubscribe(interface_index, m_host_target, this);
+  }
+  m_has_address = false;
+  m_resolved_address.Host(IPV4Address());
+  m_host_target = host_target;
+  m_address_cache->Subscribe(interface_index, m_host_target, this);
+}
+
+void BonjourResolver::TXTHandler(uint16_t txt_length,
+                                 const unsigned char *txt_data) {
+  OLA_INFO << "Got TXT response for " << service_name;
 
   if (!CheckVersionMatches(txt_length, txt_data,
                            DiscoveryAgentInterface::TXT_VERSION_KEY,
@@ -162,34 +213,9 @@ void BonjourResolver::ResolveHandler(
     return;
   }
 
-  m_resolved_address.Port(port);
-
-  if (host_target == m_host_target) {
-    return;
-  }
-  m_host_target = host_target;
-
-  // Otherwise start a new resolution
-  if (to_addr_in_progress) {
-    m_io_adapter->RemoveDescriptor(m_to_addr_ref);
-    DNSServiceRefDeallocate(m_to_addr_ref);
-  }
-
-  OLA_INFO << "Calling DNSServiceGetAddrInfo for " << m_host_target;
-  DNSServiceErrorType error = DNSServiceGetAddrInfo(
-      &m_to_addr_ref,
-      0,
-      interface_index,
-      kDNSServiceProtocol_IPv4,
-      m_host_target.c_str(),
-      &ResolveAddressCallback,
-      reinterpret_cast<void*>(this));
-
-  if (error == kDNSServiceErr_NoError) {
-    m_io_adapter->AddDescriptor(m_to_addr_ref);
-  } else {
-    OLA_WARN << "DNSServiceGetAddrInfo for " << m_host_target
-             << " failed with " << error;
+  m_has_txt = true;
+  if (IsResolved()) {
+    RunCallback();
   }
 }
 
@@ -197,7 +223,12 @@ void BonjourResolver::UpdateAddress(
     const ola::network::IPV4Address &v4_address) {
   OLA_INFO << "Resolved address for " << service_name << " is " << v4_address;
   m_resolved_address.Host(v4_address);
-  RunCallback();
+  // The wildcard address means the address record was removed, pass that on
+  // to the agent as well.
+  m_has_address = !v4_address.IsWildcard();
+  if (m_has_txt) {
+    RunCallback();
+  }
 }
 
 void BonjourResolver::GetMasterEntry(MasterEntry *entry) const {
@@ -205,6 +236,7 @@ void BonjourResolver::GetMasterEntry(MasterEntry *entry) const {
   entry->address = ResolvedAddress();
   entry->priority = m_priority;
   entry->scope = Scope();
+  entry->term = m_term;
 }
 
 bool BonjourResolver::ProcessTxtData(uint16_t txt_length,
@@ -215,7 +247,18 @@ bool BonjourResolver::ProcessTxtData(uint16_t txt_length,
     return false;
   }
 
+  // The term is optional, masters which have never been elected don't set
+  // it.
+  unsigned int term = 0;
+  if (TXTRecordContainsKey(txt_length, txt_data,
+                           DiscoveryAgentInterface::TERM_KEY) &&
+      !ExtractInt(txt_length, txt_data, DiscoveryAgentInterface::TERM_KEY,
+                  &term)) {
+    return false;
+  }
+
   m_priority = static_cast<uint8_t>(priority);
+  m_term = term;
   return true;
 }
 
@@ -273,6 +316,34 @@ bool BonjourResolver::CheckVersionMatches(
   return true;
 }
 
+DNSServiceErrorType BonjourResolver::StartQuery(const char *full_name,
+                                                uint16_t rrtype,
+                                                DNSServiceRef *service_ref) {
+  DNSServiceErrorType error = DNSServiceQueryRecord(
+      service_ref,
+      0,
+      interface_index,
+      full_name,
+      rrtype,
+      kDNSServiceClass_IN,
+      &QueryRecordCallback,
+      reinterpret_cast<void*>(this));
+  if (error == kDNSServiceErr_NoError) {
+    m_io_adapter->AddDescriptor(*service_ref);
+  } else {
+    *service_ref = NULL;
+  }
+  return error;
+}
+
+void BonjourResolver::StopQuery(DNSServiceRef *service_ref) {
+  if (*service_ref) {
+    m_io_adapter->RemoveDescriptor(*service_ref);
+    DNSServiceRefDeallocate(*service_ref);
+    *service_ref = NULL;
+  }
+}
+
 void BonjourResolver::RunCallback() {
   if (m_callback) {
     m_callback->Run(this);
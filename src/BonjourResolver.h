@@ -32,6 +32,7 @@
 
 #include "src/MasterEntry.h"
 
+class BonjourAddressCache;
 class BonjourIOAdapter;
 
 class BonjourResolver {
@@ -39,6 +40,7 @@ class BonjourResolver {
   typedef ola::Callback1<void, const BonjourResolver*> ChangeCallback;
 
   BonjourResolver(BonjourIOAdapter *io_adapter,
+                  BonjourAddressCache *address_cache,
                   ChangeCallback *callback,
                   uint32_t interface_index,
                   const std::string &service_name,
@@ -69,12 +71,19 @@ class BonjourResolver {
 
   DNSServiceErrorType StartResolution();
 
-  void ResolveHandler(DNSServiceErrorType errorCode,
-                      const std::string &host_target,
-                      uint16_t port,
-                      uint16_t txt_length,
-                      const unsigned char *txt_data);
+  /**
+   * @brief Called with the rdata of each SRV record.
+   */
+  void SRVHandler(uint16_t rdlen, const unsigned char *rdata);
+
+  /**
+   * @brief Called with the rdata of each TXT record.
+   */
+  void TXTHandler(uint16_t txt_length, const unsigned char *txt_data);
 
+  /**
+   * @brief Called by the BonjourAddressCache when the host's address changes.
+   */
   void UpdateAddress(const ola::network::IPV4Address &v4_address);
 
   std::string ServiceName() const { return service_name; }
@@ -85,25 +94,32 @@ class BonjourResolver {
     return m_resolved_address;
   }
 
+  /**
+   * @brief True once the SRV, TXT and address records have all arrived. The
+   * callback only runs after this.
+   */
+  bool IsResolved() const { return m_has_txt && m_has_address; }
+
   void GetMasterEntry(MasterEntry *entry) const;
 
  private:
   BonjourIOAdapter *m_io_adapter;
+  BonjourAddressCache *m_address_cache;
   ChangeCallback *m_callback;
-  bool m_resolve_in_progress;
-  DNSServiceRef m_resolve_ref;
-
-  bool to_addr_in_progress;
-  DNSServiceRef m_to_addr_ref;
+  DNSServiceRef m_srv_ref;
+  DNSServiceRef m_txt_ref;
 
   uint32_t interface_index;
   const std::string service_name;
   const std::string regtype;
   const std::string reply_domain;
   std::string m_host_target;
+  bool m_has_txt;
+  bool m_has_address;
 
   std::string m_scope;
   uint8_t m_priority;
+  uint32_t m_term;
 
   ola::network::IPV4SocketAddress m_resolved_address;
 
@@ -124,6 +140,9 @@ class BonjourResolver {
     const std::string &key,
     unsigned int version);
 
+  DNSServiceErrorType StartQuery(const char *full_name, uint16_t rrtype,
+                                 DNSServiceRef *service_ref);
+  void StopQuery(DNSServiceRef *service_ref);
   void RunCallback();
 
   static const uint8_t DEFAULT_PRIORITY;
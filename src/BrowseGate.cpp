@@ -0,0 +1,94 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * BrowseGate.cpp
+ * Lets DiscoveryAgent::Start() wait for the first browse to complete.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/BrowseGate.h"
+
+#include <ola/Clock.h>
+#include <ola/thread/Mutex.h>
+
+using ola::TimeInterval;
+using ola::TimeStamp;
+using ola::thread::MutexLocker;
+
+namespace {
+TimeStamp GetTime() {
+  ola::Clock clock;
+  TimeStamp now;
+  clock.CurrentTime(&now);
+  return now;
+}
+}  // namespace
+
+BrowseGate::BrowseGate(
+    const TimeInterval &timeout,
+    DiscoveryAgentInterface::BrowseCompleteCallback *callback)
+    : m_timeout(timeout),
+      m_callback(callback),
+      m_open(false) {
+}
+
+BrowseGate::~BrowseGate() {
+  delete m_callback;
+}
+
+void BrowseGate::Reset() {
+  MutexLocker lock(&m_mu);
+  m_start = GetTime();
+  m_open = false;
+}
+
+void BrowseGate::Open() {
+  MutexLocker lock(&m_mu);
+  if (!m_open) {
+    m_open = true;
+    m_condition.Broadcast();
+  }
+}
+
+bool BrowseGate::IsOpen() {
+  MutexLocker lock(&m_mu);
+  return m_open;
+}
+
+void BrowseGate::Wait() {
+  if (m_timeout == TimeInterval()) {
+    return;
+  }
+
+  bool open;
+  TimeStamp start;
+  {
+    MutexLocker lock(&m_mu);
+    const TimeStamp deadline = m_start + m_timeout;
+    while (!m_open) {
+      if (!m_condition.TimedWait(&m_mu, deadline)) {
+        break;
+      }
+    }
+    open = m_open;
+    start = m_start;
+  }
+
+  if (m_callback) {
+    DiscoveryAgentInterface::BrowseCompleteCallback *callback = m_callback;
+    m_callback = NULL;
+    callback->Run(open, GetTime() - start);
+  }
+}
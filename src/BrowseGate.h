@@ -0,0 +1,80 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * BrowseGate.h
+ * Lets DiscoveryAgent::Start() wait for the first browse to complete.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_BROWSEGATE_H_
+#define SRC_BROWSEGATE_H_
+
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <ola/thread/Mutex.h>
+
+#include "src/DiscoveryAgent.h"
+
+/**
+ * @brief Blocks Start() until the agent's first browse completes.
+ *
+ * The agent calls Open() from its DNS-SD thread once it has seen every
+ * master that was around when the browse started, and has resolved them.
+ */
+class BrowseGate {
+ public:
+  /**
+   * @brief Create a new BrowseGate.
+   * @param timeout The longest time to wait, 0 means don't wait.
+   * @param callback Run when Wait() returns, ownership is transferred. May
+   *   be NULL.
+   */
+  BrowseGate(const ola::TimeInterval &timeout,
+             DiscoveryAgentInterface::BrowseCompleteCallback *callback);
+  ~BrowseGate();
+
+  /**
+   * @brief Close the gate and start the clock, called when the browse
+   * starts.
+   */
+  void Reset();
+
+  /**
+   * @brief Open the gate, this can be called from any thread.
+   */
+  void Open();
+
+  /**
+   * @brief True if Open() has been called since the last Reset().
+   */
+  bool IsOpen();
+
+  /**
+   * @brief Wait for the gate to open, up to the timeout, then run the
+   * callback.
+   */
+  void Wait();
+
+ private:
+  const ola::TimeInterval m_timeout;
+  DiscoveryAgentInterface::BrowseCompleteCallback *m_callback;
+  ola::thread::Mutex m_mu;
+  ola::thread::ConditionVariable m_condition;
+  ola::TimeStamp m_start;  // Protected by m_mu
+  bool m_open;  // Protected by m_mu
+
+  DISALLOW_COPY_AND_ASSIGN(BrowseGate);
+};
+#endif  // SRC_BROWSEGATE_H_
@@ -0,0 +1,46 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * CPUTime.cpp
+ * Read the CPU time used by the process.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/CPUTime.h"
+
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <ola/Clock.h>
+
+using ola::TimeInterval;
+
+namespace {
+
+int64_t ToMicroSeconds(const struct timeval &tv) {
+  return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+}  // namespace
+
+TimeInterval ProcessCPUTime() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0) {
+    return TimeInterval();
+  }
+  // Sum in microseconds, the two tv_usec fields can add up to more than a
+  // second.
+  return TimeInterval(ToMicroSeconds(usage.ru_utime) +
+                      ToMicroSeconds(usage.ru_stime));
+}
@@ -0,0 +1,184 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ClientConnection.cpp
+ * A connection from a client to the master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/ClientConnection.h"
+
+#include <errno.h>
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/io/Descriptor.h>
+#include <ola/strings/Format.h>
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::network::TCPSocket;
+using ola::strings::ToHex;
+
+ClientConnection::ClientConnection(ola::io::SelectServerInterface *ss,
+                                   TCPSocket *socket,
+                                   unsigned int high_water_mark)
+    : m_ss(ss),
+      m_socket(socket),
+      m_high_water_mark(high_water_mark),
+      m_reader(NewCallback(this, &ClientConnection::HandleFrame)),
+      m_queued_bytes(0),
+      m_write_registered(false),
+      m_closed(false),
+      m_slot(0) {
+  ola::io::ConnectedDescriptor::SetNonBlocking(m_socket->WriteDescriptor());
+  m_socket->SetOnData(NewCallback(this, &ClientConnection::ReceiveData));
+  m_socket->SetOnWritable(NewCallback(this, &ClientConnection::PerformWrite));
+  m_socket->SetOnClose(NewSingleCallback(this,
+                                         &ClientConnection::SocketClosed));
+  m_ss->AddReadDescriptor(m_socket.get());
+}
+
+ClientConnection::~ClientConnection() {
+  if (m_write_registered) {
+    m_ss->RemoveWriteDescriptor(m_socket.get());
+  }
+  m_ss->RemoveReadDescriptor(m_socket.get());
+  m_socket->Close();
+
+  BufferQueue::iterator iter = m_queue.begin();
+  for (; iter != m_queue.end(); ++iter) {
+    iter->buffer->DeRef();
+  }
+}
+
+void ClientConnection::SetOnClose(CloseCallback *callback) {
+  m_on_close.reset(callback);
+}
+
+void ClientConnection::SetOnMessage(MessageCallback *callback) {
+  m_on_message.reset(callback);
+}
+
+bool ClientConnection::Send(SharedBuffer *buffer) {
+  if (m_closed) {
+    return false;
+  }
+
+  unsigned int sent = 0;
+  if (m_queue.empty()) {
+    // Fast path, try to write it now.
+    if (!Write(buffer->Data(), buffer->Size(), &sent)) {
+      return false;
+    }
+    if (sent == buffer->Size()) {
+      return true;
+    }
+  }
+
+  if (m_queued_bytes + buffer->Size() - sent > m_high_water_mark) {
+    OLA_WARN << "Client on " << m_socket->GetPeerAddress()
+             << " has exceeded the high water mark with " << m_queued_bytes
+             << " bytes queued";
+    return false;
+  }
+  Enqueue(buffer, sent);
+  return true;
+}
+
+/*
+ * Returns false if the connection has failed.
+ */
+bool ClientConnection::Write(const uint8_t *data, unsigned int length,
+                             unsigned int *sent) {
+  ssize_t bytes_sent = m_socket->Send(data, length);
+  if (bytes_sent < 0) {
+    *sent = 0;
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+  *sent = bytes_sent;
+  return true;
+}
+
+void ClientConnection::Enqueue(SharedBuffer *buffer, unsigned int offset) {
+  buffer->Ref();
+  PendingBuffer pending = {buffer, offset};
+  m_queue.push_back(pending);
+  m_queued_bytes += buffer->Size() - offset;
+
+  if (!m_write_registered) {
+    m_ss->AddWriteDescriptor(m_socket.get());
+    m_write_registered = true;
+  }
+}
+
+void ClientConnection::PerformWrite() {
+  while (!m_queue.empty()) {
+    PendingBuffer &pending = m_queue.front();
+    const unsigned int remaining = pending.buffer->Size() - pending.offset;
+    unsigned int sent = 0;
+    if (!Write(pending.buffer->Data() + pending.offset, remaining, &sent)) {
+      OLA_INFO << "Write to " << m_socket->GetPeerAddress() << " failed";
+      RunCloseCallback();
+      return;
+    }
+
+    m_queued_bytes -= sent;
+    if (sent < remaining) {
+      pending.offset += sent;
+      return;
+    }
+    pending.buffer->DeRef();
+    m_queue.pop_front();
+  }
+
+  m_ss->RemoveWriteDescriptor(m_socket.get());
+  m_write_registered = false;
+}
+
+void ClientConnection::ReceiveData() {
+  if (m_closed) {
+    return;
+  }
+  if (!m_reader.ReadFrom(m_socket.get())) {
+    OLA_INFO << "Bad data from " << m_socket->GetPeerAddress();
+    RunCloseCallback();
+  }
+}
+
+void ClientConnection::HandleFrame(uint8_t type, const uint8_t *payload,
+                                   unsigned int length) {
+  if (m_on_message.get()) {
+    m_on_message->Run(type, payload, length);
+  } else {
+    OLA_INFO << "Unexpected message " << ToHex(type) << " from "
+             << m_socket->GetPeerAddress();
+  }
+}
+
+void ClientConnection::SocketClosed() {
+  RunCloseCallback();
+}
+
+/*
+ * The callback may delete this object, so this must be the last thing that
+ * is done.
+ */
+void ClientConnection::RunCloseCallback() {
+  m_closed = true;
+  CloseCallback *callback = m_on_close.release();
+  if (callback) {
+    callback->Run();
+  }
+}
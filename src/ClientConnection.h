@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ClientConnection.h
+ * A connection from a client to the master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_CLIENTCONNECTION_H_
+#define SRC_CLIENTCONNECTION_H_
+
+#include <ola/Callback.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServerInterface.h>
+#include <ola/network/TCPSocket.h>
+#include <deque>
+#include <memory>
+
+#include "src/MasterProtocol.h"
+#include "src/SharedBuffer.h"
+
+/**
+ * @brief A connection from a client, as seen by the master.
+ *
+ * Outgoing data is written without blocking. Whatever can't be written
+ * immediately is queued, and the queue is drained when the socket becomes
+ * writable. Queued data is held as references to SharedBuffers, so the same
+ * message can be queued on many connections without copying it.
+ *
+ * Incoming data is split into frames, see MasterProtocol.
+ */
+class ClientConnection {
+ public:
+  typedef ola::SingleUseCallback0<void> CloseCallback;
+  typedef ola::Callback3<void, uint8_t, const uint8_t*, unsigned int>
+      MessageCallback;
+
+  /**
+   * @brief Create a new ClientConnection.
+   * @param ss The SelectServer to use.
+   * @param socket The connected socket, ownership is transferred.
+   * @param high_water_mark The maximum number of bytes to queue.
+   */
+  ClientConnection(ola::io::SelectServerInterface *ss,
+                   ola::network::TCPSocket *socket,
+                   unsigned int high_water_mark);
+  ~ClientConnection();
+
+  /**
+   * @brief Set the callback to run when the connection fails.
+   *
+   * This is run when the remote end closes the connection or a write fails.
+   * The callback may delete the ClientConnection. Ownership is transferred.
+   */
+  void SetOnClose(CloseCallback *callback);
+
+  /**
+   * @brief Set the callback to run when a frame is received.
+   *
+   * The callback must not delete the ClientConnection. Ownership is
+   * transferred.
+   */
+  void SetOnMessage(MessageCallback *callback);
+
+  /**
+   * @brief Send a buffer to the client.
+   * @returns false if the connection has failed, or the client isn't keeping
+   *   up and the queue would exceed the high water mark. In either case the
+   *   caller should close the connection.
+   */
+  bool Send(SharedBuffer *buffer);
+
+  unsigned int QueuedBytes() const { return m_queued_bytes; }
+
+  ola::network::TCPSocket *Socket() { return m_socket.get(); }
+
+  /**
+   * @brief The connection's position in the ConnectionTable.
+   */
+  unsigned int Slot() const { return m_slot; }
+  void SetSlot(unsigned int slot) { m_slot = slot; }
+
+ private:
+  struct PendingBuffer {
+    SharedBuffer *buffer;
+    unsigned int offset;
+  };
+
+  typedef std::deque<PendingBuffer> BufferQueue;
+
+  ola::io::SelectServerInterface *m_ss;
+  std::auto_ptr<ola::network::TCPSocket> m_socket;
+  const unsigned int m_high_water_mark;
+  std::auto_ptr<CloseCallback> m_on_close;
+  std::auto_ptr<MessageCallback> m_on_message;
+  FrameReader m_reader;
+
+  BufferQueue m_queue;
+  unsigned int m_queued_bytes;
+  bool m_write_registered;
+  bool m_closed;
+  unsigned int m_slot;
+
+  bool Write(const uint8_t *data, unsigned int length, unsigned int *sent);
+  void Enqueue(SharedBuffer *buffer, unsigned int offset);
+  void PerformWrite();
+  void ReceiveData();
+  void HandleFrame(uint8_t type, const uint8_t *payload, unsigned int length);
+  void SocketClosed();
+  void RunCloseCallback();
+
+  DISALLOW_COPY_AND_ASSIGN(ClientConnection);
+};
+#endif  // SRC_CLIENTCONNECTION_H_
@@ -0,0 +1,50 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ConnectionTable.cpp
+ * Tracks the connections to a master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/ConnectionTable.h"
+
+#include <ola/stl/STLUtils.h>
+
+ConnectionTable::~ConnectionTable() {
+  Clear();
+}
+
+void ConnectionTable::Add(ClientConnection *connection) {
+  connection->SetSlot(m_connections.size());
+  m_connections.push_back(connection);
+}
+
+bool ConnectionTable::Remove(ClientConnection *connection) {
+  const unsigned int slot = connection->Slot();
+  if (slot >= m_connections.size() || m_connections[slot] != connection) {
+    return false;
+  }
+
+  ClientConnection *last = m_connections.back();
+  m_connections[slot] = last;
+  last->SetSlot(slot);
+  m_connections.pop_back();
+  delete connection;
+  return true;
+}
+
+void ConnectionTable::Clear() {
+  ola::STLDeleteElements(&m_connections);
+}
@@ -0,0 +1,81 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ConnectionTable.h
+ * Tracks the connections to a master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_CONNECTIONTABLE_H_
+#define SRC_CONNECTIONTABLE_H_
+
+#include <ola/base/Macro.h>
+#include <vector>
+
+#include "src/ClientConnection.h"
+
+/**
+ * @brief The set of open ClientConnections.
+ *
+ * Connections are kept in a contiguous array so that sending to all of them
+ * is a linear walk. Each connection records its slot in the array, so
+ * adding and removing a connection is O(1): a removed connection is replaced
+ * by the one in the last slot.
+ *
+ * Removing connections invalidates iterators.
+ */
+class ConnectionTable {
+ public:
+  typedef std::vector<ClientConnection*>::const_iterator const_iterator;
+
+  ConnectionTable() {}
+
+  /**
+   * @brief Destroy the table, this deletes all the connections.
+   */
+  ~ConnectionTable();
+
+  /**
+   * @brief Pre-allocate space for a number of connections.
+   */
+  void Reserve(unsigned int size) { m_connections.reserve(size); }
+
+  /**
+   * @brief Add a connection, ownership is transferred.
+   */
+  void Add(ClientConnection *connection);
+
+  /**
+   * @brief Remove and delete a connection.
+   * @returns false if the connection wasn't in the table.
+   */
+  bool Remove(ClientConnection *connection);
+
+  /**
+   * @brief Delete all connections.
+   */
+  void Clear();
+
+  unsigned int Size() const { return m_connections.size(); }
+
+  const_iterator begin() const { return m_connections.begin(); }
+  const_iterator end() const { return m_connections.end(); }
+
+ private:
+  std::vector<ClientConnection*> m_connections;
+
+  DISALLOW_COPY_AND_ASSIGN(ConnectionTable);
+};
+#endif  // SRC_CONNECTIONTABLE_H_
@@ -0,0 +1,127 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ConsistentHashRing.cpp
+ * Map keys onto a changing set of nodes.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/ConsistentHashRing.h"
+
+#include <stdint.h>
+
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+const unsigned int ConsistentHashRing::DEFAULT_POINTS;
+
+ConsistentHashRing::ConsistentHashRing(unsigned int points)
+    : m_points(points ? points : 1) {
+}
+
+void ConsistentHashRing::Add(const string &node) {
+  if (!m_nodes.insert(node).second) {
+    return;
+  }
+  for (unsigned int i = 0; i < m_points; i++) {
+    // On the rare collision, the first node keeps the point.
+    m_ring.insert(PointMap::value_type(PointHash(node, i), node));
+  }
+}
+
+void ConsistentHashRing::Remove(const string &node) {
+  if (m_nodes.erase(node) == 0) {
+    return;
+  }
+  for (unsigned int i = 0; i < m_points; i++) {
+    PointMap::iterator iter = m_ring.find(PointHash(node, i));
+    if (iter != m_ring.end() && iter->second == node) {
+      m_ring.erase(iter);
+    }
+  }
+}
+
+void ConsistentHashRing::Clear() {
+  m_nodes.clear();
+  m_ring.clear();
+}
+
+bool ConsistentHashRing::Owner(const string &key, string *node) const {
+  if (m_ring.empty()) {
+    return false;
+  }
+  PointMap::const_iterator iter = m_ring.lower_bound(Hash(key));
+  if (iter == m_ring.end()) {
+    iter = m_ring.begin();
+  }
+  *node = iter->second;
+  return true;
+}
+
+void ConsistentHashRing::Successors(const string &key, unsigned int count,
+                                    vector<string> *nodes) const {
+  nodes->clear();
+  if (m_ring.empty()) {
+    return;
+  }
+  if (count > m_nodes.size()) {
+    count = m_nodes.size();
+  }
+
+  std::set<string> seen;
+  PointMap::const_iterator start = m_ring.lower_bound(Hash(key));
+  PointMap::const_iterator iter = start;
+  do {
+    if (iter == m_ring.end()) {
+      iter = m_ring.begin();
+      if (iter == start) {
+        break;
+      }
+    }
+    if (seen.insert(iter->second).second) {
+      nodes->push_back(iter->second);
+    }
+    ++iter;
+  } while (nodes->size() < count && iter != start);
+}
+
+uint64_t ConsistentHashRing::Hash(const string &value) {
+  uint64_t hash = 14695981039346656037ULL;
+  string::const_iterator iter = value.begin();
+  for (; iter != value.end(); ++iter) {
+    hash ^= static_cast<uint8_t>(*iter);
+    hash *= 1099511628211ULL;
+  }
+  // FNV alone clusters similar strings, mix the bits with MurmurHash3's
+  // fmix64 before they're placed on the ring.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint64_t ConsistentHashRing::PointHash(const string &node,
+                                       unsigned int point) {
+  std::ostringstream str;
+  str << node << "#" << point;
+  return Hash(str.str());
+}
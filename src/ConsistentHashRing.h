@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ConsistentHashRing.h
+ * Map keys onto a changing set of nodes.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_CONSISTENTHASHRING_H_
+#define SRC_CONSISTENTHASHRING_H_
+
+#include <stdint.h>
+#include <ola/base/Macro.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A consistent hash ring.
+ *
+ * Each node is hashed onto the ring at a number of points, and a key belongs
+ * to the node at the first point at or after the key's hash. Adding or
+ * removing one of N nodes only moves about 1/N of the keys.
+ *
+ * The hash doesn't depend on the platform, so every process with the same
+ * set of nodes maps a key to the same node.
+ */
+class ConsistentHashRing {
+ public:
+  /**
+   * @brief Create a new ring.
+   * @param points The number of points for each node. More points spread
+   *   the keys more evenly, at the cost of memory and update time.
+   */
+  explicit ConsistentHashRing(unsigned int points = DEFAULT_POINTS);
+  ~ConsistentHashRing() {}
+
+  void Add(const std::string &node);
+  void Remove(const std::string &node);
+  void Clear();
+
+  bool Contains(const std::string &node) const {
+    return m_nodes.find(node) != m_nodes.end();
+  }
+
+  unsigned int Size() const { return m_nodes.size(); }
+
+  const std::set<std::string> &Nodes() const { return m_nodes; }
+
+  /**
+   * @brief Find the node a key belongs to.
+   * @returns false if the ring is empty.
+   */
+  bool Owner(const std::string &key, std::string *node) const;
+
+  /**
+   * @brief Find the nodes a key would move to, in order.
+   * @param key The key to look up.
+   * @param count The maximum number of nodes to return.
+   * @param[out] nodes The owner of the key, followed by the nodes that would
+   *   take it over if the ones before them were removed.
+   */
+  void Successors(const std::string &key, unsigned int count,
+                  std::vector<std::string> *nodes) const;
+
+  /**
+   * @brief The hash used for the points and keys: 64 bit FNV-1a, followed
+   * by the fmix64 finalizer from MurmurHash3.
+   *
+   * The finalizer spreads keys that differ only in their last few bytes,
+   * which FNV-1a on its own places close together on the ring. Any other
+   * implementation has to do the same to agree on which node owns a key.
+   */
+  static uint64_t Hash(const std::string &value);
+
+  static const unsigned int DEFAULT_POINTS = 100;
+
+ private:
+  typedef std::map<uint64_t, std::string> PointMap;
+
+  const unsigned int m_points;
+  std::set<std::string> m_nodes;
+  PointMap m_ring;
+
+  static uint64_t PointHash(const std::string &node, unsigned int point);
+
+  DISALLOW_COPY_AND_ASSIGN(ConsistentHashRing);
+};
+#endif  // SRC_CONSISTENTHASHRING_H_
@@ -23,7 +23,11 @@
 #include <config.h>
 #endif
 
+#include <ola/StringUtils.h>
 #include <ola/base/Flags.h>
+#include <ola/strings/Format.h>
+
+#include <string>
 
 #ifdef HAVE_DNSSD
 #include "src/BonjourDiscoveryAgent.h"
@@ -40,8 +44,24 @@ const char DiscoveryAgentInterface::DEFAULT_SCOPE[] = "default";
 
 const char DiscoveryAgentInterface::PRIORITY_KEY[] = "priority";
 const char DiscoveryAgentInterface::SCOPE_KEY[] = "confScope";
+const char DiscoveryAgentInterface::TERM_KEY[] = "term";
 const char DiscoveryAgentInterface::TXT_VERSION_KEY[] = "txtvers";
 
+std::string DiscoveryAgentInterface::AlternativeServiceName(
+    const std::string &name) {
+  unsigned int count = 1;
+  std::string base = name;
+  const std::string::size_type open = name.rfind(" (");
+  if (open != std::string::npos && name[name.size() - 1] == ')' &&
+      ola::StringToInt(name.substr(open + 2, name.size() - open - 3),
+                       &count, true) && count > 1) {
+    base = name.substr(0, open);
+  } else {
+    count = 1;
+  }
+  return base + " (" + ola::strings::IntToString(count + 1) + ")";
+}
+
 DiscoveryAgentInterface* DiscoveryAgentFactory::New(
     const DiscoveryAgentInterface::Options &options) {
 #ifdef HAVE_DNSSD
@@ -24,11 +24,13 @@
 #include <stdint.h>
 #include <ola/base/Macro.h>
 #include <ola/Callback.h>
+#include <ola/Clock.h>
 #include <ola/network/SocketAddress.h>
 #include <string>
 #include <vector>
 
 #include "src/MasterEntry.h"
+#include "src/RegistrationThrottle.h"
 
 /**
  * @brief The interface to E1.33 DNS-SD operations like register, browse etc.
@@ -52,11 +54,52 @@ class DiscoveryAgentInterface {
   typedef ola::Callback2<void, MasterEvent, const MasterEntry&>
       MasterEventCallback;
 
+  /**
+   * @brief Called with true if the first browse completed, false if it timed
+   * out, and the time that was spent waiting.
+   */
+  typedef ola::SingleUseCallback2<void, bool, ola::TimeInterval>
+      BrowseCompleteCallback;
+
   struct Options {
-    Options() : master_callback(NULL) {}
+    Options()
+        : master_callback(NULL),
+          browse_complete_callback(NULL) {
+    }
 
     std::string scope;
+    /**
+     * @brief The DNS-SD domain to browse, e.g. "dnssd.example.com.". Empty
+     * uses the system's default, normally just "local.".
+     *
+     * Any other domain is browsed with unicast DNS queries, so masters can be
+     * found across routed subnets without mDNS reflectors.
+     */
+    std::string browse_domain;
+    /**
+     * @brief The DNS-SD domain to register masters in. Empty uses the
+     * system's default. Registering in a unicast domain uses DNS Update, so
+     * the DNS server must accept updates from this host. The Avahi agent
+     * can't register outside the local domain, and fails Start() if this is
+     * set.
+     */
+    std::string registration_domain;
     MasterEventCallback *master_callback;
+    /**
+     * @brief If non-zero, Start() waits up to this long for the first browse
+     * to complete, so that the events for the existing masters are delivered
+     * before Start() returns.
+     */
+    ola::TimeInterval initial_browse_timeout;
+    /**
+     * @brief Run by Start() once the wait is over. Only used if
+     * initial_browse_timeout is set. Ownership is transferred.
+     */
+    BrowseCompleteCallback *browse_complete_callback;
+    /**
+     * @brief Limits how often RegisterMaster() updates reach the network.
+     */
+    RegistrationThrottle::Options registration_limits;
   };
 
   virtual ~DiscoveryAgentInterface() {}
@@ -65,7 +108,7 @@ class DiscoveryAgentInterface {
    * @brief Start the DiscoveryAgent.
    *
    * In both the Avahi and Bonjour implementations this starts the DNS-SD
-   * thread.
+   * thread. See Options::initial_browse_timeout.
    */
   virtual bool Start() = 0;
 
@@ -81,7 +124,8 @@ class DiscoveryAgentInterface {
    * @param master The master entry to register in DNS-SD.
    *
    * If this is called twice with a controller with the same IPV4SocketAddress
-   * the TXT field will be updated with the newer values.
+   * the TXT field will be updated with the newer values. Updates may be
+   * coalesced and delayed, see Options::registration_limits.
    *
    * Registration may be performed in a separate thread.
    */
@@ -98,11 +142,18 @@ class DiscoveryAgentInterface {
   virtual void DeRegisterMaster(
       const ola::network::IPV4SocketAddress &master_address) = 0;
 
+  /**
+   * @brief The name to try after a name conflict. "Foo" becomes "Foo (2)"
+   * and "Foo (2)" becomes "Foo (3)", the same as Bonjour's own renaming.
+   */
+  static std::string AlternativeServiceName(const std::string &name);
+
   static const char MASTER_SERVICE[];
   static const char DEFAULT_SCOPE[];
 
   static const char PRIORITY_KEY[];
   static const char SCOPE_KEY[];
+  static const char TERM_KEY[];
   static const char TXT_VERSION_KEY[];
 
   static const uint8_t TXT_VERSION = 1;
@@ -116,13 +167,14 @@ class DiscoveryAgentInterface {
 class DiscoveryAgentFactory {
  public:
   DiscoveryAgentFactory() {}
+  virtual ~DiscoveryAgentFactory() {}
 
   /**
    * @brief Create a new DiscoveryAgent.
    * This returns a DiscoveryAgent appropriate for the platform. It can
    * either be a BonjourDiscoveryAgent or a AvahiDiscoveryAgent.
    */
-  DiscoveryAgentInterface* New(
+  virtual DiscoveryAgentInterface* New(
       const DiscoveryAgentInterface::Options &options);
 
  private:
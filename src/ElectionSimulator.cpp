@@ -0,0 +1,713 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ElectionSimulator.cpp
+ * Run discovery & election scenarios in virtual time.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/ElectionSimulator.h"
+
+#include <stdint.h>
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/StringUtils.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/NetworkUtils.h>
+#include <ola/stl/STLUtils.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/CPUTime.h"
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::TimeInterval;
+using ola::TimeStamp;
+using ola::network::HostToNetwork;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using std::string;
+using std::vector;
+
+namespace {
+
+TimeInterval MillisToInterval(unsigned int ms) {
+  return TimeInterval(ms / 1000, (ms % 1000) * 1000);
+}
+
+/*
+ * A small PRNG so that scenarios don't depend on the platform's rand().
+ */
+class Random {
+ public:
+  explicit Random(uint32_t seed) : m_state(seed ? seed : 1) {}
+
+  // Returns a value in [0, limit).
+  uint32_t Next(uint32_t limit) {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return limit ? m_state % limit : 0;
+  }
+
+ private:
+  uint32_t m_state;
+};
+
+bool EventOrder(const ScenarioEvent &a, const ScenarioEvent &b) {
+  return a.time_ms < b.time_ms;
+}
+}  // namespace
+
+// VirtualClock
+// ----------------------------------------------------------------------------
+VirtualClock::VirtualClock() {
+  // Some code treats a zero TimeStamp as unset.
+  m_now += TimeInterval(1, 0);
+}
+
+void VirtualClock::CurrentTime(TimeStamp *timestamp) const {
+  *timestamp = m_now;
+}
+
+void VirtualClock::AdvanceTo(const TimeStamp &now) {
+  if (now > m_now) {
+    m_now = now;
+  }
+}
+
+void VirtualClock::AdvanceTime(const TimeInterval &interval) {
+  m_now += interval;
+}
+
+// Scenario
+// ----------------------------------------------------------------------------
+bool Scenario::Load(const string &path) {
+  std::ifstream file(path.c_str());
+  if (!file.is_open()) {
+    OLA_WARN << "Failed to open " << path;
+    return false;
+  }
+
+  string line;
+  unsigned int line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    vector<string> tokens;
+    std::istringstream stream(line);
+    string token;
+    while (stream >> token) {
+      tokens.push_back(token);
+    }
+    if (tokens.empty() || tokens[0][0] == '#') {
+      continue;
+    }
+
+    ScenarioEvent event;
+    event.priority = 0;
+    bool ok = tokens.size() >= 3 &&
+              ola::StringToInt(tokens[0], &event.time_ms) &&
+              ola::StringToInt(tokens[2], &event.master);
+    if (ok && tokens[1] == "add" && tokens.size() == 4) {
+      event.type = ScenarioEvent::ADD_MASTER;
+      ok = ola::StringToInt(tokens[3], &event.priority);
+    } else if (ok && tokens[1] == "priority" && tokens.size() == 4) {
+      event.type = ScenarioEvent::SET_PRIORITY;
+      ok = ola::StringToInt(tokens[3], &event.priority);
+    } else if (ok && tokens[1] == "remove" && tokens.size() == 3) {
+      event.type = ScenarioEvent::REMOVE_MASTER;
+    } else if (ok && tokens[1] == "crash" && tokens.size() == 3) {
+      event.type = ScenarioEvent::CRASH_MASTER;
+    } else if (ok && tokens[1] == "handoff" && tokens.size() == 3) {
+      event.type = ScenarioEvent::HANDOFF_MASTER;
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      OLA_WARN << path << ":" << line_number << ": invalid event '" << line
+               << "'";
+      return false;
+    }
+    AddEvent(event);
+  }
+  return true;
+}
+
+void Scenario::GenerateChurn(const ChurnOptions &options) {
+  Random random(options.seed);
+  vector<uint8_t> priorities(options.masters, 0);
+  vector<unsigned int> removed;
+
+  ScenarioEvent event;
+  event.time_ms = 0;
+  for (unsigned int i = 0; i < options.masters; i++) {
+    event.type = ScenarioEvent::ADD_MASTER;
+    event.master = i;
+    event.priority = 1 + random.Next(200);
+    priorities[i] = event.priority;
+    AddEvent(event);
+  }
+
+  for (unsigned int i = 0; i < options.events && options.masters; i++) {
+    event.time_ms += 1 + random.Next(2 * options.mean_interval_ms);
+
+    // Find the master that's most likely to be the leader.
+    unsigned int leader = 0;
+    for (unsigned int j = 1; j < options.masters; j++) {
+      if (priorities[j] > priorities[leader]) {
+        leader = j;
+      }
+    }
+
+    const uint32_t action = random.Next(4);
+    if (action == 3 && !removed.empty()) {
+      const unsigned int index = random.Next(removed.size());
+      event.type = ScenarioEvent::ADD_MASTER;
+      event.master = removed[index];
+      event.priority = 1 + random.Next(200);
+      removed.erase(removed.begin() + index);
+    } else {
+      event.master = random.Next(3) == 0 ? leader :
+                                           random.Next(options.masters);
+      if (priorities[event.master] == 0) {
+        // It's already been removed.
+        continue;
+      }
+      if (action == 2) {
+        event.type = ScenarioEvent::REMOVE_MASTER;
+        if (options.mixed_failures) {
+          const uint32_t failure = random.Next(3);
+          if (failure == 1) {
+            event.type = ScenarioEvent::CRASH_MASTER;
+          } else if (failure == 2) {
+            event.type = ScenarioEvent::HANDOFF_MASTER;
+          }
+        }
+        event.priority = 0;
+        removed.push_back(event.master);
+      } else {
+        event.type = ScenarioEvent::SET_PRIORITY;
+        event.priority = 1 + random.Next(200);
+      }
+    }
+    priorities[event.master] = event.priority;
+    AddEvent(event);
+  }
+}
+
+void Scenario::AddEvent(const ScenarioEvent &event) {
+  // Keep events with the same time in the order they were added.
+  vector<ScenarioEvent>::iterator iter = std::upper_bound(
+      m_events.begin(), m_events.end(), event, EventOrder);
+  m_events.insert(iter, event);
+}
+
+// ElectionSimulator::SimulatedClient
+// ----------------------------------------------------------------------------
+/*
+ * The discovery & election half of a MasterClient.
+ */
+class ElectionSimulator::SimulatedClient {
+ public:
+  SimulatedClient(DiscoveryAgentFactory *factory, Results *results)
+      : m_results(results),
+        m_election(NewCallback(this, &SimulatedClient::LeaderChanged)) {
+    DiscoveryAgentInterface::Options options;
+    options.scope = SCOPE;
+    options.master_callback = NewCallback(this,
+                                          &SimulatedClient::MasterChanged);
+    m_agent.reset(factory->New(options));
+  }
+
+  bool Start() { return m_agent->Start(); }
+  void Stop() { m_agent->Stop(); }
+
+  const MasterEntry *Leader() const { return m_election.Leader(); }
+
+ private:
+  Results *m_results;
+  MasterElection m_election;
+  std::auto_ptr<DiscoveryAgentInterface> m_agent;
+
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry) {
+    m_results->deliveries++;
+    m_election.HandleEvent(event, entry);
+  }
+
+  void LeaderChanged(OLA_UNUSED const MasterEntry *leader) {
+    m_results->leader_changes++;
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(SimulatedClient);
+};
+
+// ElectionSimulator::SimulatedMaster
+// ----------------------------------------------------------------------------
+/*
+ * A master in the scenario. With full_stack it's a MasterServer on its own
+ * SelectServer, so it can stop running without stopping everything else.
+ * Otherwise it's a registration made through the simulator's agent.
+ */
+struct ElectionSimulator::SimulatedMaster {
+  SimulatedMaster()
+      : registered(false),
+        crashed(false),
+        handing_off(false),
+        expiry_timeout(ola::thread::INVALID_TIMEOUT) {
+  }
+
+  MasterEntry entry;
+  // True until the registration goes away, which for a crashed master is
+  // when it expires.
+  bool registered;
+  bool crashed;
+  bool handing_off;
+  ola::thread::timeout_id expiry_timeout;
+  std::auto_ptr<ola::io::SelectServer> ss;
+  std::auto_ptr<MasterServer> server;
+};
+
+// ElectionSimulator::Results
+// ----------------------------------------------------------------------------
+void ElectionSimulator::Results::Print(std::ostream *out) const {
+  *out << "--------------" << std::endl;
+  *out << "Events: " << events << ", ";
+  if (full_stack) {
+    *out << "messages: " << messages;
+  } else {
+    *out << "deliveries: " << deliveries;
+  }
+  *out << ", leader changes: " << leader_changes << std::endl;
+  *out << "Virtual time: " << virtual_time << ", wall time: " << wall_time
+       << ", CPU time: " << cpu_time << std::endl;
+  *out << "Failovers: " << latencies.size() << ", timed out: " << timeouts
+       << std::endl;
+
+  if (!latencies.empty()) {
+    vector<int64_t> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+
+    int64_t total = 0;
+    vector<int64_t>::const_iterator iter = sorted.begin();
+    for (; iter != sorted.end(); ++iter) {
+      total += *iter;
+    }
+
+    const double percentiles[] = {0.5, 0.9, 0.99};
+    *out << "min: " << sorted.front() / 1000.0 << " ms" << std::endl;
+    *out << "mean: " << total / sorted.size() / 1000.0 << " ms" << std::endl;
+    for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(double); i++) {
+      unsigned int index = static_cast<unsigned int>(
+          percentiles[i] * (sorted.size() - 1) + 0.5);
+      *out << "p" << static_cast<int>(percentiles[i] * 100) << ": "
+           << sorted[index] / 1000.0 << " ms" << std::endl;
+    }
+    *out << "max: " << sorted.back() / 1000.0 << " ms" << std::endl;
+  }
+  if (full_stack) {
+    client_stats.Print(out);
+  } else {
+    *out << "--------------" << std::endl;
+  }
+}
+
+// ElectionSimulator
+// ----------------------------------------------------------------------------
+const char ElectionSimulator::SCOPE[] = "simulation";
+
+ElectionSimulator::ElectionSimulator(const Options &options)
+    : m_options(options),
+      m_ss(NULL, &m_clock),
+      m_registry(&m_ss, options.propagation_delay_ms),
+      m_agent_factory(&m_registry),
+      m_results(NULL),
+      m_converging(false) {
+}
+
+ElectionSimulator::~ElectionSimulator() {
+  ola::STLDeleteElements(&m_clients);
+  ola::STLDeleteElements(&m_master_clients);
+  // Stop the masters here, rather than from a queued handoff.
+  for (unsigned int i = 0; i < m_masters.size(); i++) {
+    StopMaster(i);
+  }
+  m_master_agent.reset();
+  // Run anything still queued while the registry and masters are around.
+  m_ss.DrainCallbacks();
+  ola::STLDeleteElements(&m_masters);
+}
+
+/*
+ * Each step fires the timers that are due, applies the scenario events for
+ * that time, then lets the registry queue the deliveries. While the clients
+ * are converging, or deliveries are outstanding, the clock moves in ticks.
+ * Otherwise it jumps to the next event.
+ */
+bool ElectionSimulator::Run(const Scenario &scenario, Results *results) {
+  const vector<ScenarioEvent> &events = scenario.Events();
+  *results = Results();
+  results->full_stack = m_options.full_stack;
+  m_results = results;
+
+  unsigned int master_count = 0;
+  vector<ScenarioEvent>::const_iterator iter = events.begin();
+  for (; iter != events.end(); ++iter) {
+    master_count = std::max(master_count, iter->master + 1);
+  }
+  for (unsigned int i = 0; i < master_count; i++) {
+    m_masters.push_back(new SimulatedMaster());
+  }
+
+  if (!m_options.full_stack) {
+    DiscoveryAgentInterface::Options agent_options;
+    agent_options.scope = SCOPE;
+    m_master_agent.reset(m_agent_factory.New(agent_options));
+    if (!m_master_agent->Start()) {
+      return false;
+    }
+  }
+
+  if (!StartClients()) {
+    return false;
+  }
+
+  ola::Clock wall_clock;
+  TimeStamp wall_start;
+  wall_clock.CurrentTime(&wall_start);
+  const TimeInterval cpu_start = ProcessCPUTime();
+
+  const TimeInterval tick = MillisToInterval(std::max(m_options.tick_ms, 1u));
+  const TimeInterval delay = MillisToInterval(m_options.propagation_delay_ms);
+  TimeStamp start, now, last_event;
+  m_clock.CurrentTime(&start);
+  last_event = start;
+  unsigned int next = 0;
+
+  while (true) {
+    m_clock.CurrentTime(&now);
+    RunOnce();
+
+    while (next < events.size() &&
+           start + MillisToInterval(events[next].time_ms) <= now) {
+      ApplyEvent(events[next++]);
+      results->events++;
+      last_event = now;
+    }
+    if (!m_converging && !HasConverged()) {
+      m_converging = true;
+      m_converge_start = now;
+    }
+    // Queue the deliveries for these events.
+    RunOnce();
+    CheckConvergence(now);
+
+    const bool delivering = now < last_event + delay + tick;
+    // The MasterServers and MasterClients always have timers running, so
+    // with full_stack the clock can't jump.
+    if (m_converging || delivering ||
+        (m_options.full_stack && next < events.size())) {
+      m_clock.AdvanceTime(tick);
+    } else if (next < events.size()) {
+      m_clock.AdvanceTo(start + MillisToInterval(events[next].time_ms));
+    } else {
+      break;
+    }
+  }
+
+  TimeStamp wall_end;
+  wall_clock.CurrentTime(&wall_end);
+  results->virtual_time = now - start;
+  results->wall_time = wall_end - wall_start;
+  results->cpu_time = ProcessCPUTime() - cpu_start;
+
+  vector<MasterClient*>::const_iterator client = m_master_clients.begin();
+  for (; client != m_master_clients.end(); ++client) {
+    results->client_stats.Merge((*client)->GetStats());
+    results->messages += (*client)->MessagesReceived();
+  }
+  if (m_options.full_stack) {
+    results->leader_changes = results->client_stats.leadership_flips;
+  }
+  m_results = NULL;
+  return true;
+}
+
+bool ElectionSimulator::StartClients() {
+  for (unsigned int i = 0; i < m_options.clients; i++) {
+    if (m_options.full_stack) {
+      MasterClient::Options options = m_options.client_options;
+      options.scope = SCOPE;
+      options.sharded = false;
+      options.agent_factory = &m_agent_factory;
+      options.state_change_callback = NULL;
+
+      MasterClient *client = new MasterClient(&m_ss, options);
+      m_master_clients.push_back(client);
+      if (!client->Init()) {
+        return false;
+      }
+    } else {
+      SimulatedClient *client = new SimulatedClient(&m_agent_factory,
+                                                    m_results);
+      m_clients.push_back(client);
+      if (!client->Start()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+ * Crashed masters don't run, so their timers stop and their sockets go
+ * unread.
+ */
+void ElectionSimulator::RunOnce() {
+  m_ss.RunOnce(TimeInterval(0, 0));
+  if (!m_options.full_stack) {
+    return;
+  }
+  vector<SimulatedMaster*>::iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    if ((*iter)->ss.get() && !(*iter)->crashed) {
+      (*iter)->ss->RunOnce(TimeInterval(0, 0));
+    }
+  }
+}
+
+void ElectionSimulator::ApplyEvent(const ScenarioEvent &event) {
+  SimulatedMaster *master = GetMaster(event.master);
+  // Anything that happens to a master that crashed, or is still handing off,
+  // means it's been restarted or removed, so the old instance goes first.
+  if (master->crashed || master->handing_off) {
+    StopMaster(event.master);
+  }
+
+  switch (event.type) {
+    case ScenarioEvent::ADD_MASTER:
+      if (master->registered) {
+        SetMasterPriority(master, event.priority);
+      } else {
+        master->entry.priority = event.priority;
+        StartMaster(master);
+      }
+      break;
+    case ScenarioEvent::REMOVE_MASTER:
+      StopMaster(event.master);
+      break;
+    case ScenarioEvent::SET_PRIORITY:
+      SetMasterPriority(master, event.priority);
+      break;
+    case ScenarioEvent::CRASH_MASTER:
+      CrashMaster(event.master);
+      break;
+    case ScenarioEvent::HANDOFF_MASTER:
+      HandoffMaster(event.master);
+      break;
+  }
+}
+
+void ElectionSimulator::StartMaster(SimulatedMaster *master) {
+  if (m_options.full_stack) {
+    MasterServer::Options options = m_options.server_options;
+    options.service_name = master->entry.service_name;
+    options.unique_name = false;
+    options.listen_ip = IPV4Address::Loopback();
+    options.listen_port = 0;
+    options.priority = master->entry.priority;
+    options.scope = SCOPE;
+    options.worker_threads = 0;
+    // The registry delivers on our thread, so there's no waiting for the
+    // first browse.
+    options.initial_browse_timeout = 0;
+    options.agent_factory = &m_agent_factory;
+
+    master->ss.reset(new ola::io::SelectServer(NULL, &m_clock));
+    master->server.reset(new MasterServer(master->ss.get(), options));
+    if (!master->server->Init()) {
+      OLA_WARN << "Failed to start " << master->entry.service_name;
+      master->server.reset();
+      master->ss.reset();
+      return;
+    }
+    master->entry.address = master->server->ListenAddress();
+  } else {
+    m_master_agent->RegisterMaster(master->entry);
+  }
+  master->registered = true;
+  m_expected.Update(master->entry);
+}
+
+void ElectionSimulator::SetMasterPriority(SimulatedMaster *master,
+                                          uint8_t priority) {
+  master->entry.priority = priority;
+  if (!master->registered) {
+    return;
+  }
+  if (master->server.get()) {
+    master->server->SetPriority(priority);
+  } else {
+    m_master_agent->RegisterMaster(master->entry);
+  }
+  m_expected.Update(master->entry);
+}
+
+/*
+ * A MasterServer closes its connections and deregisters as it's destroyed.
+ */
+void ElectionSimulator::StopMaster(unsigned int index) {
+  SimulatedMaster *master = m_masters[index];
+  if (master->expiry_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss.RemoveTimeout(master->expiry_timeout);
+    master->expiry_timeout = ola::thread::INVALID_TIMEOUT;
+  }
+  if (master->registered) {
+    if (master->server.get()) {
+      master->server.reset();
+      master->ss.reset();
+    } else {
+      m_master_agent->DeRegisterMaster(master->entry.address);
+    }
+    m_expected.Remove(master->entry.service_name);
+  }
+  master->registered = false;
+  master->crashed = false;
+  master->handing_off = false;
+}
+
+/*
+ * The registration stays until it expires, and a MasterServer stops running
+ * with its connections left open, so only the clients' failure detectors
+ * notice straight away.
+ */
+void ElectionSimulator::CrashMaster(unsigned int index) {
+  SimulatedMaster *master = m_masters[index];
+  if (!master->registered) {
+    return;
+  }
+  master->crashed = true;
+  // The clients should move to another master, the time they take is
+  // measured from now.
+  m_expected.Remove(master->entry.service_name);
+  master->expiry_timeout = m_ss.RegisterSingleTimeout(
+      m_options.record_expiry_ms,
+      NewSingleCallback(this, &ElectionSimulator::ExpireMaster, index));
+}
+
+void ElectionSimulator::ExpireMaster(unsigned int index) {
+  m_masters[index]->expiry_timeout = ola::thread::INVALID_TIMEOUT;
+  StopMaster(index);
+}
+
+void ElectionSimulator::HandoffMaster(unsigned int index) {
+  SimulatedMaster *master = m_masters[index];
+  if (!master->server.get()) {
+    StopMaster(index);
+    return;
+  }
+  master->handing_off = true;
+  m_expected.Remove(master->entry.service_name);
+  master->server->Handoff(
+      NewSingleCallback(this, &ElectionSimulator::HandoffDone, index));
+}
+
+/*
+ * This runs on the master's SelectServer, so the MasterServer is destroyed
+ * from ours.
+ */
+void ElectionSimulator::HandoffDone(unsigned int index) {
+  m_ss.Execute(
+      NewSingleCallback(this, &ElectionSimulator::FinishHandoff, index));
+}
+
+void ElectionSimulator::FinishHandoff(unsigned int index) {
+  // A later event may have stopped it already.
+  if (m_masters[index]->handing_off) {
+    StopMaster(index);
+  }
+}
+
+bool ElectionSimulator::HasConverged() const {
+  const MasterEntry *expected = m_expected.Leader();
+  if (m_options.full_stack) {
+    // Both the elected and reported masters have to be the leader.
+    const IPV4SocketAddress leader = expected ? expected->address :
+                                                IPV4SocketAddress();
+    vector<MasterClient*>::const_iterator iter = m_master_clients.begin();
+    for (; iter != m_master_clients.end(); ++iter) {
+      if ((*iter)->ElectedMaster() != leader ||
+          (*iter)->ReportedMaster() != leader) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  vector<SimulatedClient*>::const_iterator iter = m_clients.begin();
+  for (; iter != m_clients.end(); ++iter) {
+    const MasterEntry *leader = (*iter)->Leader();
+    if (expected == NULL || leader == NULL) {
+      if (expected != leader) {
+        return false;
+      }
+    } else if (leader->service_name != expected->service_name ||
+               leader->address != expected->address) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ElectionSimulator::CheckConvergence(const TimeStamp &now) {
+  if (!m_converging) {
+    return;
+  }
+
+  const TimeInterval elapsed = now - m_converge_start;
+  if (HasConverged()) {
+    m_results->latencies.push_back(elapsed.AsInt());
+    m_converging = false;
+  } else if (elapsed > MillisToInterval(m_options.convergence_timeout_ms)) {
+    OLA_WARN << "Clients didn't converge within "
+             << m_options.convergence_timeout_ms << " ms";
+    m_results->timeouts++;
+    m_converging = false;
+  }
+}
+
+ElectionSimulator::SimulatedMaster *ElectionSimulator::GetMaster(
+    unsigned int index) {
+  SimulatedMaster *master = m_masters[index];
+  if (master->entry.service_name.empty()) {
+    std::ostringstream name;
+    name << "Sim" << index;
+    master->entry.service_name = name.str();
+    // 10.0.0.1 onwards. With full_stack this is replaced by the listening
+    // address.
+    master->entry.address = IPV4SocketAddress(
+        IPV4Address(HostToNetwork(static_cast<uint32_t>(0x0a000001 + index))),
+        5568);
+    master->entry.scope = SCOPE;
+  }
+  return master;
+}
@@ -0,0 +1,270 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * ElectionSimulator.h
+ * Run discovery & election scenarios in virtual time.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_ELECTIONSIMULATOR_H_
+#define SRC_ELECTIONSIMULATOR_H_
+
+#include <stdint.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/SocketAddress.h>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/InProcessDiscoveryAgent.h"
+#include "src/MasterClient.h"
+#include "src/MasterElection.h"
+#include "src/MasterServer.h"
+
+/**
+ * @brief A Clock that only moves when it's told to.
+ */
+class VirtualClock : public ola::Clock {
+ public:
+  VirtualClock();
+
+  void CurrentTime(ola::TimeStamp *timestamp) const;
+
+  void AdvanceTo(const ola::TimeStamp &now);
+  void AdvanceTime(const ola::TimeInterval &interval);
+
+ private:
+  ola::TimeStamp m_now;
+
+  DISALLOW_COPY_AND_ASSIGN(VirtualClock);
+};
+
+/**
+ * @brief A change to the set of masters.
+ */
+struct ScenarioEvent {
+  enum Type {
+    ADD_MASTER,
+    REMOVE_MASTER,
+    SET_PRIORITY,
+    // The master stops without closing its connections or deregistering.
+    // Its registration expires after record_expiry_ms.
+    CRASH_MASTER,
+    // The master hands its clients over to the next master, see
+    // MasterServer::Handoff(). Without full_stack it's the same as
+    // REMOVE_MASTER.
+    HANDOFF_MASTER,
+  };
+
+  // The time of the event, relative to the start of the run.
+  unsigned int time_ms;
+  Type type;
+  // Masters are numbered from 0.
+  unsigned int master;
+  uint8_t priority;
+};
+
+/**
+ * @brief A script of events to run through the simulator.
+ */
+class Scenario {
+ public:
+  struct ChurnOptions {
+    ChurnOptions()
+        : masters(10000),
+          events(1000),
+          mean_interval_ms(100),
+          seed(1),
+          mixed_failures(false) {
+    }
+
+    // The number of masters, which are all added at the start.
+    unsigned int masters;
+    // The number of random events that follow.
+    unsigned int events;
+    unsigned int mean_interval_ms;
+    uint32_t seed;
+    // Split the removals between removes, crashes and handoffs.
+    bool mixed_failures;
+  };
+
+  Scenario() {}
+
+  /**
+   * @brief Load a scenario from a file.
+   *
+   * Each line is one of:
+   *   <ms> add <master> <priority>
+   *   <ms> remove <master>
+   *   <ms> priority <master> <priority>
+   *   <ms> crash <master>
+   *   <ms> handoff <master>
+   * Blank lines and lines starting with # are ignored.
+   */
+  bool Load(const std::string &path);
+
+  /**
+   * @brief Generate a random scenario. The same options always produce the
+   * same events.
+   *
+   * Roughly half the events change the priority of a master, a quarter
+   * remove a master and a quarter add one back. With mixed_failures the
+   * removals are split between removes, crashes and handoffs. The current
+   * leader is picked more often than the others, since that's what causes
+   * failovers.
+   */
+  void GenerateChurn(const ChurnOptions &options);
+
+  void AddEvent(const ScenarioEvent &event);
+
+  const std::vector<ScenarioEvent> &Events() const { return m_events; }
+
+ private:
+  std::vector<ScenarioEvent> m_events;
+
+  DISALLOW_COPY_AND_ASSIGN(Scenario);
+};
+
+/**
+ * @brief Runs a Scenario against simulated clients.
+ *
+ * Everything runs on a single thread with a VirtualClock. The masters are
+ * registered with an InProcessRegistry, and each client has its own
+ * InProcessDiscoveryAgent and MasterElection, the same as a MasterClient.
+ * Time skips ahead whenever the clients have converged, so long scenarios
+ * run as fast as the CPU allows and give the same results every time.
+ *
+ * With full_stack, each master is a MasterServer and each client a
+ * MasterClient, connected over loopback TCP. The keepalives, heartbeats and
+ * failure detection, the connector's backoff, term claims, handoffs and the
+ * standby connections all run on the VirtualClock. Each MasterServer has its
+ * own SelectServer, so a crashed master can stop running while its
+ * connections stay open. The clock moves in ticks for the whole run and
+ * socket I/O completes within a tick, so the latencies come from the timers
+ * rather than the network. Every master and client needs a few file
+ * descriptors, so keep to tens of masters.
+ */
+class ElectionSimulator {
+ public:
+  struct Options {
+    Options()
+        : clients(10),
+          propagation_delay_ms(5),
+          tick_ms(1),
+          convergence_timeout_ms(10000),
+          record_expiry_ms(5000),
+          full_stack(false) {
+    }
+
+    unsigned int clients;
+    // The time for a registration change to reach the clients.
+    unsigned int propagation_delay_ms;
+    // How far to move the clock while the clients are converging.
+    unsigned int tick_ms;
+    unsigned int convergence_timeout_ms;
+    // How long a crashed master stays registered.
+    unsigned int record_expiry_ms;
+    // Run MasterServers and MasterClients, rather than just the election.
+    bool full_stack;
+    // The settings for the MasterServers and MasterClients. The simulator
+    // sets the names, scope, addresses, priorities and discovery agents, and
+    // the clients always use a single elected master.
+    MasterServer::Options server_options;
+    MasterClient::Options client_options;
+  };
+
+  struct Results {
+    Results()
+        : full_stack(false),
+          events(0),
+          deliveries(0),
+          messages(0),
+          leader_changes(0),
+          timeouts(0) {
+    }
+
+    bool full_stack;
+    unsigned int events;
+    // The number of events delivered to clients, without full_stack.
+    uint64_t deliveries;
+    // The number of frames and announcements the MasterClients received.
+    uint64_t messages;
+    // The number of times a client changed leader.
+    uint64_t leader_changes;
+    unsigned int timeouts;
+    // The time for all clients to agree on the new leader after a change, in
+    // virtual microseconds.
+    std::vector<int64_t> latencies;
+    ola::TimeInterval virtual_time;
+    ola::TimeInterval wall_time;
+    ola::TimeInterval cpu_time;
+    // The MasterClients' own stats, merged.
+    MasterClient::Stats client_stats;
+
+    void Print(std::ostream *out) const;
+  };
+
+  explicit ElectionSimulator(const Options &options);
+  ~ElectionSimulator();
+
+  /**
+   * @brief Run the scenario to completion.
+   */
+  bool Run(const Scenario &scenario, Results *results);
+
+ private:
+  class SimulatedClient;
+  struct SimulatedMaster;
+
+  const Options m_options;
+  VirtualClock m_clock;
+  ola::io::SelectServer m_ss;
+  InProcessRegistry m_registry;
+  InProcessAgentFactory m_agent_factory;
+  std::auto_ptr<DiscoveryAgentInterface> m_master_agent;
+  std::vector<SimulatedClient*> m_clients;
+  std::vector<MasterClient*> m_master_clients;
+  std::vector<SimulatedMaster*> m_masters;
+
+  // What the clients should converge on.
+  MasterElection m_expected;
+
+  Results *m_results;
+  bool m_converging;
+  ola::TimeStamp m_converge_start;
+
+  bool StartClients();
+  void RunOnce();
+  void ApplyEvent(const ScenarioEvent &event);
+  void StartMaster(SimulatedMaster *master);
+  void SetMasterPriority(SimulatedMaster *master, uint8_t priority);
+  void StopMaster(unsigned int index);
+  void CrashMaster(unsigned int index);
+  void ExpireMaster(unsigned int index);
+  void HandoffMaster(unsigned int index);
+  void HandoffDone(unsigned int index);
+  void FinishHandoff(unsigned int index);
+  bool HasConverged() const;
+  void CheckConvergence(const ola::TimeStamp &now);
+  SimulatedMaster *GetMaster(unsigned int index);
+
+  static const char SCOPE[];
+
+  DISALLOW_COPY_AND_ASSIGN(ElectionSimulator);
+};
+#endif  // SRC_ELECTIONSIMULATOR_H_
@@ -0,0 +1,92 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * FailureDetector.cpp
+ * Decides when a master has stopped sending heartbeats.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/FailureDetector.h"
+
+#include <math.h>
+#include <ola/Clock.h>
+
+PhiAccrualDetector::PhiAccrualDetector(const Options &options)
+    : m_options(options),
+      m_sum(0),
+      m_sum_of_squares(0),
+      m_has_heartbeat(false) {
+}
+
+void PhiAccrualDetector::Heartbeat(const ola::TimeStamp &now) {
+  if (m_has_heartbeat) {
+    int64_t interval = (now - m_last_heartbeat).AsInt();
+    m_intervals.push_back(interval);
+    m_sum += interval;
+    m_sum_of_squares += static_cast<double>(interval) * interval;
+
+    if (m_intervals.size() > m_options.max_samples) {
+      int64_t oldest = m_intervals.front();
+      m_intervals.pop_front();
+      m_sum -= oldest;
+      m_sum_of_squares -= static_cast<double>(oldest) * oldest;
+    }
+  }
+  m_last_heartbeat = now;
+  m_has_heartbeat = true;
+}
+
+void PhiAccrualDetector::Reset() {
+  m_intervals.clear();
+  m_sum = 0;
+  m_sum_of_squares = 0;
+  m_has_heartbeat = false;
+}
+
+bool PhiAccrualDetector::IsReady() const {
+  return m_has_heartbeat && !m_intervals.empty() &&
+      m_intervals.size() >= m_options.min_samples;
+}
+
+double PhiAccrualDetector::Phi(const ola::TimeStamp &now) const {
+  if (!IsReady()) {
+    return 0;
+  }
+
+  const double count = m_intervals.size();
+  const double mean = m_sum / count;
+  double variance = m_sum_of_squares / count - mean * mean;
+  double std_deviation = variance > 0 ? sqrt(variance) : 0;
+  const double min_std_deviation = m_options.min_std_deviation.AsInt();
+  if (std_deviation < min_std_deviation) {
+    std_deviation = min_std_deviation;
+  }
+
+  const double elapsed = (now - m_last_heartbeat).AsInt();
+
+  // A logistic approximation of the normal CDF, which avoids erf() and is
+  // accurate to within 0.01%.
+  const double y = (elapsed - mean) / std_deviation;
+  const double e = exp(-y * (1.5976 + 0.070566 * y * y));
+  if (elapsed > mean) {
+    return -log10(e / (1.0 + e));
+  } else {
+    return -log10(1.0 - 1.0 / (1.0 + e));
+  }
+}
+
+bool PhiAccrualDetector::IsSuspect(const ola::TimeStamp &now) const {
+  return IsReady() && Phi(now) > m_options.threshold;
+}
@@ -0,0 +1,96 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * FailureDetector.h
+ * Decides when a master has stopped sending heartbeats.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_FAILUREDETECTOR_H_
+#define SRC_FAILUREDETECTOR_H_
+
+#include <stdint.h>
+#include <ola/Clock.h>
+#include <deque>
+
+/**
+ * @brief A phi accrual failure detector.
+ *
+ * Rather than using a fixed timeout, this tracks the distribution of the
+ * intervals between heartbeats and reports phi, a measure of how unlikely it
+ * is that the next heartbeat is simply late. A phi of 1 means roughly a 10%
+ * chance of a false positive, 2 means 1%, 3 means 0.1% and so on.
+ *
+ * See "The phi Accrual Failure Detector", Hayashibara et al.
+ */
+class PhiAccrualDetector {
+ public:
+  struct Options {
+    Options()
+        : threshold(8.0),
+          max_samples(100),
+          min_samples(3),
+          min_std_deviation(0, 20000) {
+    }
+
+    /** @brief The phi above which the peer is considered dead. */
+    double threshold;
+    /** @brief The number of intervals to keep. */
+    unsigned int max_samples;
+    /** @brief The number of intervals needed before phi is computed. */
+    unsigned int min_samples;
+    /**
+     * @brief A lower bound for the standard deviation, so that very regular
+     * heartbeats don't make the detector overly sensitive.
+     */
+    ola::TimeInterval min_std_deviation;
+  };
+
+  explicit PhiAccrualDetector(const Options &options);
+
+  /**
+   * @brief Record a heartbeat.
+   */
+  void Heartbeat(const ola::TimeStamp &now);
+
+  /**
+   * @brief Forget all history, used when the connection is re-established.
+   */
+  void Reset();
+
+  /**
+   * @brief True if enough heartbeats have arrived to compute phi.
+   */
+  bool IsReady() const;
+
+  /**
+   * @brief The current suspicion level, 0 if the detector isn't ready.
+   */
+  double Phi(const ola::TimeStamp &now) const;
+
+  /**
+   * @brief True if the peer should be considered dead.
+   */
+  bool IsSuspect(const ola::TimeStamp &now) const;
+
+ private:
+  Options m_options;
+  std::deque<int64_t> m_intervals;
+  double m_sum;
+  double m_sum_of_squares;
+  ola::TimeStamp m_last_heartbeat;
+  bool m_has_heartbeat;
+};
+#endif  // SRC_FAILUREDETECTOR_H_
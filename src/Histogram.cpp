@@ -0,0 +1,136 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Histogram.cpp
+ * A log scale histogram for timing measurements.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/Histogram.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <ostream>
+
+using std::endl;
+
+const unsigned int Histogram::BUCKET_COUNT;
+
+Histogram::Histogram() {
+  Reset();
+}
+
+void Histogram::Add(int64_t value) {
+  if (value < 0) {
+    value = 0;
+  }
+  m_buckets[BucketFor(value)]++;
+  if (!m_count || value < m_min) {
+    m_min = value;
+  }
+  m_max = std::max(m_max, value);
+  m_count++;
+  m_sum += value;
+}
+
+void Histogram::Merge(const Histogram &other) {
+  if (!other.m_count) {
+    return;
+  }
+  for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+    m_buckets[i] += other.m_buckets[i];
+  }
+  m_min = m_count ? std::min(m_min, other.m_min) : other.m_min;
+  m_max = std::max(m_max, other.m_max);
+  m_count += other.m_count;
+  m_sum += other.m_sum;
+}
+
+void Histogram::Reset() {
+  memset(m_buckets, 0, sizeof(m_buckets));
+  m_count = 0;
+  m_min = 0;
+  m_max = 0;
+  m_sum = 0;
+}
+
+double Histogram::Mean() const {
+  return m_count ? m_sum / m_count : 0;
+}
+
+int64_t Histogram::Percentile(double percentile) const {
+  if (!m_count) {
+    return 0;
+  }
+  const double target = m_count * percentile / 100.0;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+    seen += m_buckets[i];
+    if (seen && seen >= target) {
+      return std::min(UpperBound(i), m_max);
+    }
+  }
+  return m_max;
+}
+
+void Histogram::Print(std::ostream *out) const {
+  *out << "count " << m_count << ", min " << Min() << ", mean " << Mean()
+       << ", p50 " << Percentile(50) << ", p99 " << Percentile(99)
+       << ", max " << m_max << endl;
+  for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+    if (m_buckets[i]) {
+      *out << "  <= " << UpperBound(i) << "\t" << m_buckets[i] << endl;
+    }
+  }
+}
+
+void Histogram::ToJson(std::ostream *out) const {
+  *out << "{\"count\": " << m_count << ", \"min\": " << Min()
+       << ", \"mean\": " << Mean() << ", \"p50\": " << Percentile(50)
+       << ", \"p90\": " << Percentile(90) << ", \"p99\": " << Percentile(99)
+       << ", \"max\": " << m_max << ", \"buckets\": {";
+  bool first = true;
+  for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+    if (m_buckets[i]) {
+      *out << (first ? "" : ", ") << "\"" << UpperBound(i) << "\": "
+           << m_buckets[i];
+      first = false;
+    }
+  }
+  *out << "}}";
+}
+
+/*
+ * The number of bits needed to represent the value, 0 for 0.
+ */
+unsigned int Histogram::BucketFor(int64_t value) {
+  unsigned int bucket = 0;
+  uint64_t v = static_cast<uint64_t>(value);
+  while (v) {
+    bucket++;
+    v >>= 1;
+  }
+  return std::min(bucket, BUCKET_COUNT - 1);
+}
+
+int64_t Histogram::UpperBound(unsigned int bucket) {
+  if (bucket >= BUCKET_COUNT - 1) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  return (static_cast<int64_t>(1) << bucket) - 1;
+}
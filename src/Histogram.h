@@ -0,0 +1,84 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Histogram.h
+ * A log scale histogram for timing measurements.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_HISTOGRAM_H_
+#define SRC_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <ostream>
+
+/**
+ * @brief A histogram with power of two buckets.
+ *
+ * Bucket n holds the values which need n bits, so the relative error is at
+ * most 2x, and a histogram is a fixed 64 counters regardless of the range
+ * of the values. Histograms can be merged, which is how the results from
+ * many clients are combined.
+ */
+class Histogram {
+ public:
+  Histogram();
+
+  /**
+   * @brief Record a value, negative values are recorded as 0.
+   */
+  void Add(int64_t value);
+
+  /**
+   * @brief Add all the values recorded by another histogram.
+   */
+  void Merge(const Histogram &other);
+
+  void Reset();
+
+  uint64_t Count() const { return m_count; }
+  int64_t Min() const { return m_count ? m_min : 0; }
+  int64_t Max() const { return m_max; }
+  double Mean() const;
+
+  /**
+   * @brief An upper bound for the given percentile.
+   * @param percentile A value between 0 and 100.
+   */
+  int64_t Percentile(double percentile) const;
+
+  /**
+   * @brief Print a summary and the non-empty buckets, one per line.
+   */
+  void Print(std::ostream *out) const;
+
+  /**
+   * @brief Write the histogram as a JSON object.
+   */
+  void ToJson(std::ostream *out) const;
+
+ private:
+  static const unsigned int BUCKET_COUNT = 64;
+
+  uint64_t m_buckets[BUCKET_COUNT];
+  uint64_t m_count;
+  int64_t m_min;
+  int64_t m_max;
+  double m_sum;
+
+  static unsigned int BucketFor(int64_t value);
+  static int64_t UpperBound(unsigned int bucket);
+};
+#endif  // SRC_HISTOGRAM_H_
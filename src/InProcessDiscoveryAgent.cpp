@@ -0,0 +1,327 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * InProcessDiscoveryAgent.cpp
+ * An implementation of DiscoveryAgentInterface that doesn't use DNS-SD.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/InProcessDiscoveryAgent.h"
+
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/network/SocketAddress.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+using ola::NewSingleCallback;
+using ola::network::IPV4SocketAddress;
+using ola::thread::MutexLocker;
+using std::string;
+
+// InProcessRegistry
+// ----------------------------------------------------------------------------
+InProcessRegistry::InProcessRegistry(ola::io::SelectServerInterface *ss,
+                                     unsigned int propagation_delay_ms)
+    : m_ss(ss),
+      m_propagation_delay(propagation_delay_ms),
+      m_next_agent_id(1) {
+}
+
+InProcessRegistry::~InProcessRegistry() {
+  if (!m_agents.empty()) {
+    OLA_WARN << m_agents.size() << " agents still attached to the registry";
+  }
+}
+
+unsigned int InProcessRegistry::AddAgent(InProcessDiscoveryAgent *agent,
+                                         const string &scope,
+                                         bool watch_masters) {
+  MutexLocker lock(&m_mu);
+  unsigned int agent_id = m_next_agent_id++;
+  AgentState state = {agent, scope, watch_masters};
+  m_agents[agent_id] = state;
+
+  if (watch_masters) {
+    // Simulate the initial browse results.
+    RegistrationMap::const_iterator iter = m_registrations.begin();
+    for (; iter != m_registrations.end(); ++iter) {
+      if (iter->second.entry.scope == scope) {
+        Notify(agent_id, DiscoveryAgentInterface::MASTER_ADDED,
+               iter->second.entry);
+      }
+    }
+    if (m_propagation_delay) {
+      m_ss->Execute(NewSingleCallback(
+          this, &InProcessRegistry::ScheduleBrowseComplete, agent_id));
+    } else {
+      m_ss->Execute(NewSingleCallback(
+          this, &InProcessRegistry::DeliverBrowseComplete, agent_id));
+    }
+  }
+  return agent_id;
+}
+
+void InProcessRegistry::RemoveAgent(unsigned int agent_id) {
+  MutexLocker lock(&m_mu);
+  m_agents.erase(agent_id);
+
+  // Withdraw any registrations this agent held, much like a DNS-SD goodbye.
+  RegistrationMap::iterator iter = m_registrations.begin();
+  while (iter != m_registrations.end()) {
+    if (iter->second.owner == agent_id) {
+      NotifyScope(iter->second.entry.scope,
+                  DiscoveryAgentInterface::MASTER_REMOVED,
+                  iter->second.entry);
+      RemoveName(iter->second.entry);
+      m_registrations.erase(iter++);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+void InProcessRegistry::Register(unsigned int agent_id,
+                                 const MasterEntry &master) {
+  MutexLocker lock(&m_mu);
+  std::pair<RegistrationMap::iterator, bool> p = m_registrations.insert(
+      RegistrationMap::value_type(master.address, Registration()));
+  Registration &registration = p.first->second;
+
+  MasterEntry entry = master;
+  if (p.second) {
+    // The instance name is fixed when the service is first registered, and
+    // renamed if another master in the scope already has it.
+    while (NameInUse(entry.scope, entry.service_name)) {
+      const string name = DiscoveryAgentInterface::AlternativeServiceName(
+          entry.service_name);
+      OLA_INFO << "Name conflict for " << entry.service_name
+               << ", trying " << name;
+      entry.service_name = name;
+    }
+  } else {
+    entry.service_name = registration.entry.service_name;
+    if (registration.entry == entry) {
+      return;
+    }
+    if (registration.entry.scope != entry.scope) {
+      NotifyScope(registration.entry.scope,
+                  DiscoveryAgentInterface::MASTER_REMOVED,
+                  registration.entry);
+    }
+    RemoveName(registration.entry);
+  }
+
+  registration.owner = agent_id;
+  registration.entry = entry;
+  AddName(entry);
+  NotifyScope(entry.scope, DiscoveryAgentInterface::MASTER_ADDED, entry);
+}
+
+void InProcessRegistry::DeRegister(unsigned int agent_id,
+                                   const IPV4SocketAddress &master_address) {
+  MutexLocker lock(&m_mu);
+  RegistrationMap::iterator iter = m_registrations.find(master_address);
+  if (iter == m_registrations.end() || iter->second.owner != agent_id) {
+    return;
+  }
+  NotifyScope(iter->second.entry.scope,
+              DiscoveryAgentInterface::MASTER_REMOVED,
+              iter->second.entry);
+  RemoveName(iter->second.entry);
+  m_registrations.erase(iter);
+}
+
+/*
+ * Requires m_mu to be held.
+ */
+bool InProcessRegistry::NameInUse(const string &scope,
+                                  const string &service_name) const {
+  ScopeNameMap::const_iterator iter = m_names.find(scope);
+  return (iter != m_names.end() &&
+          iter->second.find(service_name) != iter->second.end());
+}
+
+/*
+ * Requires m_mu to be held.
+ */
+void InProcessRegistry::AddName(const MasterEntry &entry) {
+  m_names[entry.scope].insert(entry.service_name);
+}
+
+/*
+ * Requires m_mu to be held.
+ */
+void InProcessRegistry::RemoveName(const MasterEntry &entry) {
+  ScopeNameMap::iterator iter = m_names.find(entry.scope);
+  if (iter == m_names.end()) {
+    return;
+  }
+  std::multiset<string>::iterator name_iter =
+      iter->second.find(entry.service_name);
+  if (name_iter != iter->second.end()) {
+    iter->second.erase(name_iter);
+  }
+  if (iter->second.empty()) {
+    m_names.erase(iter);
+  }
+}
+
+/*
+ * Requires m_mu to be held.
+ */
+void InProcessRegistry::NotifyScope(
+    const string &scope,
+    DiscoveryAgentInterface::MasterEvent event,
+    const MasterEntry &entry) {
+  AgentMap::const_iterator iter = m_agents.begin();
+  for (; iter != m_agents.end(); ++iter) {
+    if (iter->second.watch_masters && iter->second.scope == scope) {
+      Notify(iter->first, event, entry);
+    }
+  }
+}
+
+void InProcessRegistry::Notify(unsigned int agent_id,
+                               DiscoveryAgentInterface::MasterEvent event,
+                               const MasterEntry &entry) {
+  if (m_propagation_delay) {
+    m_ss->Execute(NewSingleCallback(
+        this, &InProcessRegistry::ScheduleDelivery, agent_id, event, entry));
+  } else {
+    m_ss->Execute(NewSingleCallback(
+        this, &InProcessRegistry::Deliver, agent_id, event, entry));
+  }
+}
+
+void InProcessRegistry::ScheduleDelivery(
+    unsigned int agent_id,
+    DiscoveryAgentInterface::MasterEvent event,
+    MasterEntry entry) {
+  m_ss->RegisterSingleTimeout(
+      m_propagation_delay,
+      NewSingleCallback(this, &InProcessRegistry::Deliver, agent_id, event,
+                        entry));
+}
+
+/*
+ * Runs on the registry's thread. The agent may have gone away since the event
+ * was queued, so look it up again.
+ */
+void InProcessRegistry::Deliver(unsigned int agent_id,
+                                DiscoveryAgentInterface::MasterEvent event,
+                                MasterEntry entry) {
+  InProcessDiscoveryAgent *agent = NULL;
+  {
+    MutexLocker lock(&m_mu);
+    AgentMap::iterator iter = m_agents.find(agent_id);
+    if (iter == m_agents.end()) {
+      return;
+    }
+    agent = iter->second.agent;
+  }
+  agent->RunMasterCallback(event, entry);
+}
+
+void InProcessRegistry::ScheduleBrowseComplete(unsigned int agent_id) {
+  m_ss->RegisterSingleTimeout(
+      m_propagation_delay,
+      NewSingleCallback(this, &InProcessRegistry::DeliverBrowseComplete,
+                        agent_id));
+}
+
+void InProcessRegistry::DeliverBrowseComplete(unsigned int agent_id) {
+  MutexLocker lock(&m_mu);
+  AgentMap::iterator iter = m_agents.find(agent_id);
+  if (iter != m_agents.end()) {
+    iter->second.agent->BrowseComplete();
+  }
+}
+
+// InProcessDiscoveryAgent
+// ----------------------------------------------------------------------------
+InProcessDiscoveryAgent::InProcessDiscoveryAgent(InProcessRegistry *registry,
+                                                 const Options &options)
+    : m_registry(registry),
+      m_scope(options.scope),
+      m_master_callback(options.master_callback),
+      m_agent_id(0),
+      m_running(false),
+      m_browse_gate(options.initial_browse_timeout,
+                    options.browse_complete_callback) {
+}
+
+InProcessDiscoveryAgent::~InProcessDiscoveryAgent() {
+  Stop();
+}
+
+bool InProcessDiscoveryAgent::Start() {
+  if (m_running) {
+    return true;
+  }
+  m_browse_gate.Reset();
+  m_agent_id = m_registry->AddAgent(this, m_scope,
+                                    m_master_callback.get() != NULL);
+  m_running = true;
+  if (!m_master_callback.get()) {
+    m_browse_gate.Open();
+  }
+  m_browse_gate.Wait();
+  return true;
+}
+
+/*
+ * As with the DNS-SD agents, this must not be called while an event for this
+ * agent is being delivered.
+ */
+bool InProcessDiscoveryAgent::Stop() {
+  if (m_running) {
+    m_registry->RemoveAgent(m_agent_id);
+    m_running = false;
+  }
+  return true;
+}
+
+void InProcessDiscoveryAgent::RegisterMaster(const MasterEntry &master) {
+  if (!m_running) {
+    OLA_WARN << "Agent not running, can't register " << master;
+    return;
+  }
+  m_registry->Register(m_agent_id, master);
+}
+
+void InProcessDiscoveryAgent::DeRegisterMaster(
+    const IPV4SocketAddress &master_address) {
+  if (m_running) {
+    m_registry->DeRegister(m_agent_id, master_address);
+  }
+}
+
+void InProcessDiscoveryAgent::RunMasterCallback(MasterEvent event,
+                                                const MasterEntry &entry) {
+  if (m_master_callback.get()) {
+    m_master_callback->Run(event, entry);
+  }
+}
+
+// InProcessAgentFactory
+// ----------------------------------------------------------------------------
+DiscoveryAgentInterface* InProcessAgentFactory::New(
+    const DiscoveryAgentInterface::Options &options) {
+  return new InProcessDiscoveryAgent(m_registry, options);
+}
@@ -0,0 +1,183 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * InProcessDiscoveryAgent.h
+ * An implementation of DiscoveryAgentInterface that doesn't use DNS-SD.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_INPROCESSDISCOVERYAGENT_H_
+#define SRC_INPROCESSDISCOVERYAGENT_H_
+
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServerInterface.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/thread/Mutex.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "src/BrowseGate.h"
+#include "src/DiscoveryAgent.h"
+#include "src/MasterEntry.h"
+
+class InProcessDiscoveryAgent;
+
+/**
+ * @brief A registry of masters that lives within a single process.
+ *
+ * The InProcessRegistry stands in for the DNS-SD network. Agents created
+ * from it see the registrations made by every other agent on the same
+ * registry, without any mDNS traffic.
+ *
+ * Events are delivered on the thread running the SelectServer passed to the
+ * constructor, which plays the role of the DNS-SD thread in the real
+ * implementations. An optional delay can be added to model the propagation
+ * time of the network.
+ *
+ * If an agent waits for the initial browse, the registry's SelectServer must
+ * be running on another thread, otherwise Start() waits for the full
+ * timeout.
+ */
+class InProcessRegistry {
+ public:
+  /**
+   * @brief Create a new registry.
+   * @param ss The SelectServer to deliver events on.
+   * @param propagation_delay_ms The time to wait before delivering events.
+   */
+  explicit InProcessRegistry(ola::io::SelectServerInterface *ss,
+                             unsigned int propagation_delay_ms = 0);
+  ~InProcessRegistry();
+
+  // These are called by InProcessDiscoveryAgent and are thread safe.
+  unsigned int AddAgent(InProcessDiscoveryAgent *agent,
+                        const std::string &scope,
+                        bool watch_masters);
+  void RemoveAgent(unsigned int agent_id);
+
+  void Register(unsigned int agent_id, const MasterEntry &master);
+  void DeRegister(unsigned int agent_id,
+                  const ola::network::IPV4SocketAddress &master_address);
+
+ private:
+  struct AgentState {
+    InProcessDiscoveryAgent *agent;
+    std::string scope;
+    bool watch_masters;
+  };
+
+  struct Registration {
+    unsigned int owner;
+    MasterEntry entry;
+  };
+
+  typedef std::map<unsigned int, AgentState> AgentMap;
+  typedef std::map<ola::network::IPV4SocketAddress, Registration>
+      RegistrationMap;
+  // A master that moves scope keeps its name, so names can repeat.
+  typedef std::map<std::string, std::multiset<std::string> > ScopeNameMap;
+
+  ola::io::SelectServerInterface *m_ss;
+  const unsigned int m_propagation_delay;
+
+  // Protected by m_mu
+  ola::thread::Mutex m_mu;
+  unsigned int m_next_agent_id;
+  AgentMap m_agents;
+  RegistrationMap m_registrations;
+  ScopeNameMap m_names;  // The registered names in each scope.
+
+  bool NameInUse(const std::string &scope,
+                 const std::string &service_name) const;
+  void AddName(const MasterEntry &entry);
+  void RemoveName(const MasterEntry &entry);
+  void NotifyScope(const std::string &scope,
+                   DiscoveryAgentInterface::MasterEvent event,
+                   const MasterEntry &entry);
+  void Notify(unsigned int agent_id,
+              DiscoveryAgentInterface::MasterEvent event,
+              const MasterEntry &entry);
+  void ScheduleDelivery(unsigned int agent_id,
+                        DiscoveryAgentInterface::MasterEvent event,
+                        MasterEntry entry);
+  void Deliver(unsigned int agent_id,
+               DiscoveryAgentInterface::MasterEvent event,
+               MasterEntry entry);
+  void ScheduleBrowseComplete(unsigned int agent_id);
+  void DeliverBrowseComplete(unsigned int agent_id);
+
+  DISALLOW_COPY_AND_ASSIGN(InProcessRegistry);
+};
+
+/**
+ * @brief An implementation of DiscoveryAgentInterface backed by an
+ * InProcessRegistry.
+ */
+class InProcessDiscoveryAgent : public DiscoveryAgentInterface {
+ public:
+  InProcessDiscoveryAgent(InProcessRegistry *registry,
+                          const Options &options);
+  ~InProcessDiscoveryAgent();
+
+  bool Start();
+
+  bool Stop();
+
+  void RegisterMaster(const MasterEntry &master);
+
+  void DeRegisterMaster(const ola::network::IPV4SocketAddress &master_address);
+
+  /**
+   * @brief Called by the registry when a master changes.
+   */
+  void RunMasterCallback(MasterEvent event, const MasterEntry &entry);
+
+  /**
+   * @brief Called by the registry once the existing masters have been
+   * delivered.
+   */
+  void BrowseComplete() { m_browse_gate.Open(); }
+
+ private:
+  InProcessRegistry *m_registry;
+  const std::string m_scope;
+  std::auto_ptr<MasterEventCallback> m_master_callback;
+  unsigned int m_agent_id;
+  bool m_running;
+  BrowseGate m_browse_gate;
+
+  DISALLOW_COPY_AND_ASSIGN(InProcessDiscoveryAgent);
+};
+
+/**
+ * @brief A DiscoveryAgentFactory that produces InProcessDiscoveryAgents.
+ */
+class InProcessAgentFactory : public DiscoveryAgentFactory {
+ public:
+  explicit InProcessAgentFactory(InProcessRegistry *registry)
+      : m_registry(registry) {
+  }
+
+  DiscoveryAgentInterface* New(
+      const DiscoveryAgentInterface::Options &options);
+
+ private:
+  InProcessRegistry *m_registry;
+
+  DISALLOW_COPY_AND_ASSIGN(InProcessAgentFactory);
+};
+#endif  // SRC_INPROCESSDISCOVERYAGENT_H_
@@ -0,0 +1,91 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * LoadPriority.cpp
+ * Derives a master's advertised priority from its load.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/LoadPriority.h"
+
+#include <stdint.h>
+#include <ola/Clock.h>
+
+#include <algorithm>
+
+LoadPriorityPolicy::LoadPriorityPolicy(const Options &options)
+    : m_options(options),
+      m_load(0.0),
+      m_priority(options.max_priority),
+      m_has_changed(false) {
+}
+
+bool LoadPriorityPolicy::Update(const ola::TimeStamp &now,
+                                const Sample &sample,
+                                uint8_t *priority) {
+  m_load += m_options.smoothing * (Score(sample) - m_load);
+  *priority = m_priority;
+
+  const uint8_t target = TargetPriority();
+  if (target == m_priority) {
+    return false;
+  }
+
+  const unsigned int change = target > m_priority ?
+      target - m_priority : m_priority - target;
+  if (change < m_options.hysteresis && target != m_options.max_priority) {
+    return false;
+  }
+
+  if (m_has_changed && now - m_last_change < m_options.min_change_interval) {
+    return false;
+  }
+
+  m_priority = target;
+  m_has_changed = true;
+  m_last_change = now;
+  *priority = m_priority;
+  return true;
+}
+
+double LoadPriorityPolicy::Score(const Sample &sample) const {
+  double score = 0.0;
+  if (m_options.client_capacity) {
+    score = std::max(
+        score, static_cast<double>(sample.clients) / m_options.client_capacity);
+  }
+  if (m_options.lag_limit.AsInt() > 0) {
+    score = std::max(score, static_cast<double>(sample.lag.AsInt()) /
+                            m_options.lag_limit.AsInt());
+  }
+  if (m_options.cpu_limit > 0) {
+    score = std::max(score, sample.cpu / m_options.cpu_limit);
+  }
+  return score;
+}
+
+uint8_t LoadPriorityPolicy::TargetPriority() const {
+  if (m_load <= m_options.shed_threshold ||
+      m_options.min_priority >= m_options.max_priority) {
+    return m_options.max_priority;
+  }
+
+  const double fraction = std::min(
+      1.0, (m_load - m_options.shed_threshold) /
+           std::max(1.0 - m_options.shed_threshold, 0.01));
+  const unsigned int range = m_options.max_priority - m_options.min_priority;
+  return static_cast<uint8_t>(
+      m_options.max_priority - static_cast<unsigned int>(fraction * range));
+}
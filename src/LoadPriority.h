@@ -0,0 +1,119 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * LoadPriority.h
+ * Derives a master's advertised priority from its load.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_LOADPRIORITY_H_
+#define SRC_LOADPRIORITY_H_
+
+#include <stdint.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+
+/**
+ * @brief Lowers a master's priority as it becomes loaded.
+ *
+ * Each sample is scored against the limits, the load being the worst of
+ * the client count, the event loop lag and the CPU use, and smoothed with
+ * an EWMA. Below shed_threshold the master advertises max_priority. From
+ * there the priority falls linearly, reaching min_priority when the load
+ * hits 1, so an overloaded master loses the election to a less loaded one
+ * before its clients notice.
+ *
+ * To stop the priority flapping, it only changes if it moves by at least
+ * hysteresis, or returns to max_priority, and no more than once every
+ * min_change_interval.
+ */
+class LoadPriorityPolicy {
+ public:
+  struct Options {
+    Options()
+        : max_priority(100),
+          min_priority(1),
+          client_capacity(0),
+          lag_limit(0, 50000),
+          cpu_limit(0.8),
+          shed_threshold(0.7),
+          smoothing(0.3),
+          hysteresis(10),
+          min_change_interval(5, 0) {
+    }
+
+    /** @brief The priority when lightly loaded. */
+    uint8_t max_priority;
+    /**
+     * @brief The priority at full load. This should be at least 1, since a
+     * priority of 0 can't be elected.
+     */
+    uint8_t min_priority;
+    /** @brief The number of clients that counts as full load, 0 to ignore. */
+    unsigned int client_capacity;
+    /** @brief The event loop lag that counts as full load, 0 to ignore. */
+    ola::TimeInterval lag_limit;
+    /** @brief The CPU use that counts as full load, 0 to ignore. */
+    double cpu_limit;
+    /** @brief The load at which the priority starts to fall. */
+    double shed_threshold;
+    /** @brief The weight of each new sample, between 0 and 1. */
+    double smoothing;
+    /** @brief The smallest change in priority that's advertised. */
+    unsigned int hysteresis;
+    /** @brief The minimum time between changes. */
+    ola::TimeInterval min_change_interval;
+  };
+
+  struct Sample {
+    Sample() : clients(0), cpu(0.0) {}
+
+    unsigned int clients;
+    /** @brief How late the event loop ran the sampling timer. */
+    ola::TimeInterval lag;
+    /** @brief The fraction of its working threads' CPU the process used. */
+    double cpu;
+  };
+
+  explicit LoadPriorityPolicy(const Options &options);
+
+  /**
+   * @brief Add a sample.
+   * @param now The current time.
+   * @param sample The load measurements.
+   * @param[out] priority The priority to advertise.
+   * @returns true if the priority changed.
+   */
+  bool Update(const ola::TimeStamp &now, const Sample &sample,
+              uint8_t *priority);
+
+  /** @brief The smoothed load, 1 is full load. */
+  double Load() const { return m_load; }
+
+  uint8_t Priority() const { return m_priority; }
+
+ private:
+  const Options m_options;
+  double m_load;
+  uint8_t m_priority;
+  bool m_has_changed;
+  ola::TimeStamp m_last_change;
+
+  double Score(const Sample &sample) const;
+  uint8_t TargetPriority() const;
+
+  DISALLOW_COPY_AND_ASSIGN(LoadPriorityPolicy);
+};
+#endif  // SRC_LOADPRIORITY_H_
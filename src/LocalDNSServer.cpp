@@ -0,0 +1,815 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * LocalDNSServer.cpp
+ * A small unicast DNS server to test wide-area DNS-SD against.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/LocalDNSServer.h"
+
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/StringUtils.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/Socket.h>
+#include <ola/network/SocketAddress.h>
+
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/DiscoveryAgent.h"
+
+using ola::NewCallback;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using ola::network::UDPSocket;
+using std::auto_ptr;
+using std::string;
+using std::vector;
+
+namespace {
+
+const uint16_t CLASS_IN = 1;
+const uint16_t CLASS_NONE = 254;
+const uint16_t CLASS_ANY = 255;
+
+const uint16_t FLAG_QR = 0x8000;
+const uint16_t FLAG_AA = 0x0400;
+const uint16_t FLAG_TC = 0x0200;
+const uint16_t FLAG_RD = 0x0100;
+const uint8_t OPCODE_QUERY = 0;
+const uint8_t OPCODE_UPDATE = 5;
+
+const uint32_t DEFAULT_TTL = 120;
+// Keep the negative caching time short, so browsers polling the zone see new
+// registrations quickly.
+const uint32_t NEGATIVE_TTL = 5;
+const unsigned int MAX_MESSAGE_SIZE = 9000;
+// Without EDNS0 clients only accept 512 byte responses over UDP.
+const unsigned int MAX_UDP_RESPONSE = 512;
+const unsigned int MAX_COMPRESSION_POINTERS = 32;
+
+string LowerCase(const string &name) {
+  string lower(name);
+  ola::ToLower(&lower);
+  return lower;
+}
+
+string Absolute(const string &domain) {
+  string name = LowerCase(domain);
+  if (name.empty() || name[name.size() - 1] != '.') {
+    name.push_back('.');
+  }
+  return name;
+}
+
+string EscapeLabel(const string &label) {
+  string escaped;
+  for (unsigned int i = 0; i < label.size(); i++) {
+    if (label[i] == '.' || label[i] == '\\') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(label[i]);
+  }
+  return escaped;
+}
+
+void AppendUInt16(uint16_t value, string *output) {
+  output->push_back(static_cast<char>(value >> 8));
+  output->push_back(static_cast<char>(value & 0xff));
+}
+
+void AppendUInt32(uint32_t value, string *output) {
+  AppendUInt16(static_cast<uint16_t>(value >> 16), output);
+  AppendUInt16(static_cast<uint16_t>(value & 0xffff), output);
+}
+
+/*
+ * Append a name in wire format, without compression.
+ */
+bool AppendName(const string &name, string *output) {
+  string label;
+  for (unsigned int i = 0; i < name.size(); i++) {
+    if (name[i] == '\\' && i + 1 < name.size()) {
+      label.push_back(name[++i]);
+    } else if (name[i] == '.') {
+      if (label.size() > 63 || (label.empty() && name.size() > 1)) {
+        return false;
+      }
+      if (!label.empty()) {
+        output->push_back(static_cast<char>(label.size()));
+        output->append(label);
+        label.clear();
+      }
+    } else {
+      label.push_back(name[i]);
+    }
+  }
+  if (!label.empty()) {
+    output->push_back(static_cast<char>(label.size()));
+    output->append(label);
+  }
+  output->push_back(0);
+  return true;
+}
+
+class MessageReader {
+ public:
+  MessageReader(const uint8_t *data, unsigned int size)
+      : m_data(data),
+        m_size(size),
+        m_offset(0) {
+  }
+
+  unsigned int Offset() const { return m_offset; }
+
+  bool ReadUInt16(uint16_t *value) {
+    if (m_offset + 2 > m_size) {
+      return false;
+    }
+    *value = static_cast<uint16_t>((m_data[m_offset] << 8) |
+                                   m_data[m_offset + 1]);
+    m_offset += 2;
+    return true;
+  }
+
+  bool ReadUInt32(uint32_t *value) {
+    uint16_t high, low;
+    if (!ReadUInt16(&high) || !ReadUInt16(&low)) {
+      return false;
+    }
+    *value = (static_cast<uint32_t>(high) << 16) | low;
+    return true;
+  }
+
+  bool ReadBytes(unsigned int length, string *output) {
+    if (m_offset + length > m_size) {
+      return false;
+    }
+    output->append(reinterpret_cast<const char*>(m_data + m_offset), length);
+    m_offset += length;
+    return true;
+  }
+
+  /*
+   * Read a possibly compressed name, and return it in presentation format.
+   */
+  bool ReadName(string *name) {
+    name->clear();
+    unsigned int offset = m_offset;
+    unsigned int pointers = 0;
+    bool jumped = false;
+    while (true) {
+      if (offset >= m_size) {
+        return false;
+      }
+      const uint8_t length = m_data[offset];
+      if ((length & 0xc0) == 0xc0) {
+        if (offset + 1 >= m_size || ++pointers > MAX_COMPRESSION_POINTERS) {
+          return false;
+        }
+        if (!jumped) {
+          m_offset = offset + 2;
+          jumped = true;
+        }
+        offset = ((length & 0x3f) << 8) | m_data[offset + 1];
+        continue;
+      } else if (length & 0xc0) {
+        return false;
+      }
+
+      offset++;
+      if (length == 0) {
+        break;
+      }
+      if (offset + length > m_size) {
+        return false;
+      }
+      name->append(EscapeLabel(string(
+          reinterpret_cast<const char*>(m_data + offset), length)));
+      name->push_back('.');
+      offset += length;
+    }
+    if (!jumped) {
+      m_offset = offset;
+    }
+    if (name->empty()) {
+      *name = ".";
+    }
+    return true;
+  }
+
+ private:
+  const uint8_t *m_data;
+  const unsigned int m_size;
+  unsigned int m_offset;
+};
+
+/*
+ * Read the RDATA of a record, uncompressing any names so records can be
+ * stored and compared.
+ */
+bool ReadRData(MessageReader *reader, uint16_t type, uint16_t length,
+               string *rdata) {
+  if (length == 0) {
+    return true;
+  }
+  const unsigned int end = reader->Offset() + length;
+  string name;
+  switch (type) {
+    case LocalDNSServer::TYPE_NS:
+    case LocalDNSServer::TYPE_CNAME:
+    case LocalDNSServer::TYPE_PTR:
+      if (!reader->ReadName(&name) || !AppendName(name, rdata)) {
+        return false;
+      }
+      break;
+    case LocalDNSServer::TYPE_SRV:
+      if (!reader->ReadBytes(6, rdata) || !reader->ReadName(&name) ||
+          !AppendName(name, rdata)) {
+        return false;
+      }
+      break;
+    case LocalDNSServer::TYPE_SOA:
+      {
+        string rname;
+        if (!reader->ReadName(&name) || !reader->ReadName(&rname) ||
+            !AppendName(name, rdata) || !AppendName(rname, rdata) ||
+            !reader->ReadBytes(20, rdata)) {
+          return false;
+        }
+      }
+      break;
+    default:
+      return reader->ReadBytes(length, rdata);
+  }
+  return reader->Offset() == end;
+}
+
+bool ReadRecord(MessageReader *reader,
+                LocalDNSServer::ResourceRecord *record,
+                uint16_t *dns_class) {
+  uint16_t rdata_length;
+  return (reader->ReadName(&record->name) &&
+          reader->ReadUInt16(&record->type) &&
+          reader->ReadUInt16(dns_class) &&
+          reader->ReadUInt32(&record->ttl) &&
+          reader->ReadUInt16(&rdata_length) &&
+          ReadRData(reader, record->type, rdata_length, &record->rdata));
+}
+
+/*
+ * Return the name in the RDATA of a PTR, NS, CNAME or SRV record.
+ */
+bool RDataName(const LocalDNSServer::ResourceRecord &record, string *name) {
+  MessageReader reader(reinterpret_cast<const uint8_t*>(record.rdata.data()),
+                       record.rdata.size());
+  string fixed;
+  switch (record.type) {
+    case LocalDNSServer::TYPE_NS:
+    case LocalDNSServer::TYPE_CNAME:
+    case LocalDNSServer::TYPE_PTR:
+      return reader.ReadName(name);
+    case LocalDNSServer::TYPE_SRV:
+      return reader.ReadBytes(6, &fixed) && reader.ReadName(name);
+    default:
+      return false;
+  }
+}
+
+void AppendRecords(const vector<const LocalDNSServer::ResourceRecord*> &records,
+                   string *output) {
+  vector<const LocalDNSServer::ResourceRecord*>::const_iterator iter =
+      records.begin();
+  for (; iter != records.end(); ++iter) {
+    const LocalDNSServer::ResourceRecord &record = **iter;
+    AppendName(record.name, output);
+    AppendUInt16(record.type, output);
+    AppendUInt16(CLASS_IN, output);
+    AppendUInt32(record.ttl, output);
+    AppendUInt16(static_cast<uint16_t>(record.rdata.size()), output);
+    output->append(record.rdata);
+  }
+}
+}  // namespace
+
+LocalDNSServer::LocalDNSServer(ola::io::SelectServerInterface *ss,
+                               const string &domain)
+    : m_ss(ss),
+      m_domain(Absolute(domain)),
+      m_updates(0) {
+}
+
+LocalDNSServer::~LocalDNSServer() {
+  Stop();
+}
+
+bool LocalDNSServer::Start(const IPV4SocketAddress &address) {
+  if (m_socket.get()) {
+    return true;
+  }
+
+  auto_ptr<UDPSocket> socket(new UDPSocket());
+  if (!socket->Init() || !socket->Bind(address) ||
+      !socket->GetSocketAddress(&m_listen_address)) {
+    OLA_WARN << "Failed to listen on " << address;
+    return false;
+  }
+  socket->SetOnData(NewCallback(this, &LocalDNSServer::ReceiveMessage));
+  m_ss->AddReadDescriptor(socket.get());
+  m_socket.reset(socket.release());
+
+  AddZoneRecords();
+  OLA_INFO << "Serving " << m_domain << " on " << m_listen_address;
+  return true;
+}
+
+void LocalDNSServer::Stop() {
+  if (m_socket.get()) {
+    m_ss->RemoveReadDescriptor(m_socket.get());
+    m_socket->Close();
+    m_socket.reset();
+  }
+}
+
+void LocalDNSServer::AddRecord(const ResourceRecord &record) {
+  const string key = LowerCase(record.name);
+  std::pair<RecordMap::iterator, RecordMap::iterator> range =
+      m_records.equal_range(key);
+  for (RecordMap::iterator iter = range.first; iter != range.second;
+       ++iter) {
+    if (iter->second.type == record.type &&
+        iter->second.rdata == record.rdata) {
+      iter->second.ttl = record.ttl;
+      return;
+    }
+  }
+  m_records.insert(RecordMap::value_type(key, record));
+}
+
+void LocalDNSServer::AddMaster(const MasterEntry &master,
+                               const string &host) {
+  const string instance = InstanceName(master.service_name);
+  const string host_name = host + "." + m_domain;
+
+  ResourceRecord record;
+  record.ttl = DEFAULT_TTL;
+
+  record.type = TYPE_PTR;
+  AppendName(instance, &record.rdata);
+  record.name = string(DiscoveryAgentInterface::MASTER_SERVICE) + "." +
+                m_domain;
+  AddRecord(record);
+  record.name = ScopeServiceName(master.scope);
+  AddRecord(record);
+
+  record.name = instance;
+  record.type = TYPE_SRV;
+  record.rdata.clear();
+  AppendUInt16(0, &record.rdata);  // priority
+  AppendUInt16(0, &record.rdata);  // weight
+  AppendUInt16(master.address.Port(), &record.rdata);
+  AppendName(host_name, &record.rdata);
+  AddRecord(record);
+
+  record.type = TYPE_TXT;
+  record.rdata = BuildTxtData(master);
+  AddRecord(record);
+
+  record.name = host_name;
+  record.type = TYPE_A;
+  // AsInt() is in network byte order.
+  const uint32_t ip = master.address.Host().AsInt();
+  record.rdata.assign(reinterpret_cast<const char*>(&ip), sizeof(ip));
+  AddRecord(record);
+}
+
+void LocalDNSServer::GetRecords(const string &name, uint16_t type,
+                                vector<ResourceRecord> *records) const {
+  vector<const ResourceRecord*> matches;
+  FindRecords(name, type, &matches);
+  vector<const ResourceRecord*>::const_iterator iter = matches.begin();
+  for (; iter != matches.end(); ++iter) {
+    records->push_back(**iter);
+  }
+}
+
+unsigned int LocalDNSServer::QueryCount(const string &name) const {
+  QueryCountMap::const_iterator iter = m_query_counts.find(LowerCase(name));
+  return iter == m_query_counts.end() ? 0 : iter->second;
+}
+
+string LocalDNSServer::ScopeServiceName(const string &scope) const {
+  return "_" + EscapeLabel(scope) + "._sub." +
+         DiscoveryAgentInterface::MASTER_SERVICE + "." + m_domain;
+}
+
+string LocalDNSServer::InstanceName(const string &service_name) const {
+  return EscapeLabel(service_name) + "." +
+         DiscoveryAgentInterface::MASTER_SERVICE + "." + m_domain;
+}
+
+/*
+ * The same TXT data the agents register.
+ */
+string LocalDNSServer::BuildTxtData(const MasterEntry &master) {
+  vector<string> entries;
+  std::ostringstream str;
+  str << DiscoveryAgentInterface::TXT_VERSION_KEY << "="
+      << static_cast<int>(DiscoveryAgentInterface::TXT_VERSION);
+  entries.push_back(str.str());
+  str.str("");
+  str << DiscoveryAgentInterface::PRIORITY_KEY << "="
+      << static_cast<int>(master.priority);
+  entries.push_back(str.str());
+  str.str("");
+  str << DiscoveryAgentInterface::SCOPE_KEY << "=" << master.scope;
+  entries.push_back(str.str());
+  if (master.term) {
+    str.str("");
+    str << DiscoveryAgentInterface::TERM_KEY << "=" << master.term;
+    entries.push_back(str.str());
+  }
+
+  string txt_data;
+  vector<string>::const_iterator iter = entries.begin();
+  for (; iter != entries.end(); ++iter) {
+    txt_data.push_back(static_cast<char>(iter->size()));
+    txt_data.append(*iter);
+  }
+  return txt_data;
+}
+
+void LocalDNSServer::ReceiveMessage() {
+  uint8_t data[MAX_MESSAGE_SIZE];
+  ssize_t size = sizeof(data);
+  IPV4Address source;
+  uint16_t port;
+  if (!m_socket->RecvFrom(data, &size, source, port)) {
+    return;
+  }
+
+  string response;
+  if (HandleMessage(data, size, &response)) {
+    m_socket->SendTo(reinterpret_cast<const uint8_t*>(response.data()),
+                     response.size(), IPV4SocketAddress(source, port));
+  }
+}
+
+/*
+ * Returns false if there's nothing to send back.
+ */
+bool LocalDNSServer::HandleMessage(const uint8_t *data, unsigned int size,
+                                   string *response) {
+  MessageReader reader(data, size);
+  uint16_t id, flags, counts[4];
+  if (!reader.ReadUInt16(&id) || !reader.ReadUInt16(&flags)) {
+    return false;
+  }
+  for (unsigned int i = 0; i < 4; i++) {
+    if (!reader.ReadUInt16(&counts[i])) {
+      return false;
+    }
+  }
+  if (flags & FLAG_QR) {
+    return false;
+  }
+  const uint8_t opcode = (flags >> 11) & 0x0f;
+
+  // For an update, this is the zone section.
+  string question_name;
+  uint16_t question_type = 0;
+  uint16_t question_class = 0;
+  const bool have_question = (counts[0] == 1 &&
+                              reader.ReadName(&question_name) &&
+                              reader.ReadUInt16(&question_type) &&
+                              reader.ReadUInt16(&question_class));
+
+  vector<const ResourceRecord*> answers, authority, additional;
+  uint8_t rcode = RCODE_FORMERR;
+  if (!have_question) {
+    rcode = RCODE_FORMERR;
+  } else if (opcode == OPCODE_QUERY) {
+    rcode = HandleQuery(question_name, question_type, &answers, &authority,
+                        &additional);
+  } else if (opcode == OPCODE_UPDATE) {
+    vector<UpdateRecord> prerequisites, updates;
+    bool ok = true;
+    for (unsigned int i = 0; ok && i < counts[1] + counts[2]; i++) {
+      UpdateRecord update;
+      ok = ReadRecord(&reader, &update.record, &update.dns_class);
+      (i < counts[1] ? prerequisites : updates).push_back(update);
+    }
+
+    if (LowerCase(question_name) != m_domain ||
+        question_type != TYPE_SOA) {
+      OLA_WARN << "Refusing update for zone " << question_name;
+      rcode = RCODE_NOTAUTH;
+    } else if (!ok) {
+      rcode = RCODE_FORMERR;
+    } else {
+      rcode = HandleUpdate(prerequisites, updates);
+    }
+  } else {
+    rcode = RCODE_NOTIMP;
+  }
+
+  for (unsigned int attempt = 0; attempt < 3; attempt++) {
+    // If the response is too big drop the additional section, and failing
+    // that the answers, setting TC so the client knows.
+    const bool truncated = attempt == 2;
+    if (attempt == 1) {
+      additional.clear();
+    } else if (truncated) {
+      answers.clear();
+      authority.clear();
+    }
+
+    response->clear();
+    AppendUInt16(id, response);
+    AppendUInt16(static_cast<uint16_t>(
+        FLAG_QR | (opcode << 11) | FLAG_AA | (flags & FLAG_RD) |
+        (truncated ? FLAG_TC : 0) | rcode), response);
+    AppendUInt16(have_question ? 1 : 0, response);
+    AppendUInt16(static_cast<uint16_t>(answers.size()), response);
+    AppendUInt16(static_cast<uint16_t>(authority.size()), response);
+    AppendUInt16(static_cast<uint16_t>(additional.size()), response);
+    if (have_question) {
+      AppendName(question_name, response);
+      AppendUInt16(question_type, response);
+      AppendUInt16(question_class, response);
+    }
+    AppendRecords(answers, response);
+    AppendRecords(authority, response);
+    AppendRecords(additional, response);
+    if (response->size() <= MAX_UDP_RESPONSE) {
+      break;
+    }
+  }
+  return true;
+}
+
+uint8_t LocalDNSServer::HandleQuery(const string &name, uint16_t type,
+                                    vector<const ResourceRecord*> *answers,
+                                    vector<const ResourceRecord*> *authority,
+                                    vector<const ResourceRecord*> *additional) {
+  m_query_counts[LowerCase(name)]++;
+  if (!InZone(name)) {
+    return RCODE_REFUSED;
+  }
+
+  FindRecords(name, type, answers);
+  vector<const ResourceRecord*>::const_iterator iter = answers->begin();
+  for (; iter != answers->end(); ++iter) {
+    AddAdditional(**iter, additional);
+  }
+
+  if (answers->empty()) {
+    // Clients use the SOA to find the zone, and its minimum for negative
+    // caching.
+    FindRecords(m_domain, TYPE_SOA, authority);
+    return NameInUse(name) ? RCODE_NOERROR : RCODE_NXDOMAIN;
+  }
+  return RCODE_NOERROR;
+}
+
+/*
+ * An update is all or nothing, so check everything before changing the zone.
+ */
+uint8_t LocalDNSServer::HandleUpdate(
+    const vector<UpdateRecord> &prerequisites,
+    const vector<UpdateRecord> &updates) {
+  vector<UpdateRecord>::const_iterator iter = prerequisites.begin();
+  for (; iter != prerequisites.end(); ++iter) {
+    if (!InZone(iter->record.name)) {
+      return RCODE_NOTZONE;
+    }
+    const uint8_t rcode = CheckPrerequisite(*iter);
+    if (rcode != RCODE_NOERROR) {
+      OLA_INFO << "Update prerequisite for " << iter->record.name
+               << " failed with " << static_cast<int>(rcode);
+      return rcode;
+    }
+  }
+
+  for (iter = updates.begin(); iter != updates.end(); ++iter) {
+    if (!InZone(iter->record.name)) {
+      return RCODE_NOTZONE;
+    }
+    if (iter->dns_class != CLASS_IN && iter->dns_class != CLASS_ANY &&
+        iter->dns_class != CLASS_NONE) {
+      return RCODE_FORMERR;
+    }
+  }
+
+  for (iter = updates.begin(); iter != updates.end(); ++iter) {
+    OLA_INFO << (iter->dns_class == CLASS_IN ? "Adding " : "Deleting ")
+             << iter->record.name << ", type " << iter->record.type;
+    ApplyUpdate(*iter);
+  }
+  if (!updates.empty()) {
+    m_updates++;
+  }
+  return RCODE_NOERROR;
+}
+
+/*
+ * See section 3.2 of RFC 2136.
+ */
+uint8_t LocalDNSServer::CheckPrerequisite(
+    const UpdateRecord &prerequisite) const {
+  const ResourceRecord &record = prerequisite.record;
+  vector<const ResourceRecord*> matches;
+  FindRecords(record.name, record.type, &matches);
+
+  switch (prerequisite.dns_class) {
+    case CLASS_ANY:
+      if (!matches.empty()) {
+        return RCODE_NOERROR;
+      }
+      return record.type == TYPE_ANY ? RCODE_NXDOMAIN : RCODE_NXRRSET;
+    case CLASS_NONE:
+      if (matches.empty()) {
+        return RCODE_NOERROR;
+      }
+      return record.type == TYPE_ANY ? RCODE_YXDOMAIN : RCODE_YXRRSET;
+    case CLASS_IN:
+      {
+        vector<const ResourceRecord*>::const_iterator iter = matches.begin();
+        for (; iter != matches.end(); ++iter) {
+          if ((*iter)->rdata == record.rdata) {
+            return RCODE_NOERROR;
+          }
+        }
+      }
+      return RCODE_NXRRSET;
+    default:
+      return RCODE_FORMERR;
+  }
+}
+
+/*
+ * See section 3.4.2 of RFC 2136.
+ */
+void LocalDNSServer::ApplyUpdate(const UpdateRecord &update) {
+  const ResourceRecord &record = update.record;
+  if (update.dns_class == CLASS_IN) {
+    if (record.type != TYPE_SOA && record.type != TYPE_ANY) {
+      AddRecord(record);
+    }
+    return;
+  }
+
+  const string key = LowerCase(record.name);
+  const bool apex = key == m_domain;
+  std::pair<RecordMap::iterator, RecordMap::iterator> range =
+      m_records.equal_range(key);
+  RecordMap::iterator iter = range.first;
+  while (iter != range.second) {
+    const ResourceRecord &existing = iter->second;
+    const bool match = (
+        (record.type == TYPE_ANY || record.type == existing.type) &&
+        (update.dns_class == CLASS_ANY || record.rdata == existing.rdata));
+    // The zone's own SOA and NS records stay.
+    const bool protect = apex && (existing.type == TYPE_SOA ||
+                                  existing.type == TYPE_NS);
+    if (match && !protect) {
+      m_records.erase(iter++);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+/*
+ * Add the records a DNS-SD client would otherwise have to query for next.
+ */
+void LocalDNSServer::AddAdditional(
+    const ResourceRecord &record,
+    vector<const ResourceRecord*> *additional) const {
+  string target;
+  if (record.type == TYPE_PTR && RDataName(record, &target)) {
+    vector<const ResourceRecord*> services;
+    FindRecords(target, TYPE_SRV, &services);
+    FindRecords(target, TYPE_TXT, additional);
+    vector<const ResourceRecord*>::const_iterator iter = services.begin();
+    for (; iter != services.end(); ++iter) {
+      additional->push_back(*iter);
+      AddAdditional(**iter, additional);
+    }
+  } else if (record.type == TYPE_SRV && RDataName(record, &target)) {
+    FindRecords(target, TYPE_A, additional);
+  }
+}
+
+void LocalDNSServer::FindRecords(const string &name, uint16_t type,
+                                 vector<const ResourceRecord*> *records) const {
+  std::pair<RecordMap::const_iterator, RecordMap::const_iterator> range =
+      m_records.equal_range(LowerCase(name));
+  for (RecordMap::const_iterator iter = range.first; iter != range.second;
+       ++iter) {
+    if (type == TYPE_ANY || iter->second.type == type) {
+      records->push_back(&iter->second);
+    }
+  }
+}
+
+/*
+ * True if the name has records, or names below it do.
+ */
+bool LocalDNSServer::NameInUse(const string &name) const {
+  const string key = LowerCase(name);
+  const string suffix = "." + key;
+  RecordMap::const_iterator iter = m_records.begin();
+  for (; iter != m_records.end(); ++iter) {
+    const string &existing = iter->first;
+    if (existing == key ||
+        (existing.size() > suffix.size() &&
+         existing.compare(existing.size() - suffix.size(), suffix.size(),
+                          suffix) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LocalDNSServer::InZone(const string &name) const {
+  const string key = LowerCase(name);
+  return (key == m_domain ||
+          (key.size() > m_domain.size() &&
+           key[key.size() - m_domain.size() - 1] == '.' &&
+           key.compare(key.size() - m_domain.size(), m_domain.size(),
+                       m_domain) == 0));
+}
+
+/*
+ * The records that let a DNS-SD client find the zone, its update server and
+ * the browse and registration domains.
+ */
+void LocalDNSServer::AddZoneRecords() {
+  const string ns_name = "ns." + m_domain;
+  IPV4Address ns_address = m_listen_address.Host();
+  if (ns_address.IsWildcard()) {
+    ns_address = IPV4Address::Loopback();
+  }
+
+  ResourceRecord record;
+  record.ttl = DEFAULT_TTL;
+  record.name = m_domain;
+  record.type = TYPE_SOA;
+  AppendName(ns_name, &record.rdata);
+  AppendName("hostmaster." + m_domain, &record.rdata);
+  AppendUInt32(1, &record.rdata);  // serial
+  AppendUInt32(3600, &record.rdata);  // refresh
+  AppendUInt32(600, &record.rdata);  // retry
+  AppendUInt32(86400, &record.rdata);  // expire
+  AppendUInt32(NEGATIVE_TTL, &record.rdata);
+  AddRecord(record);
+
+  record.type = TYPE_NS;
+  record.rdata.clear();
+  AppendName(ns_name, &record.rdata);
+  AddRecord(record);
+
+  record.name = ns_name;
+  record.type = TYPE_A;
+  const uint32_t ip = ns_address.AsInt();
+  record.rdata.assign(reinterpret_cast<const char*>(&ip), sizeof(ip));
+  AddRecord(record);
+
+  record.name = "_dns-update._udp." + m_domain;
+  record.type = TYPE_SRV;
+  record.rdata.clear();
+  AppendUInt16(0, &record.rdata);
+  AppendUInt16(0, &record.rdata);
+  AppendUInt16(m_listen_address.Port(), &record.rdata);
+  AppendName(ns_name, &record.rdata);
+  AddRecord(record);
+
+  const char *enumeration_names[] = {"b", "db", "r", "dr"};
+  record.type = TYPE_PTR;
+  record.rdata.clear();
+  AppendName(m_domain, &record.rdata);
+  for (unsigned int i = 0; i < sizeof(enumeration_names) / sizeof(char*);
+       i++) {
+    record.name = string(enumeration_names[i]) + "._dns-sd._udp." + m_domain;
+    AddRecord(record);
+  }
+}
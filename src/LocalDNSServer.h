@@ -0,0 +1,181 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * LocalDNSServer.h
+ * A small unicast DNS server to test wide-area DNS-SD against.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_LOCALDNSSERVER_H_
+#define SRC_LOCALDNSSERVER_H_
+
+#include <stdint.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServerInterface.h>
+#include <ola/network/Socket.h>
+#include <ola/network/SocketAddress.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/MasterEntry.h"
+
+/**
+ * @brief An authoritative DNS server for a single zone, used as a stand-in
+ * for a site's DNS server when testing wide-area DNS-SD.
+ *
+ * It answers unicast queries from the records in the zone, with the SRV, TXT
+ * and A records a DNS-SD browser needs added to the additional section, and
+ * accepts DNS UPDATE (RFC 2136) messages so masters can register in the
+ * zone. There's no TSIG, any update to the zone is accepted.
+ *
+ * The zone is created with the records a DNS-SD client uses to find the
+ * update server: the SOA and NS records, an A record for the name server,
+ * and the _dns-update._udp SRV record.
+ */
+class LocalDNSServer {
+ public:
+  enum RecordType {
+    TYPE_A = 1,
+    TYPE_NS = 2,
+    TYPE_CNAME = 5,
+    TYPE_SOA = 6,
+    TYPE_PTR = 12,
+    TYPE_TXT = 16,
+    TYPE_SRV = 33,
+    TYPE_ANY = 255,
+  };
+
+  struct ResourceRecord {
+    ResourceRecord() : type(0), ttl(0) {}
+
+    // An absolute name, with the trailing dot. Dots and backslashes within a
+    // label are escaped with a backslash.
+    std::string name;
+    uint16_t type;
+    uint32_t ttl;
+    // In wire format, with any names uncompressed.
+    std::string rdata;
+  };
+
+  /**
+   * @brief Create a new server.
+   * @param ss The SelectServer to run on.
+   * @param domain The zone to serve, e.g. "dnssd.test.".
+   */
+  LocalDNSServer(ola::io::SelectServerInterface *ss,
+                 const std::string &domain);
+  ~LocalDNSServer();
+
+  /**
+   * @brief Start listening. If the port is 0 one is picked, see
+   * ListenAddress().
+   */
+  bool Start(const ola::network::IPV4SocketAddress &address);
+  void Stop();
+
+  ola::network::IPV4SocketAddress ListenAddress() const {
+    return m_listen_address;
+  }
+  const std::string &Domain() const { return m_domain; }
+
+  void AddRecord(const ResourceRecord &record);
+
+  /**
+   * @brief Add the PTR, SRV, TXT and A records for a master, as a master
+   * registering with DNS UPDATE would.
+   * @param master The master to add.
+   * @param host The host name for the SRV record, relative to the zone.
+   */
+  void AddMaster(const MasterEntry &master, const std::string &host);
+
+  void GetRecords(const std::string &name, uint16_t type,
+                  std::vector<ResourceRecord> *records) const;
+
+  /**
+   * @brief The number of queries received for a name, of any type.
+   */
+  unsigned int QueryCount(const std::string &name) const;
+
+  /**
+   * @brief The number of updates that changed the zone.
+   */
+  unsigned int UpdateCount() const { return m_updates; }
+
+  /**
+   * @brief The name of the PTR record that lists the masters in a scope.
+   */
+  std::string ScopeServiceName(const std::string &scope) const;
+
+  /**
+   * @brief The name of a master's SRV and TXT records.
+   */
+  std::string InstanceName(const std::string &service_name) const;
+
+  static std::string BuildTxtData(const MasterEntry &master);
+
+ private:
+  typedef std::multimap<std::string, ResourceRecord> RecordMap;
+  typedef std::map<std::string, unsigned int> QueryCountMap;
+
+  enum ResponseCode {
+    RCODE_NOERROR = 0,
+    RCODE_FORMERR = 1,
+    RCODE_NXDOMAIN = 3,
+    RCODE_NOTIMP = 4,
+    RCODE_REFUSED = 5,
+    RCODE_YXDOMAIN = 6,
+    RCODE_YXRRSET = 7,
+    RCODE_NXRRSET = 8,
+    RCODE_NOTAUTH = 9,
+    RCODE_NOTZONE = 10,
+  };
+
+  struct UpdateRecord {
+    ResourceRecord record;
+    uint16_t dns_class;
+  };
+
+  ola::io::SelectServerInterface *m_ss;
+  const std::string m_domain;
+  std::auto_ptr<ola::network::UDPSocket> m_socket;
+  ola::network::IPV4SocketAddress m_listen_address;
+  RecordMap m_records;
+  QueryCountMap m_query_counts;
+  unsigned int m_updates;
+
+  void ReceiveMessage();
+  bool HandleMessage(const uint8_t *data, unsigned int size,
+                     std::string *response);
+  uint8_t HandleQuery(const std::string &name, uint16_t type,
+                      std::vector<const ResourceRecord*> *answers,
+                      std::vector<const ResourceRecord*> *authority,
+                      std::vector<const ResourceRecord*> *additional);
+  uint8_t HandleUpdate(const std::vector<UpdateRecord> &prerequisites,
+                       const std::vector<UpdateRecord> &updates);
+  uint8_t CheckPrerequisite(const UpdateRecord &prerequisite) const;
+  void ApplyUpdate(const UpdateRecord &update);
+  void AddAdditional(const ResourceRecord &record,
+                     std::vector<const ResourceRecord*> *additional) const;
+  void FindRecords(const std::string &name, uint16_t type,
+                   std::vector<const ResourceRecord*> *records) const;
+  bool NameInUse(const std::string &name) const;
+  bool InZone(const std::string &name) const;
+  void AddZoneRecords();
+
+  DISALLOW_COPY_AND_ASSIGN(LocalDNSServer);
+};
+#endif  // SRC_LOCALDNSSERVER_H_
@@ -0,0 +1,908 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterClient.cpp
+ * A client that tracks the elected master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterClient.h"
+
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/network/NetworkUtils.h>
+#include <ola/strings/Format.h>
+#include <unistd.h>
+
+#include <memory>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::network::GenericSocketAddress;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using ola::network::TCPSocket;
+using ola::strings::ToHex;
+using std::auto_ptr;
+using std::endl;
+
+namespace {
+ola::TimeStamp GetTime() {
+  ola::Clock clock;
+  ola::TimeStamp now;
+  clock.CurrentTime(&now);
+  return now;
+}
+
+/*
+ * Clients in the same process, e.g. the virtual clients, need different
+ * keys.
+ */
+std::string DefaultShardKey() {
+  static unsigned int instance = 0;
+  std::ostringstream key;
+  key << ola::network::Hostname() << ":" << getpid() << ":"
+      << __sync_fetch_and_add(&instance, 1);
+  return key.str();
+}
+}  // namespace
+
+#define LOG_INFO OLA_INFO << GetTime() << " : "
+
+MasterClient::MasterClient(ola::io::SelectServer *ss, const Options &options)
+    : m_ss(ss),
+      m_options(options),
+      m_state_change_callback(options.state_change_callback),
+      m_election(NewCallback(this, &MasterClient::LeaderChanged)),
+      m_ring(options.ring_points),
+      m_shard_key(options.shard_key.empty() ? DefaultShardKey() :
+                  options.shard_key),
+      m_shutting_down(false),
+      m_update_pending(false),
+      m_failure_check_timeout(ola::thread::INVALID_TIMEOUT),
+      m_tcp_socket_factory(NewCallback(this, &MasterClient::OnTCPConnect)),
+      m_connector(m_ss, &m_tcp_socket_factory, options.tcp_connect_timeout),
+      m_term(0),
+      m_messages_received(0),
+      m_mismatched(false),
+      m_failover_pending(false) {
+}
+
+MasterClient::~MasterClient() {
+  m_shutting_down = true;
+
+  // Stop the agent first so no more events are queued, then flush the ones
+  // that are already pending since they refer to this object.
+  m_discovery_agent.reset();
+  m_ss->DrainCallbacks();
+
+  if (m_failure_check_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_failure_check_timeout);
+  }
+  if (m_multicast_socket.get()) {
+    m_ss->RemoveReadDescriptor(m_multicast_socket.get());
+    m_multicast_socket->Close();
+  }
+
+  MasterMap::iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    CloseConnectionToMaster(&iter->second);
+    delete iter->second.backoff;
+  }
+}
+
+bool MasterClient::Init() {
+  // Start the agent.
+  DiscoveryAgentFactory default_factory;
+  DiscoveryAgentFactory *factory = m_options.agent_factory ?
+      m_options.agent_factory : &default_factory;
+  DiscoveryAgentInterface::Options options;
+  options.scope = m_options.scope;
+  options.browse_domain = m_options.browse_domain;
+  options.master_callback = NewCallback(this, &MasterClient::MasterChanged);
+  auto_ptr<DiscoveryAgentInterface> agent(factory->New(options));
+
+  if (!agent.get() || !agent->Start()) {
+    return false;
+  }
+
+  m_discovery_agent.reset(agent.release());
+
+  if (!m_options.multicast_group.IsWildcard() && !StartMulticast()) {
+    return false;
+  }
+
+  if (m_options.failure_check_interval != ola::TimeInterval()) {
+    m_failure_check_timeout = m_ss->RegisterRepeatingTimeout(
+        m_options.failure_check_interval,
+        NewCallback(this, &MasterClient::CheckForFailures));
+  }
+  return true;
+}
+
+void MasterClient::DumpMasterState(std::ostream *out) const {
+  MasterMap::const_iterator iter = m_masters.begin();
+  *out << "--------------" << endl;
+  for (; iter != m_masters.end(); ++iter) {
+    const Master &master = iter->second;
+    *out << master.name << " @ " << master.address << ", priority "
+         << static_cast<int>(master.priority) << ", term " << master.term
+         << ", "
+         << (master.socket ? "connected" :
+             (master.active ? "disconnected" : "idle"))
+         << (master.suspect ? ", suspected failed" : "");
+    if (master.has_announcement) {
+      *out << ", announcement " << master.sequence << ", lost "
+           << master.lost_announcements;
+    }
+    *out << endl;
+  }
+  if (m_options.sharded) {
+    *out << "Shard key is " << m_shard_key << ", " << m_ring.Size()
+         << " masters on the ring" << endl;
+  }
+  *out << "Elected Master is " << m_elected_master << endl;
+  *out << "Reported Master is " << m_reported_master << ", term " << m_term
+       << endl;
+  *out << "--------------" << endl;
+}
+
+void MasterClient::MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                                 const MasterEntry &entry) {
+  m_ss->Execute(NewSingleCallback(this, &MasterClient::MasterEvent,
+                                  event, entry));
+}
+
+void MasterClient::MasterEvent(DiscoveryAgentInterface::MasterEvent event,
+                               MasterEntry entry) {
+  if (m_shutting_down) {
+    return;
+  }
+
+  if (event == DiscoveryAgentInterface::MASTER_ADDED) {
+    UpdateTerm(entry.term);
+  } else {
+    // The entry in a remove event may not have the address.
+    MasterMap::const_iterator iter = m_masters.find(entry.service_name);
+    if (iter != m_masters.end()) {
+      LeaderLost(iter->second.address);
+    }
+  }
+  UpdateMasterList(event, entry);
+
+  // A master we've declared failed only rejoins the election once it talks
+  // to us again.
+  MasterMap::const_iterator iter = m_masters.find(entry.service_name);
+  if (event != DiscoveryAgentInterface::MASTER_ADDED ||
+      iter == m_masters.end() || !iter->second.suspect) {
+    m_election.HandleEvent(event, entry);
+  }
+  UpdateConnections();
+}
+
+void MasterClient::LeaderChanged(const MasterEntry *leader) {
+  if (m_options.sharded) {
+    // UpdateShard() picks the elected master.
+    return;
+  }
+
+  IPV4SocketAddress elected_master;
+  if (leader) {
+    elected_master = leader->address;
+    if (leader->address != m_reported_master) {
+      LOG_INFO << "MASTER MISMATCH, picked " << leader->address
+               << ", but reported was " << m_reported_master;
+    }
+  } else {
+    if (m_reported_master != IPV4SocketAddress()) {
+      LOG_INFO << "MASTER MISMATCH, failed to find master but reported was "
+               << m_reported_master;
+    }
+  }
+
+  SetElectedMaster(elected_master);
+}
+
+void MasterClient::SetElectedMaster(const IPV4SocketAddress &master) {
+  if (master != m_elected_master) {
+    m_elected_master = master;
+    UpdateMismatch();
+    RunStateChangeCallback();
+  }
+}
+
+/*
+ * Bring the ring in line with the eligible masters, then find the master
+ * that owns our shard. The ring is keyed by service name, so a master that
+ * changes address keeps its clients.
+ */
+void MasterClient::UpdateShard() {
+  std::set<std::string> eligible;
+  MasterElection::const_iterator rank_iter = m_election.begin();
+  for (; rank_iter != m_election.end(); ++rank_iter) {
+    eligible.insert((*rank_iter)->service_name);
+  }
+
+  std::vector<std::string> removed;
+  std::set<std::string>::const_iterator iter = m_ring.Nodes().begin();
+  for (; iter != m_ring.Nodes().end(); ++iter) {
+    if (eligible.find(*iter) == eligible.end()) {
+      removed.push_back(*iter);
+    }
+  }
+  std::vector<std::string>::const_iterator removed_iter = removed.begin();
+  for (; removed_iter != removed.end(); ++removed_iter) {
+    m_ring.Remove(*removed_iter);
+  }
+  for (iter = eligible.begin(); iter != eligible.end(); ++iter) {
+    m_ring.Add(*iter);
+  }
+
+  IPV4SocketAddress owner_address;
+  std::string owner;
+  if (m_ring.Owner(m_shard_key, &owner)) {
+    MasterMap::const_iterator master_iter = m_masters.find(owner);
+    if (master_iter != m_masters.end()) {
+      owner_address = master_iter->second.address;
+    }
+  }
+  if (owner_address == m_elected_master) {
+    return;
+  }
+
+  LOG_INFO << "Shard " << m_shard_key << " moved from " << m_elected_master
+           << " to " << owner << " @ " << owner_address;
+  SetElectedMaster(owner_address);
+
+  // If we're already talking to the new owner, it's serving us now.
+  Master *master = FindMaster(owner_address);
+  if (master && master->socket && !master->suspect) {
+    FailoverComplete(owner_address);
+    SetReportedMaster(owner_address);
+  } else {
+    SetReportedMaster(IPV4SocketAddress());
+  }
+}
+
+void MasterClient::UpdateMasterList(DiscoveryAgentInterface::MasterEvent event,
+                                    const MasterEntry &entry) {
+  MasterMap::iterator iter = m_masters.find(entry.service_name);
+  if (iter != m_masters.end()) {
+    Master *master = &iter->second;
+    if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
+      CloseConnectionToMaster(master);
+      RemoveMasterAddress(*master);
+      delete master->backoff;
+      m_masters.erase(iter);
+    } else {
+      // Update
+      master->priority = entry.priority;
+      master->term = entry.term;
+      if (master->address != entry.address) {
+        bool active = master->active;
+        CloseConnectionToMaster(master);
+        RemoveMasterAddress(*master);
+        master->address = entry.address;
+        m_master_addresses[master->address] = master->name;
+        if (active) {
+          OpenConnectionToMaster(master);
+        }
+      }
+    }
+    return;
+  }
+
+  if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
+    return;
+  }
+
+  // not in the list.
+  Master master = {
+    entry.service_name,
+    entry.address,
+    entry.priority,
+    entry.term,
+    false,
+    NewBackoffPolicy(entry.service_name),
+    NULL,
+    NULL,
+    PhiAccrualDetector(m_options.detector_options),
+    false,
+    false,
+    0,
+    0,
+    0,
+  };
+  m_masters.insert(MasterMap::value_type(entry.service_name, master));
+  m_master_addresses[entry.address] = entry.service_name;
+}
+
+MasterClient::Master *MasterClient::FindMaster(
+    const IPV4SocketAddress &address) {
+  AddressMap::const_iterator addr_iter = m_master_addresses.find(address);
+  if (addr_iter == m_master_addresses.end()) {
+    return NULL;
+  }
+  MasterMap::iterator iter = m_masters.find(addr_iter->second);
+  return iter == m_masters.end() ? NULL : &iter->second;
+}
+
+/*
+ * Only drop the entry if it's ours, another master may have taken the address
+ * over.
+ */
+void MasterClient::RemoveMasterAddress(const Master &master) {
+  AddressMap::iterator iter = m_master_addresses.find(master.address);
+  if (iter != m_master_addresses.end() && iter->second == master.name) {
+    m_master_addresses.erase(iter);
+  }
+}
+
+void MasterClient::OpenConnectionToMaster(Master *master) {
+  if (master->address.Host() == IPV4Address::WildCard()) {
+    return;
+  }
+  OLA_INFO << "Opening connection to " << master->name << " "
+           << master->address;
+
+  master->active = true;
+  m_connector.AddEndpoint(master->address, master->backoff);
+}
+
+void MasterClient::CloseConnectionToMaster(Master *master) {
+  if (master->address.Host() == IPV4Address::WildCard()) {
+    return;
+  }
+  OLA_INFO << "Close connection to " << master->name << " "
+           << master->address;
+  master->active = false;
+  DeleteSocket(master);
+
+  if (master->address == m_reported_master) {
+    SetReportedMaster(IPV4SocketAddress());
+  }
+
+  if (master->address != IPV4SocketAddress()) {
+    m_connector.Disconnect(master->address, true);
+    m_connector.RemoveEndpoint(master->address);
+  }
+}
+
+/*
+ * Connect to the elected master and the standby_masters masters ranked below
+ * it. Masters we've declared failed aren't in the election, but we stay
+ * connected to those that would rank among them so we notice when they come
+ * back. The reported master is always kept so a mismatch can be resolved.
+ *
+ * In sharded mode the standbys are the masters that follow ours on the ring,
+ * and we stay connected to every failed master, since we can't tell where it
+ * would land on the ring.
+ */
+void MasterClient::UpdateConnections() {
+  if (m_shutting_down) {
+    return;
+  }
+
+  std::set<std::string> wanted;
+  const MasterEntry *lowest = NULL;
+  bool have_all = true;
+  if (m_options.sharded) {
+    UpdateShard();
+    std::vector<std::string> successors;
+    m_ring.Successors(m_shard_key, m_options.standby_masters + 1,
+                      &successors);
+    wanted.insert(successors.begin(), successors.end());
+  } else {
+    MasterElection::const_iterator rank_iter = m_election.begin();
+    for (; rank_iter != m_election.end() &&
+           wanted.size() <= m_options.standby_masters;
+         ++rank_iter) {
+      wanted.insert((*rank_iter)->service_name);
+      lowest = *rank_iter;
+    }
+    have_all = rank_iter == m_election.end();
+  }
+
+  MasterMap::iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    Master *master = &iter->second;
+    bool want = wanted.find(master->name) != wanted.end() ||
+        (m_reported_master != IPV4SocketAddress() &&
+         master->address == m_reported_master);
+    if (!want && master->suspect) {
+      MasterEntry entry = EntryFor(*master);
+      want = MasterElection::IsEligible(entry) &&
+          (have_all || MasterElection::Precedes(entry, *lowest));
+    }
+
+    if (want && !master->active) {
+      OpenConnectionToMaster(master);
+    } else if (!want && master->active) {
+      CloseConnectionToMaster(master);
+    }
+  }
+}
+
+/*
+ * Used while handling a frame. UpdateConnections() may close the connection
+ * the frame arrived on, deleting the socket and FrameReader that are still on
+ * the stack.
+ */
+void MasterClient::ScheduleUpdateConnections() {
+  if (m_update_pending || m_shutting_down) {
+    return;
+  }
+  m_update_pending = true;
+  m_ss->Execute(NewSingleCallback(this,
+                                  &MasterClient::RunUpdateConnections));
+}
+
+void MasterClient::RunUpdateConnections() {
+  m_update_pending = false;
+  UpdateConnections();
+}
+
+JitteredBackoffPolicy *MasterClient::NewBackoffPolicy(
+    const std::string &name) const {
+  std::map<std::string, JitteredBackoffPolicy::Options>::const_iterator iter =
+      m_options.endpoint_backoff_options.find(name);
+  return new JitteredBackoffPolicy(
+      iter == m_options.endpoint_backoff_options.end() ?
+      m_options.backoff_options : iter->second);
+}
+
+void MasterClient::OnTCPConnect(TCPSocket *socket) {
+  GenericSocketAddress peer_address = socket->GetPeerAddress();
+  OLA_INFO << "Opened new TCP connection to " << peer_address;
+  if (peer_address.Family() != AF_INET) {
+    OLA_WARN << "Invalid socket family";
+    socket->Close();
+    delete socket;
+    return;
+  }
+  IPV4SocketAddress peer_v4 = peer_address.V4Addr();
+
+  Master *master = FindMaster(peer_v4);
+  if (!master) {
+    OLA_WARN << "Can't find master for " << peer_v4;
+    socket->Close();
+    delete socket;
+    return;
+  }
+
+  if (master->socket) {
+    OLA_WARN << "Sockets collision for " << peer_v4;
+    DeleteSocket(master);
+  }
+  master->socket = socket;
+  master->reader = new FrameReader(
+      NewCallback(this, &MasterClient::HandleFrame, peer_v4));
+
+  ola::io::ConnectedDescriptor::SetNonBlocking(socket->ReadDescriptor());
+  socket->SetOnData(
+      NewCallback(this, &MasterClient::ReceiveTCPData, peer_v4));
+  socket->SetOnClose(
+      NewSingleCallback(this, &MasterClient::SocketClosed, peer_v4));
+  m_ss->AddReadDescriptor(socket);
+}
+
+void MasterClient::DeleteSocket(Master *master) {
+  if (master->socket) {
+    master->backoff->ConnectionLost();
+    m_ss->RemoveReadDescriptor(master->socket);
+    master->socket->Close();
+    delete master->socket;
+    master->socket = NULL;
+  }
+  delete master->reader;
+  master->reader = NULL;
+  master->detector.Reset();
+}
+
+MasterEntry MasterClient::EntryFor(const Master &master) const {
+  MasterEntry entry;
+  entry.service_name = master.name;
+  entry.address = master.address;
+  entry.priority = master.priority;
+  entry.term = master.term;
+  entry.scope = m_options.scope;
+  return entry;
+}
+
+bool MasterClient::CheckForFailures() {
+  const ola::TimeStamp *now = m_ss->WakeUpTime();
+  MasterMap::iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    Master *master = &iter->second;
+    if (!master->suspect && master->detector.IsSuspect(*now)) {
+      DeclareFailed(master);
+    }
+  }
+  return true;
+}
+
+/*
+ * This has the same effect on the election as a MASTER_REMOVED event. The
+ * connection is dropped and retried, and the master is reinstated as soon as
+ * it sends us a frame.
+ */
+void MasterClient::DeclareFailed(Master *master) {
+  LOG_INFO << master->name << " @ " << master->address
+           << " missed heartbeats, phi is "
+           << master->detector.Phi(*m_ss->WakeUpTime());
+  master->suspect = true;
+  LeaderLost(master->address);
+  DeleteSocket(master);
+  m_connector.Disconnect(master->address);
+  if (master->address == m_reported_master) {
+    SetReportedMaster(IPV4SocketAddress());
+  }
+  m_election.HandleEvent(DiscoveryAgentInterface::MASTER_REMOVED,
+                         EntryFor(*master));
+  UpdateConnections();
+}
+
+void MasterClient::ReceiveTCPData(IPV4SocketAddress peer) {
+  Master *master = FindMaster(peer);
+  if (!master || !master->socket) {
+    return;
+  }
+
+  if (!master->reader->ReadFrom(master->socket)) {
+    OLA_WARN << "Bad data from " << peer << ", closing connection";
+    DeleteSocket(master);
+    m_connector.Disconnect(peer);
+    if (peer == m_reported_master) {
+      SetReportedMaster(IPV4SocketAddress());
+    }
+  }
+}
+
+void MasterClient::RecordHeartbeat(Master *master) {
+  master->detector.Heartbeat(*m_ss->WakeUpTime());
+  if (master->suspect) {
+    LOG_INFO << master->name << " @ " << master->address << " is back";
+    master->suspect = false;
+    m_election.HandleEvent(DiscoveryAgentInterface::MASTER_ADDED,
+                           EntryFor(*master));
+    // This runs from HandleFrame, see ScheduleUpdateConnections().
+    ScheduleUpdateConnections();
+  }
+}
+
+void MasterClient::HandleFrame(IPV4SocketAddress peer, uint8_t type,
+                               const uint8_t *payload, unsigned int length) {
+  m_messages_received++;
+  Master *master = FindMaster(peer);
+  if (master) {
+    RecordHeartbeat(master);
+  }
+
+  switch (type) {
+    case MasterProtocol::STATUS_MESSAGE:
+      {
+        StatusMessage status;
+        if (status.Unpack(payload, length)) {
+          HandleStatus(peer, status);
+        } else {
+          OLA_WARN << "Invalid status message from " << peer;
+        }
+      }
+      break;
+    case MasterProtocol::HEARTBEAT_MESSAGE:
+      break;
+    case MasterProtocol::REDIRECT_MESSAGE:
+      {
+        RedirectMessage redirect;
+        if (redirect.Unpack(payload, length)) {
+          HandleRedirect(peer, redirect);
+        } else {
+          OLA_WARN << "Invalid redirect message from " << peer;
+        }
+      }
+      break;
+    default:
+      OLA_WARN << "Unknown message " << ToHex(type) << " from " << peer;
+  }
+}
+
+void MasterClient::HandleStatus(const IPV4SocketAddress &peer,
+                                const StatusMessage &status) {
+  const IPV4SocketAddress old_master = m_reported_master;
+  if (m_options.sharded) {
+    HandleShardedStatus(peer, status);
+  } else {
+    HandleElectedStatus(peer, status);
+  }
+  if (m_reported_master != old_master) {
+    // UpdateConnections() keeps a connection to the reported master open, and
+    // may now close the one to the old master.
+    ScheduleUpdateConnections();
+  }
+}
+
+void MasterClient::HandleElectedStatus(const IPV4SocketAddress &peer,
+                                       const StatusMessage &status) {
+
+  if (status.is_master) {
+    if (status.term < m_term) {
+      OLA_INFO << "Ignoring stale claim from " << peer << ", term "
+               << status.term << " < " << m_term;
+      if (m_reported_master == peer) {
+        SetReportedMaster(IPV4SocketAddress());
+      }
+      return;
+    }
+
+    if (status.term == m_term && m_reported_master != peer &&
+        m_reported_master != IPV4SocketAddress() &&
+        m_reported_master < peer) {
+      // Two masters claimed the same term, the lower address wins so that
+      // every client makes the same choice.
+      OLA_INFO << "Ignoring claim from " << peer << ", " << m_reported_master
+               << " already holds term " << m_term;
+      return;
+    }
+
+    UpdateTerm(status.term);
+    FailoverComplete(peer);
+    if (m_reported_master != peer) {
+      LOG_INFO << peer << " took mastership from " << m_reported_master
+               << ", term " << status.term;
+      SetReportedMaster(peer);
+    }
+  } else if (m_reported_master == peer) {
+    OLA_INFO << peer << " is no longer reporting as master";
+    SetReportedMaster(IPV4SocketAddress());
+  }
+}
+
+/*
+ * In sharded mode the claims don't matter, every master serves the clients
+ * whose shard it owns. Our master is serving us once it talks to us.
+ */
+void MasterClient::HandleShardedStatus(const IPV4SocketAddress &peer,
+                                       const StatusMessage &status) {
+  UpdateTerm(status.term);
+  if (peer == m_elected_master && m_reported_master != peer) {
+    FailoverComplete(peer);
+    SetReportedMaster(peer);
+  }
+}
+
+void MasterClient::HandleRedirect(const IPV4SocketAddress &peer,
+                                  const RedirectMessage &redirect) {
+  LOG_INFO << peer << " is shutting down, redirected to " << redirect.address
+           << ", term " << redirect.term;
+  if (m_options.sharded) {
+    // The master dropped its priority to 0 before sending this, so it's
+    // leaving the ring. Our shard moves once DNS-SD catches up.
+    if (m_reported_master == peer) {
+      SetReportedMaster(IPV4SocketAddress());
+    }
+    return;
+  }
+  Master *successor = FindMaster(redirect.address);
+  if (!successor || successor->suspect) {
+    // We'll find the new master through DNS-SD.
+    if (m_reported_master == peer) {
+      SetReportedMaster(IPV4SocketAddress());
+    }
+    return;
+  }
+
+  if (!successor->active) {
+    OpenConnectionToMaster(successor);
+  }
+
+  if (redirect.term == 0 || redirect.term < m_term) {
+    // The successor hasn't claimed mastership yet, wait for its status.
+    if (m_reported_master == peer) {
+      SetReportedMaster(IPV4SocketAddress());
+    }
+    return;
+  }
+
+  // This is the same as the successor's own claim.
+  StatusMessage status;
+  status.is_master = true;
+  status.term = redirect.term;
+  HandleStatus(redirect.address, status);
+  ScheduleUpdateConnections();
+}
+
+bool MasterClient::StartMulticast() {
+  auto_ptr<ola::network::UDPSocket> socket(new ola::network::UDPSocket());
+  if (!socket->Init() ||
+      !socket->Bind(IPV4SocketAddress(IPV4Address::WildCard(),
+                                      m_options.multicast_port)) ||
+      !socket->JoinMulticast(m_options.multicast_interface,
+                             m_options.multicast_group, true)) {
+    OLA_WARN << "Failed to join " << m_options.multicast_group;
+    return false;
+  }
+  socket->SetOnData(NewCallback(this, &MasterClient::ReceiveAnnouncement));
+  m_ss->AddReadDescriptor(socket.get());
+  m_multicast_socket.reset(socket.release());
+  return true;
+}
+
+void MasterClient::ReceiveAnnouncement() {
+  uint8_t data[MasterProtocol::MAX_FRAME_SIZE + MasterProtocol::LENGTH_SIZE];
+  ssize_t size = sizeof(data);
+  IPV4Address source;
+  if (!m_multicast_socket->RecvFrom(data, &size, source)) {
+    return;
+  }
+
+  uint8_t type;
+  const uint8_t *payload;
+  unsigned int payload_length;
+  AnnouncementMessage announcement;
+  if (!MasterProtocol::ParseDatagram(data, size, &type, &payload,
+                                     &payload_length) ||
+      type != MasterProtocol::ANNOUNCEMENT_MESSAGE ||
+      !announcement.Unpack(payload, payload_length)) {
+    OLA_WARN << "Invalid announcement from " << source;
+    return;
+  }
+  HandleAnnouncement(source, announcement);
+}
+
+void MasterClient::HandleAnnouncement(const IPV4Address &source,
+                                      const AnnouncementMessage &announcement) {
+  IPV4SocketAddress address = announcement.address;
+  if (address.Host().IsWildcard()) {
+    address.Host(source);
+  }
+
+  Master *master = FindMaster(address);
+  if (!master) {
+    // Not a master in our scope, or we haven't found it yet.
+    return;
+  }
+
+  if (master->has_announcement && master->session == announcement.session) {
+    // Serial number arithmetic, so the sequence can wrap.
+    int32_t delta = static_cast<int32_t>(
+        announcement.sequence - master->sequence);
+    if (delta <= 0) {
+      return;
+    }
+    master->lost_announcements += delta - 1;
+  }
+  master->has_announcement = true;
+  master->session = announcement.session;
+  master->sequence = announcement.sequence;
+  m_messages_received++;
+
+  RecordHeartbeat(master);
+  HandleStatus(address, announcement.status);
+}
+
+void MasterClient::SocketClosed(IPV4SocketAddress peer) {
+  OLA_INFO << "Socket to " << peer << " was closed";
+  Master *master = FindMaster(peer);
+  if (master && master->socket) {
+    DeleteSocket(master);
+    m_connector.Disconnect(peer);
+  }
+  if (peer == m_reported_master) {
+    SetReportedMaster(IPV4SocketAddress());
+  }
+}
+
+void MasterClient::SetReportedMaster(const IPV4SocketAddress &master) {
+  if (master == m_reported_master) {
+    return;
+  }
+  m_reported_master = master;
+  if (master != IPV4SocketAddress()) {
+    if (m_last_leader != IPV4SocketAddress() && m_last_leader != master) {
+      m_stats.leadership_flips++;
+    }
+    m_last_leader = master;
+  }
+  UpdateMismatch();
+  RunStateChangeCallback();
+}
+
+void MasterClient::UpdateTerm(uint32_t term) {
+  if (term > m_term) {
+    m_term = term;
+  }
+}
+
+void MasterClient::UpdateMismatch() {
+  const bool mismatched = m_elected_master != m_reported_master;
+  if (mismatched == m_mismatched) {
+    return;
+  }
+  const ola::TimeStamp *now = m_ss->WakeUpTime();
+  if (mismatched) {
+    m_mismatch_start = *now;
+  } else {
+    m_stats.mismatch_duration.Add((*now - m_mismatch_start).AsInt());
+    m_stats.mismatches++;
+  }
+  m_mismatched = mismatched;
+}
+
+/*
+ * Start the failover timer if the elected master was removed or declared
+ * failed. It stops when a different master claims mastership.
+ */
+void MasterClient::LeaderLost(const IPV4SocketAddress &address) {
+  if (m_failover_pending || m_elected_master == IPV4SocketAddress() ||
+      address != m_elected_master) {
+    return;
+  }
+  m_failover_pending = true;
+  m_failed_leader = address;
+  m_failover_start = *m_ss->WakeUpTime();
+}
+
+/*
+ * Stop the failover timer, once a master other than the failed one is
+ * serving us.
+ */
+void MasterClient::FailoverComplete(const IPV4SocketAddress &master) {
+  if (m_failover_pending && master != m_failed_leader) {
+    m_stats.failover_time.Add(
+        (*m_ss->WakeUpTime() - m_failover_start).AsInt());
+    m_stats.failovers++;
+    m_failover_pending = false;
+  }
+}
+
+void MasterClient::RunStateChangeCallback() {
+  if (m_state_change_callback.get() && !m_shutting_down) {
+    m_state_change_callback->Run();
+  }
+}
+
+// MasterClient::Stats
+// ----------------------------------------------------------------------------
+void MasterClient::Stats::Merge(const Stats &other) {
+  mismatch_duration.Merge(other.mismatch_duration);
+  mismatches += other.mismatches;
+  failover_time.Merge(other.failover_time);
+  failovers += other.failovers;
+  leadership_flips += other.leadership_flips;
+}
+
+void MasterClient::Stats::Print(std::ostream *out) const {
+  *out << "--------------" << endl;
+  *out << "Mismatches: " << mismatches << ", durations in us: ";
+  mismatch_duration.Print(out);
+  *out << "Failovers: " << failovers << ", times in us: ";
+  failover_time.Print(out);
+  *out << "Leadership flips: " << leadership_flips << endl;
+  *out << "--------------" << endl;
+}
+
+void MasterClient::Stats::ToJson(std::ostream *out) const {
+  *out << "{\"mismatches\": " << mismatches << ", \"mismatch_us\": ";
+  mismatch_duration.ToJson(out);
+  *out << ", \"failovers\": " << failovers << ", \"failover_us\": ";
+  failover_time.ToJson(out);
+  *out << ", \"leadership_flips\": " << leadership_flips << "}";
+}
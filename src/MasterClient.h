@@ -0,0 +1,330 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterClient.h
+ * A client that tracks the elected master.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERCLIENT_H_
+#define SRC_MASTERCLIENT_H_
+
+#include <stdint.h>
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/AdvancedTCPConnector.h>
+#include <ola/network/Socket.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/network/TCPSocket.h>
+#include <ola/network/TCPSocketFactory.h>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "src/Backoff.h"
+#include "src/ConsistentHashRing.h"
+#include "src/DiscoveryAgent.h"
+#include "src/FailureDetector.h"
+#include "src/Histogram.h"
+#include "src/MasterElection.h"
+#include "src/MasterEntry.h"
+#include "src/MasterProtocol.h"
+
+/**
+ * @brief A client which connects to the masters.
+ *
+ * The MasterClient picks a master from the DNS-SD results (the elected
+ * master) and compares it with the master that reports itself as the master
+ * over TCP (the reported master).
+ *
+ * Claims to be the master carry a term, see StatusMessage. A claim is only
+ * accepted if its term is at least as high as any term we've seen, either
+ * from an earlier claim or in the DNS-SD data.
+ *
+ * Every frame from a master counts as a heartbeat. If a master stops sending
+ * them it's treated as if it had been removed from DNS-SD, until it sends
+ * data again. This catches masters which vanish without a goodbye, long
+ * before the TCP connection or the DNS-SD records time out.
+ *
+ * Only the elected master and the next standby_masters masters in the
+ * ranking are connected to, so that a failover doesn't have to wait for a
+ * new connection. The connections follow the ranking as it changes.
+ *
+ * If a multicast group is set, the client also listens for the masters'
+ * AnnouncementMessages, which carry both the status and the heartbeats.
+ *
+ * A master that's shutting down sends a RedirectMessage. If the new master
+ * has already claimed mastership we switch to it straight away.
+ *
+ * In sharded mode every eligible master serves clients. The masters are
+ * placed on a ConsistentHashRing and the elected master is the one that owns
+ * the client's shard_key, so a master joining or leaving only moves about
+ * 1/N of the clients. Claims of mastership are ignored; the elected master
+ * becomes the reported master once it's talking to us. The standby
+ * connections go to the masters that would take the shard over.
+ *
+ * All methods must be called on the thread running the SelectServer.
+ */
+class MasterClient {
+ public:
+  /**
+   * @brief How quickly the client settles on a master. Times are in
+   * microseconds.
+   */
+  struct Stats {
+    Stats() : mismatches(0), failovers(0), leadership_flips(0) {}
+
+    // How long the elected and reported masters disagreed for.
+    Histogram mismatch_duration;
+    uint64_t mismatches;
+    // The time from the elected master being removed to another master
+    // claiming mastership.
+    Histogram failover_time;
+    uint64_t failovers;
+    // The number of times the reported master moved to a different master.
+    uint64_t leadership_flips;
+
+    void Merge(const Stats &other);
+    void Print(std::ostream *out) const;
+    void ToJson(std::ostream *out) const;
+  };
+
+  struct Options {
+    Options()
+        : scope(DiscoveryAgentInterface::DEFAULT_SCOPE),
+          tcp_connect_timeout(5, 0),
+          failure_check_interval(0, 50000),
+          standby_masters(2),
+          multicast_port(0),
+          sharded(false),
+          ring_points(ConsistentHashRing::DEFAULT_POINTS),
+          agent_factory(NULL),
+          state_change_callback(NULL) {
+    }
+
+    std::string scope;
+    /**
+     * @brief The DNS-SD domain to browse, empty uses the default.
+     */
+    std::string browse_domain;
+    ola::TimeInterval tcp_connect_timeout;
+    /**
+     * @brief The reconnect policy for the masters.
+     */
+    JitteredBackoffPolicy::Options backoff_options;
+    /**
+     * @brief Reconnect policies for particular masters, keyed by service
+     * name. These override backoff_options.
+     */
+    std::map<std::string, JitteredBackoffPolicy::Options>
+        endpoint_backoff_options;
+    /**
+     * @brief How often to check for failed masters. 0 disables failure
+     * detection.
+     */
+    ola::TimeInterval failure_check_interval;
+    PhiAccrualDetector::Options detector_options;
+    /**
+     * @brief The number of masters, other than the elected master, to keep
+     * connections to.
+     */
+    unsigned int standby_masters;
+    /**
+     * @brief The group the masters multicast their status to, the wildcard
+     * address disables multicast.
+     */
+    ola::network::IPV4Address multicast_group;
+    uint16_t multicast_port;
+    /**
+     * @brief The interface to join the group on, the wildcard address uses
+     * the system default.
+     */
+    ola::network::IPV4Address multicast_interface;
+    /**
+     * @brief Spread the clients over all the masters, rather than using the
+     * single elected master.
+     */
+    bool sharded;
+    /**
+     * @brief In sharded mode, the key that picks our master. If empty, one
+     * is made from the host name and pid.
+     */
+    std::string shard_key;
+    /**
+     * @brief The number of points for each master on the hash ring.
+     */
+    unsigned int ring_points;
+    /**
+     * @brief The factory to create the DiscoveryAgent with. If NULL the
+     * platform's DNS-SD implementation is used. Not owned.
+     */
+    DiscoveryAgentFactory *agent_factory;
+    /**
+     * @brief Called when either the elected or reported master changes.
+     * Ownership is transferred.
+     */
+    ola::Callback0<void> *state_change_callback;
+  };
+
+  MasterClient(ola::io::SelectServer *ss, const Options &options);
+  ~MasterClient();
+
+  bool Init();
+
+  /**
+   * @brief The master we picked from the DNS-SD results.
+   */
+  ola::network::IPV4SocketAddress ElectedMaster() const {
+    return m_elected_master;
+  }
+
+  /**
+   * @brief The master that last told us it was the master.
+   */
+  ola::network::IPV4SocketAddress ReportedMaster() const {
+    return m_reported_master;
+  }
+
+  /**
+   * @brief The highest mastership term we've seen.
+   */
+  uint32_t Term() const { return m_term; }
+
+  /**
+   * @brief The key that picks our master in sharded mode.
+   */
+  const std::string &ShardKey() const { return m_shard_key; }
+
+  /**
+   * @brief The number of frames and announcements received from masters.
+   */
+  uint64_t MessagesReceived() const { return m_messages_received; }
+
+  const Stats &GetStats() const { return m_stats; }
+
+  void DumpMasterState(std::ostream *out) const;
+
+ private:
+  struct Master {
+    std::string name;
+    ola::network::IPV4SocketAddress address;
+    uint8_t priority;
+    uint32_t term;
+    // True if the connector is trying to keep a connection open.
+    bool active;
+    JitteredBackoffPolicy *backoff;
+    ola::network::TCPSocket *socket;
+    FrameReader *reader;
+    PhiAccrualDetector detector;
+    // True if the failure detector has declared this master dead.
+    bool suspect;
+    // The last announcement we accepted.
+    bool has_announcement;
+    uint32_t session;
+    uint32_t sequence;
+    uint64_t lost_announcements;
+  };
+
+  typedef std::map<std::string, Master> MasterMap;
+  typedef std::map<ola::network::IPV4SocketAddress, std::string> AddressMap;
+
+  ola::io::SelectServer *m_ss;
+  const Options m_options;
+  std::auto_ptr<ola::Callback0<void> > m_state_change_callback;
+  MasterMap m_masters;
+  AddressMap m_master_addresses;  // address to service name, for FindMaster()
+  MasterElection m_election;
+  ConsistentHashRing m_ring;
+  const std::string m_shard_key;
+  bool m_shutting_down;
+  bool m_update_pending;
+  ola::thread::timeout_id m_failure_check_timeout;
+
+  std::auto_ptr<DiscoveryAgentInterface> m_discovery_agent;
+  ola::network::TCPSocketFactory m_tcp_socket_factory;
+  ola::network::AdvancedTCPConnector m_connector;
+  std::auto_ptr<ola::network::UDPSocket> m_multicast_socket;
+
+  ola::network::IPV4SocketAddress m_elected_master;
+  ola::network::IPV4SocketAddress m_reported_master;
+  uint32_t m_term;
+  uint64_t m_messages_received;
+
+  Stats m_stats;
+  bool m_mismatched;
+  ola::TimeStamp m_mismatch_start;
+  // Set when the elected master goes away, until another master claims
+  // mastership.
+  bool m_failover_pending;
+  ola::network::IPV4SocketAddress m_failed_leader;
+  ola::TimeStamp m_failover_start;
+  ola::network::IPV4SocketAddress m_last_leader;
+
+  // This is called within the Discovery thread.
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry);
+
+  void MasterEvent(DiscoveryAgentInterface::MasterEvent event,
+                   MasterEntry entry);
+  void UpdateMasterList(DiscoveryAgentInterface::MasterEvent event,
+                        const MasterEntry &entry);
+  void LeaderChanged(const MasterEntry *leader);
+  void SetElectedMaster(const ola::network::IPV4SocketAddress &master);
+  void UpdateShard();
+  void HandleElectedStatus(const ola::network::IPV4SocketAddress &peer,
+                           const StatusMessage &status);
+  void HandleShardedStatus(const ola::network::IPV4SocketAddress &peer,
+                           const StatusMessage &status);
+  Master *FindMaster(const ola::network::IPV4SocketAddress &address);
+  void RemoveMasterAddress(const Master &master);
+  void OpenConnectionToMaster(Master *master);
+  void CloseConnectionToMaster(Master *master);
+  void UpdateConnections();
+  void ScheduleUpdateConnections();
+  void RunUpdateConnections();
+  JitteredBackoffPolicy *NewBackoffPolicy(const std::string &name) const;
+  void DeleteSocket(Master *master);
+  MasterEntry EntryFor(const Master &master) const;
+  bool CheckForFailures();
+  void DeclareFailed(Master *master);
+  void RecordHeartbeat(Master *master);
+  bool StartMulticast();
+  void ReceiveAnnouncement();
+  void HandleAnnouncement(const ola::network::IPV4Address &source,
+                          const AnnouncementMessage &announcement);
+
+  void OnTCPConnect(ola::network::TCPSocket *socket);
+  void ReceiveTCPData(ola::network::IPV4SocketAddress peer);
+  void HandleFrame(ola::network::IPV4SocketAddress peer, uint8_t type,
+                   const uint8_t *payload, unsigned int length);
+  void HandleStatus(const ola::network::IPV4SocketAddress &peer,
+                    const StatusMessage &status);
+  void HandleRedirect(const ola::network::IPV4SocketAddress &peer,
+                      const RedirectMessage &redirect);
+  void SocketClosed(ola::network::IPV4SocketAddress peer);
+
+  void SetReportedMaster(const ola::network::IPV4SocketAddress &master);
+  void UpdateTerm(uint32_t term);
+  void UpdateMismatch();
+  void LeaderLost(const ola::network::IPV4SocketAddress &address);
+  void FailoverComplete(const ola::network::IPV4SocketAddress &master);
+  void RunStateChangeCallback();
+
+  DISALLOW_COPY_AND_ASSIGN(MasterClient);
+};
+#endif  // SRC_MASTERCLIENT_H_
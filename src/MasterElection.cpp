@@ -0,0 +1,130 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterElection.cpp
+ * Picks the preferred master from the set of known masters.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterElection.h"
+
+#include <ola/network/IPV4Address.h>
+
+#include <string>
+#include <utility>
+
+using ola::network::IPV4Address;
+using std::string;
+
+MasterElection::MasterElection(LeaderChangeCallback *callback)
+    : m_callback(callback),
+      m_has_leader(false) {
+}
+
+void MasterElection::HandleEvent(DiscoveryAgentInterface::MasterEvent event,
+                                 const MasterEntry &entry) {
+  if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
+    Remove(entry.service_name);
+  } else {
+    Update(entry);
+  }
+}
+
+void MasterElection::Update(const MasterEntry &entry) {
+  std::pair<EntryMap::iterator, bool> p = m_entries.insert(
+      EntryMap::value_type(entry.service_name, entry));
+  MasterEntry *stored = &p.first->second;
+
+  if (!p.second) {
+    if (*stored == entry) {
+      return;
+    }
+    // The key must be removed from the index before it's modified.
+    if (IsEligible(*stored)) {
+      m_ranking.erase(stored);
+    }
+    stored->UpdateFrom(entry);
+  }
+
+  if (IsEligible(*stored)) {
+    m_ranking.insert(stored);
+  }
+  CheckForLeaderChange();
+}
+
+void MasterElection::Remove(const string &service_name) {
+  EntryMap::iterator iter = m_entries.find(service_name);
+  if (iter == m_entries.end()) {
+    return;
+  }
+  if (IsEligible(iter->second)) {
+    m_ranking.erase(&iter->second);
+  }
+  m_entries.erase(iter);
+  CheckForLeaderChange();
+}
+
+void MasterElection::Clear() {
+  m_ranking.clear();
+  m_entries.clear();
+  CheckForLeaderChange();
+}
+
+bool MasterElection::Precedes(const MasterEntry &first,
+                              const MasterEntry &second) {
+  if (first.priority != second.priority) {
+    return first.priority > second.priority;
+  }
+  if (first.address != second.address) {
+    return first.address < second.address;
+  }
+  return first.service_name < second.service_name;
+}
+
+/*
+ * Masters that haven't been resolved yet, or have a priority of 0, can't be
+ * elected.
+ */
+bool MasterElection::IsEligible(const MasterEntry &entry) {
+  return (entry.priority != 0 &&
+          entry.address.Host() != IPV4Address::WildCard());
+}
+
+void MasterElection::CheckForLeaderChange() {
+  const MasterEntry *leader = Leader();
+  if (!leader) {
+    if (m_has_leader) {
+      m_has_leader = false;
+      m_leader = MasterEntry();
+      if (m_callback.get()) {
+        m_callback->Run(NULL);
+      }
+    }
+    return;
+  }
+
+  if (m_has_leader && leader->service_name == m_leader.service_name &&
+      leader->address == m_leader.address) {
+    // Same leader, but the other fields may have changed.
+    m_leader.UpdateFrom(*leader);
+    return;
+  }
+
+  m_has_leader = true;
+  m_leader.UpdateFrom(*leader);
+  if (m_callback.get()) {
+    m_callback->Run(leader);
+  }
+}
@@ -0,0 +1,144 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterElection.h
+ * Picks the preferred master from the set of known masters.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERELECTION_H_
+#define SRC_MASTERELECTION_H_
+
+#include <ola/Callback.h>
+#include <ola/base/Macro.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "src/DiscoveryAgent.h"
+#include "src/MasterEntry.h"
+
+/**
+ * @brief Tracks the known masters and elects a leader.
+ *
+ * Masters are keyed by service name. Those with a resolved address are kept
+ * in an index ordered by priority (highest first), then address, then
+ * service name, so every process that sees the same set of masters elects
+ * the same leader.
+ *
+ * Updates are O(log n) and Leader() is O(1). The callback only runs when the
+ * leader changes, i.e. a different master is elected or the elected master
+ * moves to a new address.
+ */
+class MasterElection {
+ public:
+  /**
+   * @brief Called with the new leader, or NULL if there is no leader.
+   */
+  typedef ola::Callback1<void, const MasterEntry*> LeaderChangeCallback;
+
+  /**
+   * @brief Create a new MasterElection.
+   * @param callback the callback to run when the leader changes, ownership is
+   *   transferred. May be NULL.
+   */
+  explicit MasterElection(LeaderChangeCallback *callback = NULL);
+  ~MasterElection() {}
+
+  /**
+   * @brief Apply an event from a DiscoveryAgent.
+   */
+  void HandleEvent(DiscoveryAgentInterface::MasterEvent event,
+                   const MasterEntry &entry);
+
+  /**
+   * @brief Add a master, or update an existing one.
+   */
+  void Update(const MasterEntry &entry);
+
+  /**
+   * @brief Remove a master.
+   */
+  void Remove(const std::string &service_name);
+
+  /**
+   * @brief Remove all masters.
+   */
+  void Clear();
+
+  /**
+   * @brief Return the elected master, or NULL if there isn't one.
+   */
+  const MasterEntry* Leader() const {
+    return m_ranking.empty() ? NULL : *m_ranking.begin();
+  }
+
+  /**
+   * @brief Return the number of masters, including unresolved ones.
+   */
+  unsigned int Size() const { return m_entries.size(); }
+
+  /**
+   * @brief Return the number of masters that are eligible for election.
+   */
+  unsigned int EligibleCount() const { return m_ranking.size(); }
+
+  /**
+   * @brief Return true if the first master would be preferred over the second.
+   */
+  static bool Precedes(const MasterEntry &first, const MasterEntry &second);
+
+  /**
+   * @brief Return true if the master can be elected.
+   */
+  static bool IsEligible(const MasterEntry &entry);
+
+ private:
+  struct RankOrder {
+    bool operator()(const MasterEntry *a, const MasterEntry *b) const {
+      return Precedes(*a, *b);
+    }
+  };
+
+  typedef std::set<const MasterEntry*, RankOrder> RankIndex;
+
+ public:
+  /**
+   * @brief Iterates over the eligible masters, the leader first.
+   *
+   * Iterators are invalidated by any change to the masters.
+   */
+  typedef RankIndex::const_iterator const_iterator;
+
+  const_iterator begin() const { return m_ranking.begin(); }
+  const_iterator end() const { return m_ranking.end(); }
+
+ private:
+  typedef std::map<std::string, MasterEntry> EntryMap;
+
+  std::auto_ptr<LeaderChangeCallback> m_callback;
+  EntryMap m_entries;
+  RankIndex m_ranking;
+
+  // The last leader we reported.
+  bool m_has_leader;
+  MasterEntry m_leader;
+
+  void CheckForLeaderChange();
+
+  DISALLOW_COPY_AND_ASSIGN(MasterElection);
+};
+#endif  // SRC_MASTERELECTION_H_
@@ -22,28 +22,26 @@
 
 #include <stdint.h>
 #include <ola/network/SocketAddress.h>
-#include <ola/strings/Format.h>
 #include <string>
 #include <iostream>
+#include <sstream>
 
 using std::string;
 
-MasterEntry::MasterEntry() {}
+MasterEntry::MasterEntry() : priority(0), term(0) {}
 
 void MasterEntry::UpdateFrom(const MasterEntry &other) {
   service_name = other.service_name;
   address = other.address;
   priority = other.priority;
   scope = other.scope;
+  term = other.term;
 }
 
 string MasterEntry::ToString() const {
   std::ostringstream out;
   out << "Controller: '" << service_name << "' @ " << address << ", priority "
-      << static_cast<int>(priority) << ", scope " << scope;
+      << static_cast<int>(priority) << ", scope " << scope << ", term "
+      << term;
   return out.str();
 }
-
-std::string MasterEntry::ServiceName() const {
-  return service_name + "-" + ola::strings::IntToString(priority);
-}
@@ -46,21 +46,26 @@ class MasterEntry {
   /** @brief The master's scope */
   std::string scope;
 
+  /**
+   * @brief The last mastership term this master claimed, 0 if it has never
+   * been the master.
+   */
+  uint32_t term;
+
   MasterEntry();
 
   bool operator==(const MasterEntry &other) const {
     return (service_name == other.service_name &&
             address == other.address &&
             priority == other.priority &&
-            scope == other.scope);
+            scope == other.scope &&
+            term == other.term);
   }
 
   void UpdateFrom(const MasterEntry &other);
 
   std::string ToString() const;
 
-  std::string ServiceName() const;
-
   friend std::ostream& operator<<(std::ostream &out,
                                   const MasterEntry &entry) {
     return out << entry.ToString();
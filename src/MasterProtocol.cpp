@@ -0,0 +1,232 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterProtocol.cpp
+ * The framed protocol spoken between masters and clients.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterProtocol.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <ola/Logging.h>
+#include <ola/network/IPV4Address.h>
+
+#include <string>
+
+const unsigned int MasterProtocol::LENGTH_SIZE;
+const unsigned int MasterProtocol::MAX_FRAME_SIZE;
+const unsigned int StatusMessage::PAYLOAD_SIZE;
+const unsigned int AnnouncementMessage::PAYLOAD_SIZE;
+const unsigned int RedirectMessage::PAYLOAD_SIZE;
+
+namespace {
+void PutUInt32(uint32_t value, uint8_t *data) {
+  data[0] = static_cast<uint8_t>(value >> 24);
+  data[1] = static_cast<uint8_t>(value >> 16);
+  data[2] = static_cast<uint8_t>(value >> 8);
+  data[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t GetUInt32(const uint8_t *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+         (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) |
+         static_cast<uint32_t>(data[3]);
+}
+
+void PutSocketAddress(const ola::network::IPV4SocketAddress &address,
+                      uint8_t *data) {
+  // AsInt() is already in network byte order.
+  const uint32_t host = address.Host().AsInt();
+  memcpy(data, &host, sizeof(host));
+  data[4] = static_cast<uint8_t>(address.Port() >> 8);
+  data[5] = static_cast<uint8_t>(address.Port() & 0xff);
+}
+
+ola::network::IPV4SocketAddress GetSocketAddress(const uint8_t *data) {
+  uint32_t host;
+  memcpy(&host, data, sizeof(host));
+  return ola::network::IPV4SocketAddress(
+      ola::network::IPV4Address(host), (data[4] << 8) + data[5]);
+}
+}  // namespace
+
+SharedBuffer *MasterProtocol::BuildFrame(uint8_t type, const uint8_t *payload,
+                                         unsigned int length) {
+  const unsigned int body_length = length + 1;
+  if (body_length > MAX_FRAME_SIZE) {
+    OLA_WARN << "Payload of " << length << " bytes is too large";
+    return NULL;
+  }
+
+  uint8_t frame[MAX_FRAME_SIZE + LENGTH_SIZE];
+  frame[0] = static_cast<uint8_t>(body_length >> 8);
+  frame[1] = static_cast<uint8_t>(body_length & 0xff);
+  frame[2] = type;
+  if (length) {
+    memcpy(frame + LENGTH_SIZE + 1, payload, length);
+  }
+  return SharedBuffer::New(frame, LENGTH_SIZE + body_length);
+}
+
+bool MasterProtocol::ParseDatagram(const uint8_t *data, unsigned int length,
+                                   uint8_t *type, const uint8_t **payload,
+                                   unsigned int *payload_length) {
+  if (length < LENGTH_SIZE + 1) {
+    return false;
+  }
+  unsigned int body_length = (data[0] << 8) + data[1];
+  if (body_length == 0 || body_length != length - LENGTH_SIZE) {
+    return false;
+  }
+  *type = data[LENGTH_SIZE];
+  *payload = data + LENGTH_SIZE + 1;
+  *payload_length = body_length - 1;
+  return true;
+}
+
+// StatusMessage
+// ----------------------------------------------------------------------------
+SharedBuffer *StatusMessage::Pack() const {
+  uint8_t payload[PAYLOAD_SIZE];
+  payload[0] = is_master ? 1 : 0;
+  PutUInt32(term, payload + 1);
+  return MasterProtocol::BuildFrame(MasterProtocol::STATUS_MESSAGE, payload,
+                                    sizeof(payload));
+}
+
+bool StatusMessage::Unpack(const uint8_t *payload, unsigned int length) {
+  if (length < PAYLOAD_SIZE) {
+    return false;
+  }
+  is_master = payload[0] != 0;
+  term = GetUInt32(payload + 1);
+  return true;
+}
+
+// AnnouncementMessage
+// ----------------------------------------------------------------------------
+SharedBuffer *AnnouncementMessage::Pack() const {
+  uint8_t payload[PAYLOAD_SIZE];
+  PutUInt32(session, payload);
+  PutUInt32(sequence, payload + 4);
+  PutSocketAddress(address, payload + 8);
+  payload[14] = status.is_master ? 1 : 0;
+  PutUInt32(status.term, payload + 15);
+  return MasterProtocol::BuildFrame(MasterProtocol::ANNOUNCEMENT_MESSAGE,
+                                    payload, sizeof(payload));
+}
+
+bool AnnouncementMessage::Unpack(const uint8_t *payload, unsigned int length) {
+  if (length < PAYLOAD_SIZE) {
+    return false;
+  }
+  session = GetUInt32(payload);
+  sequence = GetUInt32(payload + 4);
+  address = GetSocketAddress(payload + 8);
+  return status.Unpack(payload + 14, length - 14);
+}
+
+// RedirectMessage
+// ----------------------------------------------------------------------------
+SharedBuffer *RedirectMessage::Pack() const {
+  uint8_t payload[PAYLOAD_SIZE];
+  PutSocketAddress(address, payload);
+  PutUInt32(term, payload + 6);
+  return MasterProtocol::BuildFrame(MasterProtocol::REDIRECT_MESSAGE,
+                                    payload, sizeof(payload));
+}
+
+bool RedirectMessage::Unpack(const uint8_t *payload, unsigned int length) {
+  if (length < PAYLOAD_SIZE) {
+    return false;
+  }
+  address = GetSocketAddress(payload);
+  term = GetUInt32(payload + 6);
+  return true;
+}
+
+// FrameReader
+// ----------------------------------------------------------------------------
+FrameReader::FrameReader(FrameCallback *callback)
+    : m_callback(callback) {
+}
+
+bool FrameReader::ReadFrom(ola::io::ConnectedDescriptor *descriptor) {
+  uint8_t data[READ_SIZE];
+  while (true) {
+    ssize_t ret = read(descriptor->ReadDescriptor(), data, sizeof(data));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      OLA_WARN << "read failed: " << strerror(errno);
+      return false;
+    }
+
+    // A 0 byte read means the remote end closed, the SelectServer will run
+    // the on-close handler.
+    if (ret == 0) {
+      return true;
+    }
+
+    if (!Parse(data, ret)) {
+      return false;
+    }
+
+    if (static_cast<size_t>(ret) < sizeof(data)) {
+      // The socket is drained.
+      return true;
+    }
+  }
+}
+
+bool FrameReader::Parse(const uint8_t *data, unsigned int length) {
+  m_buffer.append(reinterpret_cast<const char*>(data), length);
+
+  const uint8_t *buffer = reinterpret_cast<const uint8_t*>(m_buffer.data());
+  unsigned int offset = 0;
+  bool ok = true;
+  while (m_buffer.size() - offset >= MasterProtocol::LENGTH_SIZE) {
+    const uint8_t *frame = buffer + offset;
+    unsigned int body_length = (frame[0] << 8) + frame[1];
+    if (body_length == 0 || body_length > MasterProtocol::MAX_FRAME_SIZE) {
+      OLA_WARN << "Invalid frame length " << body_length;
+      ok = false;
+      break;
+    }
+
+    if (m_buffer.size() - offset < MasterProtocol::LENGTH_SIZE + body_length) {
+      break;
+    }
+
+    const uint8_t *body = frame + MasterProtocol::LENGTH_SIZE;
+    m_callback->Run(body[0], body + 1, body_length - 1);
+    offset += MasterProtocol::LENGTH_SIZE + body_length;
+  }
+
+  if (!ok) {
+    m_buffer.clear();
+  } else {
+    m_buffer.erase(0, offset);
+  }
+  return ok;
+}
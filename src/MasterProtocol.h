@@ -0,0 +1,185 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterProtocol.h
+ * The framed protocol spoken between masters and clients.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERPROTOCOL_H_
+#define SRC_MASTERPROTOCOL_H_
+
+#include <stdint.h>
+#include <ola/Callback.h>
+#include <ola/base/Macro.h>
+#include <ola/io/Descriptor.h>
+#include <ola/network/SocketAddress.h>
+#include <memory>
+#include <string>
+
+#include "src/SharedBuffer.h"
+
+/**
+ * @brief The messages exchanged between masters and clients.
+ *
+ * Each frame is a 2 byte length, in network byte order, followed by that
+ * many bytes of body. The first byte of the body is the message type, the
+ * rest is the payload.
+ */
+class MasterProtocol {
+ public:
+  enum MessageType {
+    STATUS_MESSAGE = 1,
+    HEARTBEAT_MESSAGE = 2,
+    ANNOUNCEMENT_MESSAGE = 3,
+    REDIRECT_MESSAGE = 4,
+  };
+
+  static const unsigned int LENGTH_SIZE = 2;
+  static const unsigned int MAX_FRAME_SIZE = 4096;
+
+  /**
+   * @brief Build a frame.
+   * @returns A new SharedBuffer with a reference count of 1, or NULL if the
+   *   payload is larger than MAX_FRAME_SIZE allows.
+   */
+  static SharedBuffer *BuildFrame(uint8_t type, const uint8_t *payload,
+                                  unsigned int length);
+
+  /**
+   * @brief Split a datagram that holds a single frame.
+   * @returns false if the datagram isn't a complete frame.
+   */
+  static bool ParseDatagram(const uint8_t *data, unsigned int length,
+                            uint8_t *type, const uint8_t **payload,
+                            unsigned int *payload_length);
+};
+
+/**
+ * @brief The mastership status, sent by a master to each client.
+ *
+ * Each time a master is elected it claims a new term, one greater than any
+ * term it has seen in the DNS-SD data. Clients ignore claims from older
+ * terms, so when two masters briefly both think they're the master, the
+ * clients settle on the newer one.
+ */
+struct StatusMessage {
+  StatusMessage() : is_master(false), term(0) {}
+
+  bool is_master;
+  /**
+   * @brief If is_master is true, the term of the claim, otherwise the
+   * highest term the sender has seen.
+   */
+  uint32_t term;
+
+  /**
+   * @brief Encode the message as a frame.
+   */
+  SharedBuffer *Pack() const;
+
+  /**
+   * @brief Decode the payload of a STATUS_MESSAGE frame.
+   */
+  bool Unpack(const uint8_t *payload, unsigned int length);
+
+  static const unsigned int PAYLOAD_SIZE = 5;
+};
+
+/**
+ * @brief The mastership status, multicast by a master.
+ *
+ * Each master picks a random session when it starts and numbers its
+ * announcements from there. Clients drop announcements which aren't newer
+ * than the last one they saw from the same session, and count the gaps.
+ */
+struct AnnouncementMessage {
+  AnnouncementMessage() : session(0), sequence(0) {}
+
+  uint32_t session;
+  uint32_t sequence;
+  /**
+   * @brief The address the master accepts TCP connections on. If the host
+   * is the wildcard address, the source of the datagram should be used.
+   */
+  ola::network::IPV4SocketAddress address;
+  StatusMessage status;
+
+  SharedBuffer *Pack() const;
+  bool Unpack(const uint8_t *payload, unsigned int length);
+
+  static const unsigned int PAYLOAD_SIZE = 14 + StatusMessage::PAYLOAD_SIZE;
+};
+
+/**
+ * @brief Sent by a master that's shutting down, to move its clients to
+ * another master.
+ *
+ * If term is non-zero the new master has already claimed that term, so
+ * clients can switch to it without waiting for its status. If the address
+ * is the wildcard address no other master was found.
+ */
+struct RedirectMessage {
+  RedirectMessage() : term(0) {}
+
+  ola::network::IPV4SocketAddress address;
+  uint32_t term;
+
+  SharedBuffer *Pack() const;
+  bool Unpack(const uint8_t *payload, unsigned int length);
+
+  static const unsigned int PAYLOAD_SIZE = 10;
+};
+
+/**
+ * @brief Splits a byte stream into frames.
+ *
+ * Data may arrive in any sized pieces. Once a frame is complete, the
+ * callback is run with the message type and payload. The callback must not
+ * delete the FrameReader.
+ */
+class FrameReader {
+ public:
+  typedef ola::Callback3<void, uint8_t, const uint8_t*, unsigned int>
+      FrameCallback;
+
+  /**
+   * @brief Create a new FrameReader.
+   * @param callback The callback to run for each frame, ownership is
+   *   transferred.
+   */
+  explicit FrameReader(FrameCallback *callback);
+
+  /**
+   * @brief Read everything that's available on a non-blocking descriptor.
+   * @returns false if the read failed or the peer sent an invalid frame.
+   */
+  bool ReadFrom(ola::io::ConnectedDescriptor *descriptor);
+
+  /**
+   * @brief Add data to the stream.
+   * @returns false if the peer sent an invalid frame.
+   */
+  bool Parse(const uint8_t *data, unsigned int length);
+
+ private:
+  std::auto_ptr<FrameCallback> m_callback;
+  std::string m_buffer;
+
+  static const unsigned int READ_SIZE = 4096;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameReader);
+};
+#endif  // SRC_MASTERPROTOCOL_H_
@@ -0,0 +1,451 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterServer.cpp
+ * A master that registers itself and reports its status to clients.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterServer.h"
+
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/network/InterfacePicker.h>
+#include <ola/network/NetworkUtils.h>
+#include <ola/stl/STLUtils.h>
+#include <ola/strings/Format.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/MasterProtocol.h"
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::STLContains;
+using ola::network::Interface;
+using ola::network::InterfacePicker;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using std::auto_ptr;
+using std::string;
+using std::vector;
+
+const unsigned int MasterServer::HANDOFF_LINGER;
+
+MasterServer::MasterServer(ola::io::SelectServer *ss, const Options &options)
+    : m_ss(ss),
+      m_options(options),
+      m_is_master(false),
+      m_highest_term(0),
+      m_shutting_down(false),
+      m_election(NewCallback(this, &MasterServer::LeaderChanged)),
+      m_session(0),
+      m_sequence(0),
+      m_announce_timeout(ola::thread::INVALID_TIMEOUT),
+      m_handing_off(false),
+      m_handoff_timeout(ola::thread::INVALID_TIMEOUT) {
+}
+
+MasterServer::~MasterServer() {
+  m_shutting_down = true;
+
+  // Stop the agent first so no more events are queued, then flush the ones
+  // that are already pending since they refer to this object.
+  m_discovery_agent.reset();
+  m_ss->DrainCallbacks();
+
+  if (m_announce_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_announce_timeout);
+  }
+  if (m_handoff_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_handoff_timeout);
+  }
+  if (m_multicast_socket.get()) {
+    m_multicast_socket->Close();
+  }
+
+  StopWorkers();
+}
+
+bool MasterServer::Init() {
+  auto_ptr<InterfacePicker> picker(InterfacePicker::NewPicker());
+  vector<Interface> interfaces = picker->GetInterfaces(false);
+  vector<Interface>::const_iterator iter = interfaces.begin();
+  for (; iter != interfaces.end(); ++iter) {
+    m_local_ips.insert(iter->ip_address);
+  }
+
+  // Start the agent.
+  DiscoveryAgentFactory default_factory;
+  DiscoveryAgentFactory *factory = m_options.agent_factory ?
+      m_options.agent_factory : &default_factory;
+  DiscoveryAgentInterface::Options options;
+  options.scope = m_options.scope;
+  options.browse_domain = m_options.browse_domain;
+  options.registration_domain = m_options.registration_domain;
+  if (m_options.watch_masters) {
+    options.master_callback = ola::NewCallback(this,
+                                               &MasterServer::MasterChanged);
+    // Wait for the existing masters, so that we don't claim mastership from
+    // a higher priority master we haven't heard about yet.
+    options.initial_browse_timeout = ola::TimeInterval(
+        m_options.initial_browse_timeout / 1000,
+        (m_options.initial_browse_timeout % 1000) * 1000);
+    options.browse_complete_callback = NewSingleCallback(
+        this, &MasterServer::InitialBrowseDone);
+  }
+  auto_ptr<DiscoveryAgentInterface> agent(factory->New(options));
+
+  if (!agent.get() || !agent->Start()) {
+    return false;
+  }
+
+  if (!StartWorkers()) {
+    StopWorkers();
+    return false;
+  }
+  OLA_INFO << "Listening on " << m_listen_address;
+
+  if (!m_options.multicast_group.IsWildcard() && !StartMulticast()) {
+    return false;
+  }
+
+  // Register as a master
+  m_master_entry.service_name = InstanceName();
+  m_master_entry.address = m_listen_address;
+  m_master_entry.priority = m_options.priority;
+  m_master_entry.scope = m_options.scope;
+  agent->RegisterMaster(m_master_entry);
+
+  m_discovery_agent.reset(agent.release());
+  return true;
+}
+
+void MasterServer::SetPriority(uint8_t priority) {
+  // Once we're handing off, the priority stays at 0.
+  if (!m_discovery_agent.get() || m_handing_off ||
+      priority == m_master_entry.priority) {
+    return;
+  }
+  OLA_INFO << "Changing priority from "
+           << static_cast<int>(m_master_entry.priority) << " to "
+           << static_cast<int>(priority);
+  m_master_entry.priority = priority;
+  m_discovery_agent->RegisterMaster(m_master_entry);
+}
+
+/*
+ * Only the elected master needs to wait for a successor, anyone else just
+ * redirects its clients to the current leader.
+ */
+void MasterServer::Handoff(ola::SingleUseCallback0<void> *callback) {
+  if (m_handing_off) {
+    OLA_WARN << "Handoff already in progress";
+    delete callback;
+    return;
+  }
+  m_handing_off = true;
+  m_handoff_callback.reset(callback);
+
+  if (!m_discovery_agent.get() || !m_is_master || !m_options.watch_masters ||
+      m_options.handoff_timeout == 0) {
+    FinishHandoff();
+    return;
+  }
+
+  OLA_INFO << "Handing off mastership, waiting up to "
+           << m_options.handoff_timeout << "ms for a successor";
+  m_master_entry.priority = 0;
+  m_discovery_agent->RegisterMaster(m_master_entry);
+  m_handoff_timeout = m_ss->RegisterSingleTimeout(
+      m_options.handoff_timeout,
+      NewSingleCallback(this, &MasterServer::HandoffTimeout));
+}
+
+void MasterServer::MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                                 const MasterEntry &entry) {
+  m_ss->Execute(NewSingleCallback(this, &MasterServer::MasterEvent,
+                                  event, entry));
+}
+
+void MasterServer::MasterEvent(DiscoveryAgentInterface::MasterEvent event,
+                               MasterEntry entry) {
+  if (m_shutting_down) {
+    return;
+  }
+
+  OLA_INFO << "Got event "
+           << (event == DiscoveryAgentInterface::MASTER_ADDED ?
+               "Add / Update" : "Remove") << entry;
+  if (event == DiscoveryAgentInterface::MASTER_ADDED &&
+      entry.term > m_highest_term) {
+    m_highest_term = entry.term;
+  }
+  m_election.HandleEvent(event, entry);
+  CheckHandoff();
+}
+
+void MasterServer::LeaderChanged(const MasterEntry *leader) {
+  if (leader) {
+    OLA_INFO << "Elected master is " << *leader;
+  }
+  bool am_master = leader && IsLocalAddress(leader->address);
+  if (am_master != m_is_master) {
+    if (am_master) {
+      // Claim a new term, and advertise it so that the next master claims a
+      // higher one.
+      m_highest_term++;
+      m_master_entry.term = m_highest_term;
+      OLA_INFO << "I'm now the master, term " << m_master_entry.term;
+      m_discovery_agent->RegisterMaster(m_master_entry);
+    } else {
+      OLA_INFO << "I'm no longer the master!";
+    }
+    m_is_master = am_master;
+    // Don't make the clients wait for the keepalive.
+    PublishStatus();
+  }
+}
+
+void MasterServer::InitialBrowseDone(bool complete,
+                                     ola::TimeInterval elapsed) {
+  if (complete) {
+    OLA_INFO << "Initial browse took " << elapsed;
+  } else {
+    OLA_WARN << "Initial browse didn't complete within " << elapsed
+             << ", the first election may be wrong";
+  }
+}
+
+bool MasterServer::IsLocalAddress(const IPV4SocketAddress &address) const {
+  if (address.Port() != m_listen_address.Port()) {
+    return false;
+  }
+  // If we're bound to a specific address, that's what we registered.
+  if (m_listen_address.Host() != IPV4Address::WildCard()) {
+    return address.Host() == m_listen_address.Host();
+  }
+  return STLContains(m_local_ips, address.Host());
+}
+
+/*
+ * DNS-SD instance names are limited to 63 bytes, leave room for the suffix
+ * that's added if there's still a conflict.
+ */
+string MasterServer::InstanceName() const {
+  static const unsigned int MAX_NAME_LENGTH = 56;
+  if (!m_options.unique_name) {
+    return m_options.service_name;
+  }
+  string name = m_options.service_name + " @ " + ola::network::Hostname() +
+                ":" + ola::strings::IntToString(m_listen_address.Port());
+  if (name.size() > MAX_NAME_LENGTH) {
+    name.resize(MAX_NAME_LENGTH);
+  }
+  return name;
+}
+
+unsigned int MasterServer::ConnectionCount() const {
+  unsigned int count = 0;
+  vector<MasterWorker*>::const_iterator iter = m_workers.begin();
+  for (; iter != m_workers.end(); ++iter) {
+    count += (*iter)->ConnectionCount();
+  }
+  return count;
+}
+
+/*
+ * The first worker picks the port if one wasn't specified, the rest listen on
+ * the same port.
+ */
+bool MasterServer::StartWorkers() {
+  MasterWorker::Options options;
+  options.keepalive_interval = m_options.keepalive_interval;
+  options.heartbeat_interval = m_options.heartbeat_interval;
+  options.max_queued_bytes = m_options.max_queued_bytes;
+  options.listen_backlog = m_options.listen_backlog;
+  if (!m_options.multicast_group.IsWildcard()) {
+    // The announcements replace the periodic TCP sends.
+    options.keepalive_interval = 0;
+    options.heartbeat_interval = 0;
+  }
+
+  IPV4SocketAddress listen_address(m_options.listen_ip,
+                                   m_options.listen_port);
+
+  if (m_options.worker_threads == 0) {
+    options.expected_connections = m_options.expected_connections;
+    m_inline_worker.reset(new MasterWorker(m_ss, &m_status, options));
+    m_workers.push_back(m_inline_worker.get());
+    if (!m_inline_worker->Listen(listen_address, false)) {
+      return false;
+    }
+    m_listen_address = m_inline_worker->ListenAddress();
+    return true;
+  }
+
+  options.expected_connections = (
+      m_options.expected_connections / m_options.worker_threads);
+  for (unsigned int i = 0; i < m_options.worker_threads; i++) {
+    MasterWorkerThread *thread = new MasterWorkerThread(&m_status, options);
+    m_worker_threads.push_back(thread);
+    m_workers.push_back(thread->Worker());
+    if (!thread->Worker()->Listen(listen_address, true)) {
+      return false;
+    }
+    if (i == 0) {
+      listen_address = thread->Worker()->ListenAddress();
+      m_listen_address = listen_address;
+    }
+  }
+
+  vector<MasterWorkerThread*>::iterator iter = m_worker_threads.begin();
+  for (; iter != m_worker_threads.end(); ++iter) {
+    if (!(*iter)->Start()) {
+      return false;
+    }
+  }
+  OLA_INFO << "Started " << m_worker_threads.size() << " worker threads";
+  return true;
+}
+
+void MasterServer::StopWorkers() {
+  vector<MasterWorkerThread*>::iterator iter = m_worker_threads.begin();
+  for (; iter != m_worker_threads.end(); ++iter) {
+    if ((*iter)->IsRunning()) {
+      (*iter)->Stop();
+    }
+  }
+  ola::STLDeleteElements(&m_worker_threads);
+  m_inline_worker.reset();
+  m_workers.clear();
+}
+
+void MasterServer::PublishStatus() {
+  m_status.Set(m_is_master,
+               m_is_master ? m_master_entry.term : m_highest_term);
+  vector<MasterWorker*>::iterator iter = m_workers.begin();
+  for (; iter != m_workers.end(); ++iter) {
+    (*iter)->StatusChanged();
+  }
+  Announce();
+}
+
+bool MasterServer::StartMulticast() {
+  auto_ptr<ola::network::UDPSocket> socket(new ola::network::UDPSocket());
+  if (!socket->Init()) {
+    return false;
+  }
+  if (!m_options.multicast_interface.IsWildcard() &&
+      !socket->SetMulticastInterface(m_options.multicast_interface)) {
+    return false;
+  }
+
+  // The session lets clients spot a restarted master, whose sequence
+  // numbers start again.
+  ola::Clock clock;
+  ola::TimeStamp now;
+  clock.CurrentTime(&now);
+  m_session = static_cast<uint32_t>(now.Seconds()) * 1000000 +
+              now.MicroSeconds();
+
+  m_multicast_address = IPV4SocketAddress(m_options.multicast_group,
+                                          m_options.multicast_port);
+  m_multicast_socket.reset(socket.release());
+  if (m_options.multicast_interval) {
+    m_announce_timeout = m_ss->RegisterRepeatingTimeout(
+        m_options.multicast_interval,
+        NewCallback(this, &MasterServer::AnnounceTimeout));
+  }
+  OLA_INFO << "Announcing status to " << m_multicast_address;
+  return true;
+}
+
+void MasterServer::Announce() {
+  if (!m_multicast_socket.get()) {
+    return;
+  }
+
+  AnnouncementMessage announcement;
+  announcement.session = m_session;
+  announcement.sequence = ++m_sequence;
+  announcement.address = m_listen_address;
+  m_status.Get(&announcement.status.is_master, &announcement.status.term);
+
+  SharedBuffer *message = announcement.Pack();
+  if (m_multicast_socket->SendTo(message->Data(), message->Size(),
+                                 m_multicast_address) < 0) {
+    OLA_WARN << "Failed to send announcement to " << m_multicast_address;
+  }
+  message->DeRef();
+}
+
+bool MasterServer::AnnounceTimeout() {
+  Announce();
+  return true;
+}
+
+/*
+ * The successor has taken over once it's advertising a newer term than
+ * ours.
+ */
+void MasterServer::CheckHandoff() {
+  if (m_handoff_timeout == ola::thread::INVALID_TIMEOUT) {
+    return;
+  }
+  const MasterEntry *leader = m_election.Leader();
+  if (!leader || IsLocalAddress(leader->address) ||
+      leader->term <= m_master_entry.term) {
+    return;
+  }
+  OLA_INFO << leader->service_name << " took over, term " << leader->term;
+  m_ss->RemoveTimeout(m_handoff_timeout);
+  m_handoff_timeout = ola::thread::INVALID_TIMEOUT;
+  FinishHandoff();
+}
+
+void MasterServer::HandoffTimeout() {
+  m_handoff_timeout = ola::thread::INVALID_TIMEOUT;
+  OLA_WARN << "No master took over within " << m_options.handoff_timeout
+           << "ms";
+  FinishHandoff();
+}
+
+void MasterServer::FinishHandoff() {
+  RedirectMessage redirect;
+  const MasterEntry *leader = m_election.Leader();
+  if (leader && !IsLocalAddress(leader->address)) {
+    redirect.address = leader->address;
+    if (leader->term > m_master_entry.term) {
+      redirect.term = leader->term;
+    }
+  }
+  OLA_INFO << "Redirecting clients to " << redirect.address;
+
+  SharedBuffer *message = redirect.Pack();
+  vector<MasterWorker*>::iterator iter = m_workers.begin();
+  for (; iter != m_workers.end(); ++iter) {
+    (*iter)->Broadcast(message);
+  }
+  message->DeRef();
+
+  if (m_discovery_agent.get()) {
+    m_discovery_agent->DeRegisterMaster(m_listen_address);
+  }
+  m_ss->RegisterSingleTimeout(HANDOFF_LINGER, m_handoff_callback.release());
+}
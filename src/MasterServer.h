@@ -0,0 +1,255 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterServer.h
+ * A master that registers itself and reports its status to clients.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERSERVER_H_
+#define SRC_MASTERSERVER_H_
+
+#include <stdint.h>
+#include <ola/Callback.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/Socket.h>
+#include <ola/network/SocketAddress.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "src/DiscoveryAgent.h"
+#include "src/MasterElection.h"
+#include "src/MasterEntry.h"
+#include "src/MasterWorker.h"
+
+/**
+ * @brief A master.
+ *
+ * The MasterServer registers itself in DNS-SD, watches for other masters in
+ * the same scope and tells each connected client whether it's currently the
+ * elected master.
+ *
+ * The client connections are handled by MasterWorkers. By default there's a
+ * single worker on the MasterServer's SelectServer. If worker_threads is set,
+ * each worker runs in its own thread with its own SO_REUSEPORT listener and
+ * the election result is published to them with PublishedStatus.
+ *
+ * If a multicast group is set, the status is multicast as an
+ * AnnouncementMessage on each change and every multicast_interval, and the
+ * TCP connections are only used to send the initial status. The
+ * announcements double as heartbeats.
+ *
+ * Handoff() gives up mastership before a planned shutdown. We advertise a
+ * priority of 0, which takes us out of every election, wait for the next
+ * master to claim a new term, then send our clients a RedirectMessage
+ * pointing at it, so they can switch without waiting for DNS-SD.
+ *
+ * All methods must be called on the thread running the SelectServer.
+ */
+class MasterServer {
+ public:
+  struct Options {
+    Options()
+        : service_name("Master"),
+          unique_name(true),
+          listen_port(0),
+          priority(50),
+          scope(DiscoveryAgentInterface::DEFAULT_SCOPE),
+          watch_masters(true),
+          keepalive_interval(1000),
+          heartbeat_interval(100),
+          listen_backlog(128),
+          expected_connections(0),
+          max_queued_bytes(64 * 1024),
+          worker_threads(0),
+          multicast_port(0),
+          multicast_interval(100),
+          initial_browse_timeout(0),
+          handoff_timeout(2000),
+          agent_factory(NULL) {
+    }
+
+    std::string service_name;
+    /**
+     * @brief Add the host name and port to service_name, so that masters
+     * with the same service_name don't conflict.
+     */
+    bool unique_name;
+    ola::network::IPV4Address listen_ip;
+    uint16_t listen_port;
+    uint8_t priority;
+    std::string scope;
+    /**
+     * @brief The DNS-SD domains to browse and register in, see
+     * DiscoveryAgentInterface::Options. Empty uses the default.
+     */
+    std::string browse_domain;
+    std::string registration_domain;
+    bool watch_masters;
+    /**
+     * @brief How often to resend the status to clients, in ms. Status is
+     * always sent when it changes, this just guards against lost updates.
+     * 0 disables the keepalive.
+     */
+    unsigned int keepalive_interval;
+    /**
+     * @brief How often to send a heartbeat to clients, in ms. Clients use
+     * these to detect a master that has gone away without closing the
+     * connection. 0 disables heartbeats.
+     */
+    unsigned int heartbeat_interval;
+    /**
+     * @brief The maximum length of the queue of pending connections.
+     */
+    unsigned int listen_backlog;
+    /**
+     * @brief The number of clients we expect, used to size the connection
+     * table up front.
+     */
+    unsigned int expected_connections;
+    /**
+     * @brief The number of bytes that may be queued for a client before it's
+     * disconnected.
+     */
+    unsigned int max_queued_bytes;
+    /**
+     * @brief The number of threads to handle client connections. If 0 the
+     * connections are handled on the MasterServer's SelectServer.
+     */
+    unsigned int worker_threads;
+    /**
+     * @brief The group to multicast the status to, the wildcard address
+     * disables multicast.
+     */
+    ola::network::IPV4Address multicast_group;
+    uint16_t multicast_port;
+    /**
+     * @brief The interface to send multicast on, the wildcard address uses
+     * the system default.
+     */
+    ola::network::IPV4Address multicast_interface;
+    /**
+     * @brief How often to multicast the status, in ms.
+     */
+    unsigned int multicast_interval;
+    /**
+     * @brief How long Init() waits for the first browse to complete, in ms,
+     * so the first election sees the existing masters. 0 doesn't wait.
+     */
+    unsigned int initial_browse_timeout;
+    /**
+     * @brief How long Handoff() waits for another master to take over, in
+     * ms.
+     */
+    unsigned int handoff_timeout;
+    /**
+     * @brief The factory to create the DiscoveryAgent with. If NULL the
+     * platform's DNS-SD implementation is used. Not owned.
+     */
+    DiscoveryAgentFactory *agent_factory;
+  };
+
+  MasterServer(ola::io::SelectServer *ss, const Options &options);
+  ~MasterServer();
+
+  bool Init();
+
+  /**
+   * @brief Change the priority we advertise.
+   */
+  void SetPriority(uint8_t priority);
+
+  /**
+   * @brief Hand mastership to another master and deregister.
+   * @param callback Run once the clients have been redirected, ownership is
+   *   transferred. The MasterServer should be destroyed after this.
+   */
+  void Handoff(ola::SingleUseCallback0<void> *callback);
+
+  bool IsMaster() const { return m_is_master; }
+
+  /**
+   * @brief The term of our current, or most recent, claim to be master.
+   */
+  uint32_t Term() const { return m_master_entry.term; }
+
+  ola::network::IPV4SocketAddress ListenAddress() const {
+    return m_listen_address;
+  }
+
+  unsigned int ConnectionCount() const;
+
+ private:
+  ola::io::SelectServer *m_ss;
+  const Options m_options;
+
+  ola::network::IPV4SocketAddress m_listen_address;
+  std::auto_ptr<DiscoveryAgentInterface> m_discovery_agent;
+  MasterEntry m_master_entry;
+
+  std::set<ola::network::IPV4Address> m_local_ips;
+  bool m_is_master;
+  uint32_t m_highest_term;
+  bool m_shutting_down;
+  MasterElection m_election;
+
+  PublishedStatus m_status;
+  std::auto_ptr<MasterWorker> m_inline_worker;
+  std::vector<MasterWorkerThread*> m_worker_threads;
+  // All the workers, inline or threaded.
+  std::vector<MasterWorker*> m_workers;
+
+  std::auto_ptr<ola::network::UDPSocket> m_multicast_socket;
+  ola::network::IPV4SocketAddress m_multicast_address;
+  uint32_t m_session;
+  uint32_t m_sequence;
+  ola::thread::timeout_id m_announce_timeout;
+
+  bool m_handing_off;
+  std::auto_ptr<ola::SingleUseCallback0<void> > m_handoff_callback;
+  ola::thread::timeout_id m_handoff_timeout;
+
+  // This is called within the Discovery thread.
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry);
+
+  void MasterEvent(DiscoveryAgentInterface::MasterEvent event,
+                   MasterEntry entry);
+  void LeaderChanged(const MasterEntry *leader);
+  void InitialBrowseDone(bool complete, ola::TimeInterval elapsed);
+  bool IsLocalAddress(const ola::network::IPV4SocketAddress &address) const;
+  std::string InstanceName() const;
+
+  bool StartWorkers();
+  void StopWorkers();
+  void PublishStatus();
+  bool StartMulticast();
+  void Announce();
+  bool AnnounceTimeout();
+  void CheckHandoff();
+  void HandoffTimeout();
+  void FinishHandoff();
+
+  // How long to let the workers flush the redirect before the handoff
+  // callback runs, in ms.
+  static const unsigned int HANDOFF_LINGER = 100;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterServer);
+};
+#endif  // SRC_MASTERSERVER_H_
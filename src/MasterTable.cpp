@@ -0,0 +1,322 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterTable.cpp
+ * A table of masters in shared memory.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterTable.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif  // __linux__
+
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/SocketAddress.h>
+
+#include <algorithm>
+#include <string>
+
+using ola::TimeInterval;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using std::string;
+
+namespace {
+
+template <size_t N>
+void CopyString(char (&dest)[N], const string &src) {
+  strncpy(dest, src.c_str(), N - 1);
+  dest[N - 1] = 0;
+}
+
+template <size_t N>
+string ReadString(const char (&src)[N]) {
+  return string(src, strnlen(src, N));
+}
+
+#ifdef __linux__
+int Futex(volatile uint32_t *address, int op, uint32_t value,
+          const struct timespec *timeout) {
+  return syscall(SYS_futex, address, op, value, timeout, NULL, 0);
+}
+#endif  // __linux__
+}  // namespace
+
+// MasterTableWriter
+// ----------------------------------------------------------------------------
+MasterTableWriter::MasterTableWriter(const string &name, const string &scope)
+    : m_name(name),
+      m_scope(scope),
+      m_table(NULL) {
+}
+
+MasterTableWriter::~MasterTableWriter() {
+  Close();
+}
+
+bool MasterTableWriter::Open() {
+  if (m_table) {
+    return true;
+  }
+
+  int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    OLA_WARN << "shm_open(" << m_name << ") failed: " << strerror(errno);
+    return false;
+  }
+
+  if (ftruncate(fd, sizeof(MasterTableLayout)) < 0) {
+    OLA_WARN << "ftruncate(" << m_name << ") failed: " << strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  void *ptr = mmap(NULL, sizeof(MasterTableLayout), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    OLA_WARN << "mmap(" << m_name << ") failed: " << strerror(errno);
+    return false;
+  }
+
+  MasterTableLayout *table = reinterpret_cast<MasterTableLayout*>(ptr);
+  const pid_t pid = table->writer_pid;
+  if (table->magic == MasterTableLayout::MAGIC && pid != 0 &&
+      pid != getpid() && kill(pid, 0) == 0) {
+    OLA_WARN << m_name << " is already being written by pid " << pid;
+    munmap(ptr, sizeof(MasterTableLayout));
+    return false;
+  }
+
+  // Keep the generation so that readers waiting on it notice the first
+  // Publish().
+  if (table->magic != MasterTableLayout::MAGIC ||
+      table->version != MasterTableLayout::VERSION) {
+    table->generation = 0;
+  }
+  // A previous writer may have died part way through an update, leaving the
+  // sequence odd. Either way, make it odd while the header is written; the
+  // increment below makes it even again.
+  table->sequence = (table->sequence + 1) | 1;
+  __sync_synchronize();
+  table->magic = MasterTableLayout::MAGIC;
+  table->version = MasterTableLayout::VERSION;
+  table->writer_pid = getpid();
+  table->count = 0;
+  CopyString(table->scope, m_scope);
+  __sync_add_and_fetch(&table->sequence, 1);
+
+  m_table = table;
+  OLA_INFO << "Publishing masters for " << m_scope << " to " << m_name;
+  return true;
+}
+
+void MasterTableWriter::Close() {
+  if (!m_table) {
+    return;
+  }
+  m_table->writer_pid = 0;
+  munmap(m_table, sizeof(MasterTableLayout));
+  m_table = NULL;
+}
+
+bool MasterTableWriter::Publish(const MasterEntryList &masters) {
+  if (!m_table) {
+    return false;
+  }
+
+  const unsigned int count = std::min(
+      static_cast<unsigned int>(masters.size()),
+      MasterTableLayout::MAX_MASTERS);
+  if (count < masters.size()) {
+    OLA_WARN << "Only publishing " << count << " of " << masters.size()
+             << " masters";
+  }
+
+  __sync_add_and_fetch(&m_table->sequence, 1);
+  for (unsigned int i = 0; i < count; i++) {
+    const MasterEntry &master = masters[i];
+    MasterTableLayout::Slot *slot = &m_table->slots[i];
+    CopyString(slot->service_name, master.service_name);
+    slot->host = master.address.Host().AsInt();
+    slot->port = master.address.Port();
+    slot->priority = master.priority;
+    slot->reserved = 0;
+    slot->term = master.term;
+  }
+  m_table->count = count;
+  __sync_add_and_fetch(&m_table->sequence, 1);
+
+  __sync_add_and_fetch(&m_table->generation, 1);
+#ifdef __linux__
+  // The table is shared between processes, so this can't use
+  // FUTEX_PRIVATE_FLAG.
+  Futex(&m_table->generation, FUTEX_WAKE, INT_MAX, NULL);
+#endif  // __linux__
+  return true;
+}
+
+// MasterTableReader
+// ----------------------------------------------------------------------------
+MasterTableReader::MasterTableReader(const string &name)
+    : m_name(name),
+      m_table(NULL) {
+}
+
+MasterTableReader::~MasterTableReader() {
+  Close();
+}
+
+bool MasterTableReader::Open() {
+  if (m_table) {
+    return true;
+  }
+
+  int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      OLA_WARN << "shm_open(" << m_name << ") failed: " << strerror(errno);
+    }
+    return false;
+  }
+
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) < 0 ||
+      stat_buf.st_size < static_cast<off_t>(sizeof(MasterTableLayout))) {
+    // The writer hasn't sized the table yet.
+    close(fd);
+    return false;
+  }
+
+  void *ptr = mmap(NULL, sizeof(MasterTableLayout), PROT_READ, MAP_SHARED,
+                   fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    OLA_WARN << "mmap(" << m_name << ") failed: " << strerror(errno);
+    return false;
+  }
+
+  const MasterTableLayout *table =
+      reinterpret_cast<const MasterTableLayout*>(ptr);
+  if (table->magic != MasterTableLayout::MAGIC ||
+      table->version != MasterTableLayout::VERSION) {
+    OLA_WARN << m_name << " isn't a version " << MasterTableLayout::VERSION
+             << " master table";
+    munmap(ptr, sizeof(MasterTableLayout));
+    return false;
+  }
+  m_table = table;
+  return true;
+}
+
+void MasterTableReader::Close() {
+  if (m_table) {
+    munmap(const_cast<MasterTableLayout*>(m_table),
+           sizeof(MasterTableLayout));
+    m_table = NULL;
+  }
+}
+
+bool MasterTableReader::Read(MasterEntryList *masters,
+                             uint32_t *generation) const {
+  if (!m_table) {
+    return false;
+  }
+
+  for (unsigned int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+    const uint32_t start = m_table->sequence;
+    if (start & 1) {
+      // An update is in progress.
+      sched_yield();
+      continue;
+    }
+    __sync_synchronize();
+
+    const uint32_t current_generation = m_table->generation;
+    const string scope = ReadString(m_table->scope);
+    const unsigned int count = std::min(m_table->count,
+                                        MasterTableLayout::MAX_MASTERS);
+    masters->resize(count);
+    for (unsigned int i = 0; i < count; i++) {
+      const MasterTableLayout::Slot &slot = m_table->slots[i];
+      MasterEntry *master = &(*masters)[i];
+      master->service_name = ReadString(slot.service_name);
+      master->address = IPV4SocketAddress(IPV4Address(slot.host), slot.port);
+      master->priority = slot.priority;
+      master->scope = scope;
+      master->term = slot.term;
+    }
+
+    __sync_synchronize();
+    if (m_table->sequence == start) {
+      if (generation) {
+        *generation = current_generation;
+      }
+      return true;
+    }
+  }
+  OLA_WARN << "Failed to read a consistent copy of " << m_name;
+  return false;
+}
+
+bool MasterTableReader::Wait(uint32_t generation,
+                             const TimeInterval &timeout) const {
+  if (!m_table) {
+    return false;
+  }
+  if (m_table->generation != generation) {
+    return true;
+  }
+
+#ifdef __linux__
+  struct timespec ts;
+  ts.tv_sec = timeout.Seconds();
+  ts.tv_nsec = (timeout.AsInt() % 1000000) * 1000;
+  // FUTEX_WAIT returns immediately if the generation has already moved on.
+  Futex(const_cast<volatile uint32_t*>(&m_table->generation), FUTEX_WAIT,
+        generation, &ts);
+#else
+  // Fall back to polling.
+  static const int64_t POLL_INTERVAL = 10000;
+  int64_t remaining = timeout.AsInt();
+  while (remaining > 0 && m_table->generation == generation) {
+    const int64_t sleep_for = std::min(remaining, POLL_INTERVAL);
+    usleep(sleep_for);
+    remaining -= sleep_for;
+  }
+#endif  // __linux__
+  return m_table->generation != generation;
+}
+
+bool MasterTableReader::HasWriter() const {
+  return m_table && m_table->writer_pid != 0;
+}
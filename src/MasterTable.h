@@ -0,0 +1,159 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterTable.h
+ * A table of masters in shared memory.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERTABLE_H_
+#define SRC_MASTERTABLE_H_
+
+#include <stdint.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <string>
+
+#include "src/MasterEntry.h"
+
+/**
+ * @brief The layout of the table in shared memory.
+ *
+ * The table is protected by a seqlock. The writer makes sequence odd, updates
+ * the table, then makes sequence even again. A reader copies the table and
+ * retries if sequence was odd, or changed while it was copying.
+ *
+ * After each update the writer increments generation and wakes any readers
+ * waiting on it with a futex.
+ */
+struct MasterTableLayout {
+  struct Slot {
+    char service_name[64];
+    uint32_t host;  // In network byte order.
+    uint16_t port;
+    uint8_t priority;
+    uint8_t reserved;
+    uint32_t term;
+  };
+
+  uint32_t magic;
+  uint32_t version;
+  volatile uint32_t sequence;
+  volatile uint32_t generation;
+  // The pid of the writer, 0 if there isn't one.
+  volatile uint32_t writer_pid;
+  uint32_t count;
+  char scope[64];
+  Slot slots[256];
+
+  static const uint32_t MAGIC = 0x4d544231;  // MTB1
+  static const uint32_t VERSION = 1;
+  static const unsigned int MAX_MASTERS = 256;
+};
+
+/**
+ * @brief Publishes a table of masters to shared memory.
+ *
+ * There should only be one writer for each table.
+ */
+class MasterTableWriter {
+ public:
+  /**
+   * @brief Create a new writer.
+   * @param name The name of the shared memory object, e.g. "/masters".
+   * @param scope The scope the masters are from.
+   */
+  MasterTableWriter(const std::string &name, const std::string &scope);
+  ~MasterTableWriter();
+
+  /**
+   * @brief Create, or take over, the table.
+   */
+  bool Open();
+
+  /**
+   * @brief Detach from the table.
+   *
+   * The table is left in place, so readers keep the last set of masters
+   * until a new writer takes over.
+   */
+  void Close();
+
+  /**
+   * @brief Replace the masters in the table.
+   *
+   * Only the first MAX_MASTERS masters are published.
+   */
+  bool Publish(const MasterEntryList &masters);
+
+ private:
+  const std::string m_name;
+  const std::string m_scope;
+  MasterTableLayout *m_table;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterTableWriter);
+};
+
+/**
+ * @brief Reads a table of masters from shared memory.
+ *
+ * Readers never block the writer. Read() is wait-free unless it overlaps
+ * with an update, in which case it retries.
+ */
+class MasterTableReader {
+ public:
+  /**
+   * @brief Create a new reader.
+   * @param name The name of the shared memory object.
+   */
+  explicit MasterTableReader(const std::string &name);
+  ~MasterTableReader();
+
+  /**
+   * @brief Map the table.
+   * @returns false if the table doesn't exist or is the wrong version.
+   */
+  bool Open();
+  void Close();
+  bool IsOpen() const { return m_table != NULL; }
+
+  /**
+   * @brief Copy the masters from the table.
+   * @param[out] masters The masters in the table.
+   * @param[out] generation The generation of the copy, see Wait().
+   * @returns false if a consistent copy couldn't be made.
+   */
+  bool Read(MasterEntryList *masters, uint32_t *generation) const;
+
+  /**
+   * @brief Wait for the table to move on from a generation.
+   * @returns true if the table changed, false if the timeout expired.
+   */
+  bool Wait(uint32_t generation, const ola::TimeInterval &timeout) const;
+
+  /**
+   * @brief True if a writer is attached to the table.
+   */
+  bool HasWriter() const;
+
+ private:
+  const std::string m_name;
+  const MasterTableLayout *m_table;
+
+  static const unsigned int MAX_READ_ATTEMPTS = 100;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterTableReader);
+};
+#endif  // SRC_MASTERTABLE_H_
@@ -0,0 +1,264 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterTableAgent.cpp
+ * Share the masters between processes on the same host.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterTableAgent.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/thread/CallbackThread.h>
+
+#include <map>
+#include <string>
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::TimeInterval;
+using ola::network::IPV4SocketAddress;
+using ola::thread::MutexLocker;
+using std::string;
+
+// MasterTablePublisher
+// ----------------------------------------------------------------------------
+MasterTablePublisher::MasterTablePublisher(DiscoveryHub *hub,
+                                           const string &table_name)
+    : m_hub(hub),
+      m_table_name(table_name),
+      m_writer(table_name, hub->Scope()),
+      m_subscriber_id(0) {
+}
+
+MasterTablePublisher::~MasterTablePublisher() {
+  Stop();
+}
+
+bool MasterTablePublisher::Start() {
+  if (m_subscriber_id) {
+    return true;
+  }
+  if (!m_writer.Open()) {
+    return false;
+  }
+  // Publish an empty table, so readers know a writer is around.
+  m_writer.Publish(MasterEntryList());
+  if (!CheckTable()) {
+    m_writer.Close();
+    return false;
+  }
+
+  m_callback.reset(NewCallback(this, &MasterTablePublisher::MasterChanged));
+  m_subscriber_id = m_hub->AddSubscriber(m_callback.get(), NULL);
+  return true;
+}
+
+void MasterTablePublisher::Stop() {
+  if (m_subscriber_id) {
+    m_hub->RemoveSubscriber(m_subscriber_id);
+    m_subscriber_id = 0;
+  }
+  m_callback.reset();
+  m_writer.Close();
+}
+
+/*
+ * Read the table back, the same way a MasterTableAgent would, to catch a
+ * table that readers can't use before any of them try.
+ */
+bool MasterTablePublisher::CheckTable() {
+  MasterTableReader reader(m_table_name);
+  MasterEntryList masters;
+  uint32_t generation = 0;
+  if (!reader.Open() || !reader.Read(&masters, &generation)) {
+    OLA_WARN << "Failed to read back " << m_table_name;
+    return false;
+  }
+  if (!masters.empty() || !reader.HasWriter()) {
+    OLA_WARN << m_table_name << " doesn't match what was written";
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Runs on the DNS-SD thread. Each change rewrites the whole table; it's at
+ * most a few KB.
+ */
+void MasterTablePublisher::MasterChanged(
+    DiscoveryAgentInterface::MasterEvent event,
+    const MasterEntry &entry) {
+  MutexLocker lock(&m_mu);
+  if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
+    m_masters.erase(entry.service_name);
+  } else {
+    m_masters[entry.service_name] = entry;
+  }
+
+  MasterEntryList masters;
+  masters.reserve(m_masters.size());
+  MasterMap::const_iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    masters.push_back(iter->second);
+  }
+  m_writer.Publish(masters);
+}
+
+// MasterTableAgent
+// ----------------------------------------------------------------------------
+MasterTableAgent::MasterTableAgent(const string &table_name,
+                                   const Options &options)
+    : m_scope(options.scope),
+      m_master_callback(options.master_callback),
+      m_reader(table_name),
+      m_browse_gate(options.initial_browse_timeout,
+                    options.browse_complete_callback),
+      m_stopping(false) {
+}
+
+MasterTableAgent::~MasterTableAgent() {
+  Stop();
+}
+
+bool MasterTableAgent::Start() {
+  if (m_thread.get()) {
+    return true;
+  }
+
+  {
+    MutexLocker lock(&m_mu);
+    m_stopping = false;
+  }
+  m_browse_gate.Reset();
+  if (!m_master_callback.get()) {
+    m_browse_gate.Open();
+  }
+
+  m_thread.reset(new ola::thread::CallbackThread(NewSingleCallback(
+      this, &MasterTableAgent::RunThread)));
+  m_thread->Start();
+  m_browse_gate.Wait();
+  return true;
+}
+
+bool MasterTableAgent::Stop() {
+  if (m_thread.get()) {
+    {
+      MutexLocker lock(&m_mu);
+      m_stopping = true;
+    }
+    m_thread->Join();
+    m_thread.reset();
+  }
+  m_reader.Close();
+  m_masters.clear();
+  return true;
+}
+
+void MasterTableAgent::RegisterMaster(const MasterEntry &master) {
+  OLA_WARN << "Can't register " << master << " in a master table";
+}
+
+void MasterTableAgent::DeRegisterMaster(
+    const IPV4SocketAddress &master_address) {
+  OLA_WARN << "Can't de-register " << master_address
+           << " from a master table";
+}
+
+/*
+ * Readers never take a lock that the writer holds, so the wait for the next
+ * generation is the only place this thread blocks. The wait is limited so
+ * that Stop() is noticed.
+ */
+void MasterTableAgent::RunThread() {
+  const TimeInterval wait_interval(0, WAIT_INTERVAL_MS * 1000);
+  uint32_t generation = 0;
+  bool have_generation = false;
+
+  while (!Stopping()) {
+    if (!m_reader.IsOpen()) {
+      if (!m_reader.Open()) {
+        // No publisher yet, try again later.
+        usleep(wait_interval.AsInt());
+        continue;
+      }
+      have_generation = false;
+    }
+
+    if (have_generation) {
+      if (!m_reader.Wait(generation, wait_interval)) {
+        continue;
+      }
+    }
+
+    MasterEntryList masters;
+    if (m_reader.Read(&masters, &generation)) {
+      have_generation = true;
+      UpdateMasters(masters);
+      m_browse_gate.Open();
+    }
+  }
+}
+
+bool MasterTableAgent::Stopping() {
+  MutexLocker lock(&m_mu);
+  return m_stopping;
+}
+
+/*
+ * Turn the new copy of the table into MASTER_ADDED & MASTER_REMOVED events.
+ */
+void MasterTableAgent::UpdateMasters(const MasterEntryList &masters) {
+  if (!m_master_callback.get()) {
+    return;
+  }
+
+  MasterMap current;
+  MasterEntryList::const_iterator iter = masters.begin();
+  for (; iter != masters.end(); ++iter) {
+    if (iter->scope == m_scope) {
+      current[iter->service_name] = *iter;
+    }
+  }
+
+  MasterMap::const_iterator old_iter = m_masters.begin();
+  for (; old_iter != m_masters.end(); ++old_iter) {
+    if (current.find(old_iter->first) == current.end()) {
+      m_master_callback->Run(MASTER_REMOVED, old_iter->second);
+    }
+  }
+
+  MasterMap::const_iterator new_iter = current.begin();
+  for (; new_iter != current.end(); ++new_iter) {
+    MasterMap::const_iterator previous = m_masters.find(new_iter->first);
+    if (previous == m_masters.end() ||
+        !(previous->second == new_iter->second)) {
+      m_master_callback->Run(MASTER_ADDED, new_iter->second);
+    }
+  }
+  m_masters.swap(current);
+}
+
+// MasterTableAgentFactory
+// ----------------------------------------------------------------------------
+DiscoveryAgentInterface* MasterTableAgentFactory::New(
+    const DiscoveryAgentInterface::Options &options) {
+  return new MasterTableAgent(m_table_name, options);
+}
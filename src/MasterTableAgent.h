@@ -0,0 +1,135 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterTableAgent.h
+ * Share the masters between processes on the same host.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERTABLEAGENT_H_
+#define SRC_MASTERTABLEAGENT_H_
+
+#include <ola/base/Macro.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/thread/CallbackThread.h>
+#include <ola/thread/Mutex.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "src/BrowseGate.h"
+#include "src/DiscoveryAgent.h"
+#include "src/MasterTable.h"
+#include "src/SharedDiscoveryAgent.h"
+
+/**
+ * @brief Writes the masters a DiscoveryHub finds to a MasterTable.
+ *
+ * One publisher per host does the DNS-SD work, and every other process
+ * reads the table with a MasterTableAgent.
+ */
+class MasterTablePublisher {
+ public:
+  /**
+   * @brief Create a new publisher.
+   * @param hub The hub to take masters from, not owned.
+   * @param table_name The name of the shared memory object.
+   */
+  MasterTablePublisher(DiscoveryHub *hub, const std::string &table_name);
+  ~MasterTablePublisher();
+
+  bool Start();
+  void Stop();
+
+ private:
+  typedef std::map<std::string, MasterEntry> MasterMap;
+
+  DiscoveryHub *m_hub;
+  const std::string m_table_name;
+  MasterTableWriter m_writer;
+  std::auto_ptr<DiscoveryAgentInterface::MasterEventCallback> m_callback;
+  unsigned int m_subscriber_id;
+
+  ola::thread::Mutex m_mu;
+  MasterMap m_masters;  // Protected by m_mu
+
+  bool CheckTable();
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry);
+
+  DISALLOW_COPY_AND_ASSIGN(MasterTablePublisher);
+};
+
+/**
+ * @brief An implementation of DiscoveryAgentInterface that reads the masters
+ * from a MasterTable.
+ *
+ * This doesn't use DNS-SD at all, so it can't register masters.
+ */
+class MasterTableAgent : public DiscoveryAgentInterface {
+ public:
+  MasterTableAgent(const std::string &table_name, const Options &options);
+  ~MasterTableAgent();
+
+  bool Start();
+
+  bool Stop();
+
+  void RegisterMaster(const MasterEntry &master);
+
+  void DeRegisterMaster(const ola::network::IPV4SocketAddress &master_address);
+
+ private:
+  typedef std::map<std::string, MasterEntry> MasterMap;
+
+  const std::string m_scope;
+  std::auto_ptr<MasterEventCallback> m_master_callback;
+  MasterTableReader m_reader;
+  std::auto_ptr<ola::thread::CallbackThread> m_thread;
+  BrowseGate m_browse_gate;
+
+  ola::thread::Mutex m_mu;
+  bool m_stopping;  // Protected by m_mu
+
+  // Only accessed by the reader thread.
+  MasterMap m_masters;
+
+  void RunThread();
+  bool Stopping();
+  void UpdateMasters(const MasterEntryList &masters);
+
+  static const unsigned int WAIT_INTERVAL_MS = 100;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterTableAgent);
+};
+
+/**
+ * @brief A DiscoveryAgentFactory that produces MasterTableAgents.
+ */
+class MasterTableAgentFactory : public DiscoveryAgentFactory {
+ public:
+  explicit MasterTableAgentFactory(const std::string &table_name)
+      : m_table_name(table_name) {
+  }
+
+  DiscoveryAgentInterface* New(
+      const DiscoveryAgentInterface::Options &options);
+
+ private:
+  const std::string m_table_name;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterTableAgentFactory);
+};
+#endif  // SRC_MASTERTABLEAGENT_H_
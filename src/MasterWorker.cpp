@@ -0,0 +1,224 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterWorker.cpp
+ * Accepts client connections and sends them the master's status.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/MasterWorker.h"
+
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+
+#include <vector>
+
+#include "src/MasterProtocol.h"
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::network::IPV4SocketAddress;
+using ola::network::TCPSocket;
+using std::vector;
+
+// PublishedStatus
+// ----------------------------------------------------------------------------
+void PublishedStatus::Set(bool is_master, uint32_t term) {
+  const uint64_t value = (static_cast<uint64_t>(term) << 32) |
+                         (is_master ? 1 : 0);
+  uint64_t old_value = m_value;
+  while (true) {
+    uint64_t previous = __sync_val_compare_and_swap(&m_value, old_value,
+                                                    value);
+    if (previous == old_value) {
+      return;
+    }
+    old_value = previous;
+  }
+}
+
+void PublishedStatus::Get(bool *is_master, uint32_t *term) const {
+  const uint64_t value = __sync_fetch_and_add(&m_value, 0);
+  *is_master = value & 1;
+  *term = static_cast<uint32_t>(value >> 32);
+}
+
+// MasterWorker
+// ----------------------------------------------------------------------------
+MasterWorker::MasterWorker(ola::io::SelectServerInterface *ss,
+                           const PublishedStatus *status,
+                           const Options &options)
+    : m_ss(ss),
+      m_status(status),
+      m_options(options),
+      m_tcp_socket_factory(NewCallback(this, &MasterWorker::OnTCPConnect)),
+      m_listen_socket(&m_tcp_socket_factory),
+      m_listening(false),
+      m_connection_count(0),
+      m_keepalive_timeout(ola::thread::INVALID_TIMEOUT),
+      m_heartbeat_timeout(ola::thread::INVALID_TIMEOUT),
+      m_heartbeat(MasterProtocol::BuildFrame(MasterProtocol::HEARTBEAT_MESSAGE,
+                                             NULL, 0)) {
+  m_connections.Reserve(m_options.expected_connections);
+  if (m_options.keepalive_interval) {
+    m_keepalive_timeout = m_ss->RegisterRepeatingTimeout(
+        m_options.keepalive_interval,
+        NewCallback(this, &MasterWorker::KeepaliveTimeout));
+  }
+  if (m_options.heartbeat_interval) {
+    m_heartbeat_timeout = m_ss->RegisterRepeatingTimeout(
+        m_options.heartbeat_interval,
+        NewCallback(this, &MasterWorker::HeartbeatTimeout));
+  }
+}
+
+MasterWorker::~MasterWorker() {
+  if (m_keepalive_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_keepalive_timeout);
+  }
+  if (m_heartbeat_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_heartbeat_timeout);
+  }
+
+  if (m_listening) {
+    m_ss->RemoveReadDescriptor(&m_listen_socket);
+  }
+  m_listen_socket.Close();
+
+  m_connections.Clear();
+  m_heartbeat->DeRef();
+}
+
+bool MasterWorker::Listen(const IPV4SocketAddress &address, bool reuse_port) {
+  if (!m_listen_socket.Listen(address, m_options.listen_backlog,
+                              reuse_port)) {
+    return false;
+  }
+  m_ss->AddReadDescriptor(&m_listen_socket);
+  m_listening = true;
+  return true;
+}
+
+void MasterWorker::StatusChanged() {
+  m_ss->Execute(NewSingleCallback(this, &MasterWorker::UpdateClients));
+}
+
+void MasterWorker::Broadcast(SharedBuffer *message) {
+  message->Ref();
+  m_ss->Execute(NewSingleCallback(this, &MasterWorker::BroadcastAndRelease,
+                                  message));
+}
+
+unsigned int MasterWorker::ConnectionCount() const {
+  return __sync_fetch_and_add(&m_connection_count, 0);
+}
+
+void MasterWorker::OnTCPConnect(TCPSocket *socket) {
+  OLA_INFO << "New connection: " << socket;
+  ClientConnection *connection = new ClientConnection(
+      m_ss, socket, m_options.max_queued_bytes);
+  connection->SetOnClose(
+      NewSingleCallback(this, &MasterWorker::ConnectionClosed, connection));
+  m_connections.Add(connection);
+  __sync_add_and_fetch(&m_connection_count, 1);
+  SendStatus(connection);
+}
+
+void MasterWorker::ConnectionClosed(ClientConnection *connection) {
+  OLA_INFO << "Connection @ " << connection << " was closed";
+  if (m_connections.Remove(connection)) {
+    __sync_sub_and_fetch(&m_connection_count, 1);
+  }
+}
+
+SharedBuffer *MasterWorker::NewStatusMessage() const {
+  StatusMessage status;
+  m_status->Get(&status.is_master, &status.term);
+  return status.Pack();
+}
+
+void MasterWorker::SendStatus(ClientConnection *connection) {
+  SharedBuffer *message = NewStatusMessage();
+  bool ok = connection->Send(message);
+  message->DeRef();
+  if (!ok) {
+    ConnectionClosed(connection);
+  }
+}
+
+void MasterWorker::UpdateClients() {
+  OLA_INFO << "Sending status to " << m_connections.Size() << " clients";
+  // The message is encoded once and shared between all the connections.
+  SharedBuffer *message = NewStatusMessage();
+  SendToAll(message);
+  message->DeRef();
+}
+
+void MasterWorker::SendToAll(SharedBuffer *message) {
+  vector<ClientConnection*> failed_connections;
+  ConnectionTable::const_iterator iter = m_connections.begin();
+  for (; iter != m_connections.end(); ++iter) {
+    if (!(*iter)->Send(message)) {
+      failed_connections.push_back(*iter);
+    }
+  }
+
+  vector<ClientConnection*>::iterator failed_iter =
+      failed_connections.begin();
+  for (; failed_iter != failed_connections.end(); ++failed_iter) {
+    ConnectionClosed(*failed_iter);
+  }
+}
+
+void MasterWorker::BroadcastAndRelease(SharedBuffer *message) {
+  SendToAll(message);
+  message->DeRef();
+}
+
+bool MasterWorker::KeepaliveTimeout() {
+  UpdateClients();
+  return true;
+}
+
+bool MasterWorker::HeartbeatTimeout() {
+  SendToAll(m_heartbeat);
+  return true;
+}
+
+// MasterWorkerThread
+// ----------------------------------------------------------------------------
+MasterWorkerThread::MasterWorkerThread(const PublishedStatus *status,
+                                       const MasterWorker::Options &options)
+    : ola::thread::Thread(ola::thread::Thread::Options("master-worker")),
+      m_worker(&m_ss, status, options) {
+}
+
+/*
+ * The thread has exited by now, so anything still queued with Execute() can
+ * be run from this thread.
+ */
+MasterWorkerThread::~MasterWorkerThread() {
+  m_ss.DrainCallbacks();
+}
+
+void MasterWorkerThread::Stop() {
+  m_ss.Terminate();
+  Join();
+}
+
+void *MasterWorkerThread::Run() {
+  m_ss.Run();
+  return NULL;
+}
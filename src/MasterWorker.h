@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * MasterWorker.h
+ * Accepts client connections and sends them the master's status.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_MASTERWORKER_H_
+#define SRC_MASTERWORKER_H_
+
+#include <stdint.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/network/TCPSocket.h>
+#include <ola/network/TCPSocketFactory.h>
+#include <ola/thread/Thread.h>
+
+#include "src/AcceptingSocket.h"
+#include "src/ClientConnection.h"
+#include "src/ConnectionTable.h"
+#include "src/SharedBuffer.h"
+
+/**
+ * @brief The mastership status, written by the MasterServer and read by
+ * workers on other threads without locking.
+ */
+class PublishedStatus {
+ public:
+  PublishedStatus() : m_value(0) {}
+
+  void Set(bool is_master, uint32_t term);
+  void Get(bool *is_master, uint32_t *term) const;
+
+ private:
+  // The term in the upper 32 bits, is_master in the lowest bit.
+  mutable uint64_t m_value;
+
+  DISALLOW_COPY_AND_ASSIGN(PublishedStatus);
+};
+
+/**
+ * @brief Handles a share of the master's client connections.
+ *
+ * Each worker has its own listening socket and its own connections, and runs
+ * entirely on one SelectServer. With a single worker this is the same
+ * SelectServer as the MasterServer, with more than one each worker runs in
+ * its own MasterWorkerThread.
+ */
+class MasterWorker {
+ public:
+  struct Options {
+    Options()
+        : keepalive_interval(1000),
+          heartbeat_interval(100),
+          max_queued_bytes(64 * 1024),
+          listen_backlog(128),
+          expected_connections(0) {
+    }
+
+    unsigned int keepalive_interval;
+    unsigned int heartbeat_interval;
+    unsigned int max_queued_bytes;
+    unsigned int listen_backlog;
+    unsigned int expected_connections;
+  };
+
+  /**
+   * @brief Create a new MasterWorker.
+   * @param ss The SelectServer to run on.
+   * @param status The status to send to clients, not owned.
+   * @param options The options for the worker.
+   */
+  MasterWorker(ola::io::SelectServerInterface *ss,
+               const PublishedStatus *status,
+               const Options &options);
+  ~MasterWorker();
+
+  /**
+   * @brief Start listening.
+   *
+   * This must be called before the SelectServer is running.
+   */
+  bool Listen(const ola::network::IPV4SocketAddress &address,
+              bool reuse_port);
+
+  ola::network::IPV4SocketAddress ListenAddress() const {
+    return m_listen_socket.LocalAddress();
+  }
+
+  /**
+   * @brief Tell the worker the published status has changed.
+   *
+   * This may be called from any thread.
+   */
+  void StatusChanged();
+
+  /**
+   * @brief Send a message to every client.
+   *
+   * This may be called from any thread. The worker takes its own reference
+   * to the message.
+   */
+  void Broadcast(SharedBuffer *message);
+
+  /**
+   * @brief The number of connected clients, this may be called from any
+   * thread.
+   */
+  unsigned int ConnectionCount() const;
+
+ private:
+  ola::io::SelectServerInterface *m_ss;
+  const PublishedStatus *m_status;
+  const Options m_options;
+
+  ola::network::TCPSocketFactory m_tcp_socket_factory;
+  AcceptingSocket m_listen_socket;
+  bool m_listening;
+  ConnectionTable m_connections;
+  mutable unsigned int m_connection_count;
+  ola::thread::timeout_id m_keepalive_timeout;
+  ola::thread::timeout_id m_heartbeat_timeout;
+  SharedBuffer *m_heartbeat;
+
+  void OnTCPConnect(ola::network::TCPSocket *socket);
+  void ConnectionClosed(ClientConnection *connection);
+  SharedBuffer *NewStatusMessage() const;
+  void SendStatus(ClientConnection *connection);
+  void UpdateClients();
+  void SendToAll(SharedBuffer *message);
+  void BroadcastAndRelease(SharedBuffer *message);
+  bool KeepaliveTimeout();
+  bool HeartbeatTimeout();
+
+  DISALLOW_COPY_AND_ASSIGN(MasterWorker);
+};
+
+/**
+ * @brief Runs a MasterWorker on its own SelectServer and thread.
+ */
+class MasterWorkerThread : public ola::thread::Thread {
+ public:
+  MasterWorkerThread(const PublishedStatus *status,
+                     const MasterWorker::Options &options);
+  ~MasterWorkerThread();
+
+  MasterWorker *Worker() { return &m_worker; }
+
+  /**
+   * @brief Stop the thread and wait for it to exit.
+   */
+  void Stop();
+
+ protected:
+  void *Run();
+
+ private:
+  ola::io::SelectServer m_ss;
+  MasterWorker m_worker;
+
+  DISALLOW_COPY_AND_ASSIGN(MasterWorkerThread);
+};
+#endif  // SRC_MASTERWORKER_H_
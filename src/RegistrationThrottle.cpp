@@ -0,0 +1,134 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * RegistrationThrottle.cpp
+ * Coalesces and rate limits updates to the DNS-SD registrations.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/RegistrationThrottle.h"
+
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+
+#include <algorithm>
+#include <utility>
+
+using ola::NewSingleCallback;
+using ola::network::IPV4SocketAddress;
+using ola::thread::MutexLocker;
+
+RegistrationThrottle::RegistrationThrottle(ola::io::SelectServerInterface *ss,
+                                           ApplyCallback *callback,
+                                           const Options &options)
+    : m_ss(ss),
+      m_callback(callback),
+      m_options(options),
+      m_flush_scheduled(false),
+      m_stopped(false),
+      m_tokens(std::max(options.burst, 1u)),
+      m_timeout(ola::thread::INVALID_TIMEOUT) {
+  m_clock.CurrentTime(&m_last_refill);
+}
+
+void RegistrationThrottle::Update(const MasterEntry &entry) {
+  MutexLocker lock(&m_mutex);
+  m_counters.requested++;
+  std::pair<PendingMap::iterator, bool> p = m_pending.insert(
+      PendingMap::value_type(entry.address, entry));
+  if (!p.second) {
+    p.first->second = entry;
+    m_counters.coalesced++;
+  }
+
+  if (!m_flush_scheduled && !m_stopped) {
+    m_flush_scheduled = true;
+    m_ss->Execute(NewSingleCallback(this, &RegistrationThrottle::Flush));
+  }
+}
+
+void RegistrationThrottle::Cancel(const IPV4SocketAddress &address) {
+  MutexLocker lock(&m_mutex);
+  m_pending.erase(address);
+}
+
+void RegistrationThrottle::Stop() {
+  if (m_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_timeout);
+    m_timeout = ola::thread::INVALID_TIMEOUT;
+  }
+
+  MutexLocker lock(&m_mutex);
+  m_stopped = true;
+  m_pending.clear();
+  OLA_INFO << "Registration updates: " << m_counters.requested
+           << " requested, " << m_counters.applied << " applied, "
+           << m_counters.coalesced << " coalesced, " << m_counters.throttled
+           << " throttled";
+}
+
+RegistrationThrottle::Counters RegistrationThrottle::GetCounters() const {
+  MutexLocker lock(&m_mutex);
+  return m_counters;
+}
+
+/*
+ * The callback is run without the lock held, so it can call back into
+ * Update().
+ */
+void RegistrationThrottle::Flush() {
+  m_timeout = ola::thread::INVALID_TIMEOUT;
+  RefillTokens();
+
+  while (true) {
+    MasterEntry entry;
+    {
+      MutexLocker lock(&m_mutex);
+      if (m_stopped || m_pending.empty()) {
+        m_flush_scheduled = false;
+        return;
+      }
+      if (m_options.rate && m_tokens < 1.0) {
+        m_counters.throttled++;
+        break;
+      }
+      entry = m_pending.begin()->second;
+      m_pending.erase(m_pending.begin());
+      m_counters.applied++;
+    }
+
+    if (m_options.rate) {
+      m_tokens -= 1.0;
+    }
+    m_callback->Run(entry);
+  }
+
+  // Wait for the next token, m_flush_scheduled stays set until then.
+  const unsigned int delay = std::max(
+      1u, static_cast<unsigned int>((1.0 - m_tokens) * 1000 / m_options.rate));
+  m_timeout = m_ss->RegisterSingleTimeout(
+      delay, NewSingleCallback(this, &RegistrationThrottle::Flush));
+}
+
+void RegistrationThrottle::RefillTokens() {
+  ola::TimeStamp now;
+  m_clock.CurrentTime(&now);
+  // AsInt() is in microseconds.
+  const double elapsed = (now - m_last_refill).AsInt() / 1000000.0;
+  m_last_refill = now;
+  m_tokens = std::min(static_cast<double>(std::max(m_options.burst, 1u)),
+                      m_tokens + elapsed * m_options.rate);
+}
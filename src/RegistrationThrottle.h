@@ -0,0 +1,128 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * RegistrationThrottle.h
+ * Coalesces and rate limits updates to the DNS-SD registrations.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_REGISTRATIONTHROTTLE_H_
+#define SRC_REGISTRATIONTHROTTLE_H_
+
+#include <stdint.h>
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/base/Macro.h>
+#include <ola/io/SelectServerInterface.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/thread/Mutex.h>
+#include <map>
+#include <memory>
+
+#include "src/MasterEntry.h"
+
+/**
+ * @brief Sits between RegisterMaster() and the DNS-SD thread.
+ *
+ * Each registration update is a multicast announcement, so a master whose
+ * priority changes rapidly could flood the network. Updates are queued per
+ * registration, keyed by address, and a newer update replaces one that
+ * hasn't been applied yet. The queued updates are applied on the
+ * SelectServer's thread, at most burst back to back and rate per second
+ * after that.
+ */
+class RegistrationThrottle {
+ public:
+  struct Options {
+    Options() : rate(10), burst(5) {}
+
+    /** @brief The sustained number of updates per second, 0 for no limit. */
+    unsigned int rate;
+    /** @brief The number of updates that can be applied back to back. */
+    unsigned int burst;
+  };
+
+  struct Counters {
+    Counters() : requested(0), applied(0), coalesced(0), throttled(0) {}
+
+    uint64_t requested;
+    uint64_t applied;
+    /** @brief Updates that were replaced before they were applied. */
+    uint64_t coalesced;
+    /** @brief The number of times the updates had to wait for a token. */
+    uint64_t throttled;
+  };
+
+  typedef ola::Callback1<void, MasterEntry> ApplyCallback;
+
+  /**
+   * @brief Create a new RegistrationThrottle.
+   * @param ss The SelectServer to apply the updates on.
+   * @param callback Applies an update, ownership is transferred.
+   * @param options The limits.
+   */
+  RegistrationThrottle(ola::io::SelectServerInterface *ss,
+                       ApplyCallback *callback,
+                       const Options &options);
+  ~RegistrationThrottle() {}
+
+  /**
+   * @brief Queue an update. This may be called from any thread.
+   */
+  void Update(const MasterEntry &entry);
+
+  /**
+   * @brief Drop any queued update for a registration. This may be called
+   * from any thread.
+   */
+  void Cancel(const ola::network::IPV4SocketAddress &address);
+
+  /**
+   * @brief Drop the queued updates and stop applying them. This must be
+   * called on the SelectServer's thread before it exits.
+   */
+  void Stop();
+
+  /**
+   * @brief This may be called from any thread.
+   */
+  Counters GetCounters() const;
+
+ private:
+  typedef std::map<ola::network::IPV4SocketAddress, MasterEntry> PendingMap;
+
+  ola::io::SelectServerInterface *m_ss;
+  std::auto_ptr<ApplyCallback> m_callback;
+  const Options m_options;
+
+  mutable ola::thread::Mutex m_mutex;
+  // These are protected by m_mutex.
+  PendingMap m_pending;
+  bool m_flush_scheduled;
+  bool m_stopped;
+  Counters m_counters;
+
+  // These are only used on the SelectServer's thread.
+  ola::Clock m_clock;
+  double m_tokens;
+  ola::TimeStamp m_last_refill;
+  ola::thread::timeout_id m_timeout;
+
+  void Flush();
+  void RefillTokens();
+
+  DISALLOW_COPY_AND_ASSIGN(RegistrationThrottle);
+};
+#endif  // SRC_REGISTRATIONTHROTTLE_H_
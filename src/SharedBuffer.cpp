@@ -0,0 +1,48 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * SharedBuffer.cpp
+ * An immutable, reference counted block of data.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/SharedBuffer.h"
+
+#include <string.h>
+
+SharedBuffer* SharedBuffer::New(const uint8_t *data, unsigned int length) {
+  return new SharedBuffer(data, length);
+}
+
+void SharedBuffer::Ref() {
+  __sync_add_and_fetch(&m_ref_count, 1);
+}
+
+void SharedBuffer::DeRef() {
+  if (__sync_sub_and_fetch(&m_ref_count, 1) == 0) {
+    delete this;
+  }
+}
+
+SharedBuffer::SharedBuffer(const uint8_t *data, unsigned int length)
+    : m_data(new uint8_t[length]),
+      m_length(length),
+      m_ref_count(1) {
+  memcpy(m_data, data, length);
+}
+
+SharedBuffer::~SharedBuffer() {
+  delete[] m_data;
+}
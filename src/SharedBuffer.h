@@ -0,0 +1,64 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * SharedBuffer.h
+ * An immutable, reference counted block of data.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_SHAREDBUFFER_H_
+#define SRC_SHAREDBUFFER_H_
+
+#include <stdint.h>
+#include <ola/base/Macro.h>
+
+/**
+ * @brief An immutable, reference counted block of data.
+ *
+ * This allows a message to be encoded once and then queued on many
+ * connections. The reference count is updated atomically so buffers can be
+ * shared between threads.
+ *
+ * New() returns a buffer with a reference count of 1, each call to Ref() must
+ * be matched with a call to DeRef().
+ */
+class SharedBuffer {
+ public:
+  /**
+   * @brief Create a new buffer holding a copy of the data.
+   */
+  static SharedBuffer* New(const uint8_t *data, unsigned int length);
+
+  void Ref();
+
+  /**
+   * @brief Drop a reference, the buffer is deleted once the count is 0.
+   */
+  void DeRef();
+
+  const uint8_t *Data() const { return m_data; }
+  unsigned int Size() const { return m_length; }
+
+ private:
+  uint8_t *m_data;
+  const unsigned int m_length;
+  unsigned int m_ref_count;
+
+  SharedBuffer(const uint8_t *data, unsigned int length);
+  ~SharedBuffer();
+
+  DISALLOW_COPY_AND_ASSIGN(SharedBuffer);
+};
+#endif  // SRC_SHAREDBUFFER_H_
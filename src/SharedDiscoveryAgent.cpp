@@ -0,0 +1,246 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * SharedDiscoveryAgent.cpp
+ * Lets many clients share a single DNS-SD browse.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include "src/SharedDiscoveryAgent.h"
+
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/network/SocketAddress.h>
+
+#include <map>
+#include <memory>
+#include <string>
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::TimeInterval;
+using ola::network::IPV4SocketAddress;
+using ola::thread::MutexLocker;
+using std::auto_ptr;
+using std::string;
+
+// DiscoveryHub
+// ----------------------------------------------------------------------------
+DiscoveryHub::DiscoveryHub(DiscoveryAgentFactory *factory,
+                           const string &scope,
+                           const string &browse_domain)
+    : m_factory(factory),
+      m_scope(scope),
+      m_browse_domain(browse_domain),
+      m_next_subscriber_id(1),
+      m_browse_complete(false) {
+}
+
+DiscoveryHub::~DiscoveryHub() {
+  Stop();
+  if (!m_subscribers.empty()) {
+    OLA_WARN << m_subscribers.size() << " agents still attached to the hub";
+  }
+}
+
+bool DiscoveryHub::Start() {
+  if (m_agent.get()) {
+    return true;
+  }
+
+  DiscoveryAgentFactory default_factory;
+  DiscoveryAgentFactory *factory = m_factory ? m_factory : &default_factory;
+  DiscoveryAgentInterface::Options options;
+  options.scope = m_scope;
+  options.browse_domain = m_browse_domain;
+  options.master_callback = NewCallback(this, &DiscoveryHub::MasterChanged);
+  options.initial_browse_timeout = TimeInterval(
+      BROWSE_TIMEOUT_MS / 1000, (BROWSE_TIMEOUT_MS % 1000) * 1000);
+  options.browse_complete_callback = NewSingleCallback(
+      this, &DiscoveryHub::BrowseComplete);
+  auto_ptr<DiscoveryAgentInterface> agent(factory->New(options));
+
+  if (!agent.get() || !agent->Start()) {
+    return false;
+  }
+  m_agent.reset(agent.release());
+  return true;
+}
+
+void DiscoveryHub::Stop() {
+  if (m_agent.get()) {
+    m_agent->Stop();
+    m_agent.reset();
+  }
+  MutexLocker lock(&m_mu);
+  m_masters.clear();
+  m_browse_complete = false;
+}
+
+unsigned int DiscoveryHub::AddSubscriber(
+    DiscoveryAgentInterface::MasterEventCallback *callback,
+    BrowseGate *gate) {
+  MutexLocker lock(&m_mu);
+  unsigned int subscriber_id = m_next_subscriber_id++;
+  m_subscribers[subscriber_id] = callback;
+
+  MasterMap::const_iterator iter = m_masters.begin();
+  for (; iter != m_masters.end(); ++iter) {
+    callback->Run(DiscoveryAgentInterface::MASTER_ADDED, iter->second);
+  }
+
+  if (gate) {
+    if (m_browse_complete) {
+      gate->Open();
+    } else {
+      m_waiting_gates[subscriber_id] = gate;
+    }
+  }
+  return subscriber_id;
+}
+
+void DiscoveryHub::RemoveSubscriber(unsigned int subscriber_id) {
+  MutexLocker lock(&m_mu);
+  m_subscribers.erase(subscriber_id);
+  m_waiting_gates.erase(subscriber_id);
+}
+
+void DiscoveryHub::RegisterMaster(const MasterEntry &master) {
+  if (m_agent.get()) {
+    m_agent->RegisterMaster(master);
+  }
+}
+
+void DiscoveryHub::DeRegisterMaster(const IPV4SocketAddress &address) {
+  if (m_agent.get()) {
+    m_agent->DeRegisterMaster(address);
+  }
+}
+
+/*
+ * Runs from Start(). If the browse timed out the waiting subscribers are left
+ * to time out as well, rather than being told the browse completed.
+ */
+void DiscoveryHub::BrowseComplete(bool complete, TimeInterval duration) {
+  if (!complete) {
+    OLA_WARN << "Hub's initial browse timed out after " << duration;
+    return;
+  }
+
+  MutexLocker lock(&m_mu);
+  m_browse_complete = true;
+  GateMap::iterator iter = m_waiting_gates.begin();
+  for (; iter != m_waiting_gates.end(); ++iter) {
+    iter->second->Open();
+  }
+  m_waiting_gates.clear();
+}
+
+/*
+ * Runs on the DNS-SD thread.
+ */
+void DiscoveryHub::MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                                 const MasterEntry &entry) {
+  MutexLocker lock(&m_mu);
+  if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
+    m_masters.erase(entry.service_name);
+  } else {
+    m_masters[entry.service_name] = entry;
+  }
+
+  SubscriberMap::const_iterator iter = m_subscribers.begin();
+  for (; iter != m_subscribers.end(); ++iter) {
+    iter->second->Run(event, entry);
+  }
+}
+
+// SharedDiscoveryAgent
+// ----------------------------------------------------------------------------
+SharedDiscoveryAgent::SharedDiscoveryAgent(DiscoveryHub *hub,
+                                           const Options &options)
+    : m_hub(hub),
+      m_scope(options.scope),
+      m_browse_domain(options.browse_domain),
+      m_master_callback(options.master_callback),
+      m_subscriber_id(0),
+      m_running(false),
+      m_browse_gate(options.initial_browse_timeout,
+                    options.browse_complete_callback) {
+}
+
+SharedDiscoveryAgent::~SharedDiscoveryAgent() {
+  Stop();
+}
+
+bool SharedDiscoveryAgent::Start() {
+  if (m_running) {
+    return true;
+  }
+  if (m_scope != m_hub->Scope()) {
+    OLA_WARN << "Scope " << m_scope << " doesn't match the hub's scope of "
+             << m_hub->Scope();
+    return false;
+  }
+  if (m_browse_domain != m_hub->BrowseDomain()) {
+    OLA_WARN << "Browse domain " << m_browse_domain
+             << " doesn't match the hub's domain of " << m_hub->BrowseDomain();
+    return false;
+  }
+  m_browse_gate.Reset();
+  if (m_master_callback.get()) {
+    // The hub sends us the masters it knows about, and opens the gate once
+    // its first browse has completed.
+    m_subscriber_id = m_hub->AddSubscriber(m_master_callback.get(),
+                                           &m_browse_gate);
+  } else {
+    m_browse_gate.Open();
+  }
+  m_running = true;
+  m_browse_gate.Wait();
+  return true;
+}
+
+bool SharedDiscoveryAgent::Stop() {
+  if (m_running) {
+    if (m_subscriber_id) {
+      m_hub->RemoveSubscriber(m_subscriber_id);
+      m_subscriber_id = 0;
+    }
+    m_running = false;
+  }
+  return true;
+}
+
+void SharedDiscoveryAgent::RegisterMaster(const MasterEntry &master) {
+  if (!m_running) {
+    OLA_WARN << "Agent not running, can't register " << master;
+    return;
+  }
+  m_hub->RegisterMaster(master);
+}
+
+void SharedDiscoveryAgent::DeRegisterMaster(
+    const IPV4SocketAddress &master_address) {
+  if (m_running) {
+    m_hub->DeRegisterMaster(master_address);
+  }
+}
+
+// SharedAgentFactory
+// ----------------------------------------------------------------------------
+DiscoveryAgentInterface* SharedAgentFactory::New(
+    const DiscoveryAgentInterface::Options &options) {
+  return new SharedDiscoveryAgent(m_hub, options);
+}
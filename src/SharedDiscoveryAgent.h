@@ -0,0 +1,153 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * SharedDiscoveryAgent.h
+ * Lets many clients share a single DNS-SD browse.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#ifndef SRC_SHAREDDISCOVERYAGENT_H_
+#define SRC_SHAREDDISCOVERYAGENT_H_
+
+#include <ola/base/Macro.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/thread/Mutex.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "src/BrowseGate.h"
+#include "src/DiscoveryAgent.h"
+#include "src/MasterEntry.h"
+
+class SharedDiscoveryAgent;
+
+/**
+ * @brief Runs one DiscoveryAgent and passes its events on to many
+ * subscribers.
+ *
+ * The known masters are cached, so a subscriber that starts late is sent the
+ * current masters, as if it had done its own browse. Start() waits for the
+ * first browse, and subscribers that attach before it has completed are held
+ * until it does. Subscriber callbacks
+ * are run on the DNS-SD thread, with an internal lock held, so they must not
+ * block or call back into the hub.
+ */
+class DiscoveryHub {
+ public:
+  /**
+   * @brief Create a new hub.
+   * @param factory The factory to create the real agent with. If NULL the
+   *   platform's DNS-SD implementation is used. Not owned.
+   * @param scope The scope to browse.
+   * @param browse_domain The DNS-SD domain to browse, empty for the default.
+   */
+  DiscoveryHub(DiscoveryAgentFactory *factory, const std::string &scope,
+               const std::string &browse_domain);
+  ~DiscoveryHub();
+
+  bool Start();
+  void Stop();
+
+  const std::string &Scope() const { return m_scope; }
+  const std::string &BrowseDomain() const { return m_browse_domain; }
+
+  // These are called by SharedDiscoveryAgent and are thread safe. The
+  // callback and gate aren't owned. The gate, which may be NULL, is opened
+  // once the hub's first browse has completed.
+  unsigned int AddSubscriber(
+      DiscoveryAgentInterface::MasterEventCallback *callback,
+      BrowseGate *gate);
+  void RemoveSubscriber(unsigned int subscriber_id);
+
+  void RegisterMaster(const MasterEntry &master);
+  void DeRegisterMaster(const ola::network::IPV4SocketAddress &address);
+
+ private:
+  typedef std::map<unsigned int,
+                   DiscoveryAgentInterface::MasterEventCallback*>
+      SubscriberMap;
+  typedef std::map<std::string, MasterEntry> MasterMap;
+  typedef std::map<unsigned int, BrowseGate*> GateMap;
+
+  DiscoveryAgentFactory *m_factory;
+  const std::string m_scope;
+  const std::string m_browse_domain;
+  std::auto_ptr<DiscoveryAgentInterface> m_agent;
+
+  // Protected by m_mu
+  ola::thread::Mutex m_mu;
+  unsigned int m_next_subscriber_id;
+  SubscriberMap m_subscribers;
+  MasterMap m_masters;
+  bool m_browse_complete;
+  GateMap m_waiting_gates;
+
+  void BrowseComplete(bool complete, ola::TimeInterval duration);
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry);
+
+  static const unsigned int BROWSE_TIMEOUT_MS = 2000;
+
+  DISALLOW_COPY_AND_ASSIGN(DiscoveryHub);
+};
+
+/**
+ * @brief An implementation of DiscoveryAgentInterface backed by a
+ * DiscoveryHub.
+ */
+class SharedDiscoveryAgent : public DiscoveryAgentInterface {
+ public:
+  SharedDiscoveryAgent(DiscoveryHub *hub, const Options &options);
+  ~SharedDiscoveryAgent();
+
+  bool Start();
+
+  bool Stop();
+
+  void RegisterMaster(const MasterEntry &master);
+
+  void DeRegisterMaster(const ola::network::IPV4SocketAddress &master_address);
+
+ private:
+  DiscoveryHub *m_hub;
+  const std::string m_scope;
+  const std::string m_browse_domain;
+  std::auto_ptr<MasterEventCallback> m_master_callback;
+  unsigned int m_subscriber_id;
+  bool m_running;
+  BrowseGate m_browse_gate;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedDiscoveryAgent);
+};
+
+/**
+ * @brief A DiscoveryAgentFactory that produces SharedDiscoveryAgents.
+ */
+class SharedAgentFactory : public DiscoveryAgentFactory {
+ public:
+  explicit SharedAgentFactory(DiscoveryHub *hub)
+      : m_hub(hub) {
+  }
+
+  DiscoveryAgentInterface* New(
+      const DiscoveryAgentInterface::Options &options);
+
+ private:
+  DiscoveryHub *m_hub;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedAgentFactory);
+};
+#endif  // SRC_SHAREDDISCOVERYAGENT_H_
@@ -8,38 +8,76 @@
 #include <ola/base/SysExits.h>
 #include <ola/io/SelectServer.h>
 #include <ola/io/StdinHandler.h>
-#include <ola/network/AdvancedTCPConnector.h>
-#include <ola/network/TCPSocketFactory.h>
-#include <ola/strings/Format.h>
-
-
+#include <ola/network/IPV4Address.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/stl/STLUtils.h>
+#include <ola/thread/Mutex.h>
+#include <ola/thread/Thread.h>
+
+#include <iostream>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
-#include "DiscoveryAgent.h"
-#include "MasterEntry.h"
+#include "src/MasterClient.h"
+#include "src/MasterTableAgent.h"
+#include "src/SharedDiscoveryAgent.h"
 
 DEFINE_string(scope, "default", "The scope to use.");
+DEFINE_string(browse_domain, "",
+              "The DNS-SD domain to browse for masters, empty uses the "
+              "system default.");
 DEFINE_uint16(tcp_connect_timeout, 5,
               "The time in seconds for the TCP connect");
-DEFINE_uint16(tcp_retry_interval, 5,
-              "The time in seconds before retring the TCP connection");
+DEFINE_uint16(tcp_retry_interval, 30,
+              "The maximum time in seconds between TCP connection attempts");
+DEFINE_uint32(tcp_min_retry_interval, 500,
+              "The minimum time in ms between TCP connection attempts");
+DEFINE_uint32(tcp_fast_retry, 100,
+              "The maximum time in ms before the first retry after a TCP "
+              "connection is lost, 0 to disable.");
+DEFINE_uint32(failure_check_interval, 50,
+              "How often to check for failed masters in ms, 0 to disable.");
+DEFINE_uint16(failure_threshold, 8,
+              "The phi value at which a master is considered failed.");
+DEFINE_uint16(standby_masters, 2,
+              "The number of masters, other than the elected one, to stay "
+              "connected to.");
+DEFINE_string(multicast_group, "",
+              "The multicast group to listen for status announcements on.");
+DEFINE_uint16(multicast_port, 5570,
+              "The port to listen for status announcements on.");
+DEFINE_uint32(virtual_clients, 0,
+              "Run this many clients in one process, sharing a single "
+              "DNS-SD browse, and print aggregate stats. 0 runs a single "
+              "interactive client.");
+DEFINE_uint16(io_threads, 4,
+              "The number of threads to run the virtual clients on.");
+DEFINE_uint32(stats_interval, 0,
+              "How often to print the convergence stats as JSON in seconds, "
+              "0 to disable.");
+DEFINE_default_bool(sharded, false,
+                    "Spread the clients over all the masters with a "
+                    "consistent hash, rather than using the elected master.");
+DEFINE_string(shard_key, "",
+              "The key that picks the master in sharded mode, defaults to "
+              "the host name and pid.");
+DEFINE_string(master_table, "",
+              "Read the masters from this shared memory table, written by "
+              "table_publisher, rather than browsing with DNS-SD.");
 
 using ola::NewCallback;
-using ola::NewSingleCallback;
 using ola::io::SelectServer;
 using ola::io::StdinHandler;
 using ola::network::IPV4Address;
-using ola::network::GenericSocketAddress;
 using ola::network::IPV4SocketAddress;
-using ola::network::TCPSocket;
-using ola::strings::ToHex;
+using ola::thread::MutexLocker;
 using ola::TimeInterval;
 using std::auto_ptr;
 using std::cout;
 using std::endl;
-using std::set;
+using std::map;
 using std::vector;
 
 ola::TimeStamp GetTime() {
@@ -49,32 +87,23 @@ ola::TimeStamp GetTime() {
   return now;
 }
 
-#define LOG_INFO OLA_INFO << GetTime() << " : "
-
 class Client {
  public:
-  Client()
+  explicit Client(const MasterClient::Options &options)
       : m_stdin_handler(&m_ss,
                         ola::NewCallback(this, &Client::Input)),
-        m_tcp_socket_factory(NewCallback(this, &Client::OnTCPConnect)),
-        m_connector(&m_ss, &m_tcp_socket_factory,
-                    TimeInterval(FLAGS_tcp_connect_timeout, 0)),
-        m_backoff_policy(TimeInterval(FLAGS_tcp_retry_interval, 0)) {
+        m_client(&m_ss, options) {
   }
 
   bool Init() {
-    // Start the agent.
-    DiscoveryAgentFactory factory;
-    DiscoveryAgentInterface::Options options;
-    options.scope = FLAGS_scope.str();
-    options.master_callback = NewCallback(this, &Client::MasterChanged);
-    auto_ptr<DiscoveryAgentInterface> agent(factory.New(options));
-
-    if (!agent->Start()) {
+    if (!m_client.Init()) {
       return false;
     }
-
-    m_discovery_agent.reset(agent.release());
+    if (FLAGS_stats_interval) {
+      m_ss.RegisterRepeatingTimeout(
+          FLAGS_stats_interval * 1000,
+          NewCallback(this, &Client::DumpStats));
+    }
     return true;
   }
 
@@ -86,20 +115,16 @@ class Client {
     m_ss.Run();
   }
 
-  // This is called within the Discovery thread.
-  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
-                     const MasterEntry &entry) {
-    m_ss.Execute(NewSingleCallback(this, &Client::MasterEvent,
-                 event, entry));
-  }
-
   void Input(int c) {
     switch (c) {
       case 'h':
         ShowHelp();
         break;
       case 'm':
-        DumpMasterState();
+        m_client.DumpMasterState(&cout);
+        break;
+      case 's':
+        m_client.GetStats().Print(&cout);
         break;
       case 't':
         cout << "Time: " << GetTime() << endl;
@@ -113,222 +138,331 @@ class Client {
   }
 
  private:
-  struct Master {
-    std::string name;
-    ola::network::IPV4SocketAddress address;
-    uint8_t priority;
-    TCPSocket *socket;
-  };
-
-  std::vector<Master> m_masters;
   ola::io::SelectServer m_ss;
   ola::io::StdinHandler m_stdin_handler;
+  MasterClient m_client;
 
-  // Accessed by the discovery thread.
-  std::auto_ptr<DiscoveryAgentInterface> m_discovery_agent;
-  ola::network::TCPSocketFactory m_tcp_socket_factory;
-  ola::network::AdvancedTCPConnector  m_connector;
-  ola::ConstantBackoffPolicy m_backoff_policy;
-
-  IPV4SocketAddress m_reported_master;
-
-  void MasterEvent(DiscoveryAgentInterface::MasterEvent event,
-                   MasterEntry entry) {
-    UpdateMasterList(event, entry);
-
-    uint8_t priority = 0;
-    Master *preferred_master = NULL;
-    vector<Master>::iterator iter = m_masters.begin();
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->priority > priority &&
-          iter->address.Host() != IPV4Address::WildCard()) {
-        preferred_master = &(*iter);
-        priority = iter->priority;
-      }
-    }
-    if (preferred_master) {
-      if (preferred_master->address != m_reported_master) {
-        LOG_INFO << "MASTER MISMATCH, picked " << preferred_master->address
-                 << ", but reported was " << m_reported_master;
-      }
-    } else {
-      if (m_reported_master != IPV4SocketAddress()) {
-        LOG_INFO << "MASTER MISMATCH, failed to find master but reported was "
-                 << m_reported_master;
-      }
-    }
+  void ShowHelp() {
+    cout << "--------------" << endl;
+    cout << "h - Show Help" << endl;
+    cout << "m - Dump Master State" << endl;
+    cout << "s - Dump Convergence Stats" << endl;
+    cout << "t - Print timestamp" << endl;
+    cout << "q - Quit" << endl;
+    cout << "--------------" << endl;
   }
 
-  void UpdateMasterList(DiscoveryAgentInterface::MasterEvent event,
-                        const MasterEntry &entry) {
-    vector<Master>::iterator iter = m_masters.begin();
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->name == entry.service_name) {
-        if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
-          CloseConnectionToMaster(&*iter);
-          iter = m_masters.erase(iter);
-        } else {
-          // Update
-          if (iter->address != entry.address) {
-            CloseConnectionToMaster(&*iter);
-            iter->priority = entry.priority;
-            iter->address = entry.address;
-            OpenConnectionToMaster(&*iter);
-          }
-        }
-        return;
-      }
-    }
-    // not in the list.
-    Master master = {
-      entry.service_name,
-      entry.address,
-      entry.priority,
-      NULL,
-    };
-    m_masters.push_back(master);
-    OpenConnectionToMaster(&m_masters.back());
-  }
-
-  void OpenConnectionToMaster(Master *master) {
-    if (master->address.Host() == IPV4Address::WildCard()) {
-      return;
-    }
-    OLA_INFO << "Opening connection to " << master->name << " "
-             << master->address;
+  bool DumpStats() {
+    cout << "{\"time\": \"" << GetTime() << "\", \"stats\": ";
+    m_client.GetStats().ToJson(&cout);
+    cout << "}" << endl;
+    return true;
+  }
+};
+
+/**
+ * @brief Runs a share of the virtual clients on its own SelectServer.
+ */
+class ClientThread : public ola::thread::Thread {
+ public:
+  struct Summary {
+    Summary() : clients(0), converged(0), state_changes(0), messages(0) {}
+
+    unsigned int clients;
+    // Clients where the reported master is also the elected master.
+    unsigned int converged;
+    uint64_t state_changes;
+    uint64_t messages;
+    MasterClient::Stats stats;
+    // The number of clients that have each master as the reported master.
+    map<IPV4SocketAddress, unsigned int> masters;
+  };
 
-    m_connector.AddEndpoint(master->address, &m_backoff_policy);
+  ClientThread()
+      : ola::thread::Thread(ola::thread::Thread::Options("client-io")),
+        m_state_changes(0) {
   }
 
-  void CloseConnectionToMaster(Master *master) {
-    if (master->address.Host() == IPV4Address::WildCard()) {
-      return;
-    }
-    OLA_INFO << "Close connection to " << master->name << " "
-             << master->address;
-    if (master->socket) {
-      m_ss.RemoveReadDescriptor(master->socket);
-      master->socket->Close();
-      delete master->socket;
-      master->socket = NULL;
-    }
+  /*
+   * The thread has been joined by now, so the clients can be deleted from
+   * this thread.
+   */
+  ~ClientThread() {
+    ola::STLDeleteElements(&m_clients);
+    m_ss.DrainCallbacks();
+  }
 
-    if (master->address != IPV4SocketAddress()) {
-      m_connector.Disconnect(master->address, true);
-      m_connector.RemoveEndpoint(master->address);
+  /**
+   * @brief Add a client, this must be called before Start().
+   */
+  bool AddClient(MasterClient::Options options) {
+    options.state_change_callback = NewCallback(this,
+                                                &ClientThread::StateChanged);
+    auto_ptr<MasterClient> client(new MasterClient(&m_ss, options));
+    if (!client->Init()) {
+      return false;
     }
+    m_clients.push_back(client.release());
+    return true;
   }
 
-  void OnTCPConnect(TCPSocket *socket) {
-    GenericSocketAddress peer_address = socket->GetPeerAddress();
-    OLA_INFO << "Opened new TCP connection to " << peer_address;
-    if (peer_address.Family() != AF_INET) {
-      OLA_WARN << "Invalid socket family";
-      socket->Close();
-      delete socket;
-      exit(ola::EXIT_UNAVAILABLE);
-    }
-    IPV4SocketAddress peer_v4 = peer_address.V4Addr();
+  void Stop() {
+    m_ss.Terminate();
+    Join();
+  }
 
-    vector<Master>::iterator iter = m_masters.begin();
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->address == peer_v4) {
-        break;
+  /**
+   * @brief Get the latest summary, this can be called from any thread.
+   */
+  Summary GetSummary() {
+    MutexLocker lock(&m_mu);
+    return m_summary;
+  }
+
+ protected:
+  void *Run() {
+    m_ss.RegisterRepeatingTimeout(
+        250, NewCallback(this, &ClientThread::UpdateSummary));
+    m_ss.Run();
+    return NULL;
+  }
+
+ private:
+  SelectServer m_ss;
+  vector<MasterClient*> m_clients;
+  uint64_t m_state_changes;
+
+  ola::thread::Mutex m_mu;
+  Summary m_summary;  // Protected by m_mu
+
+  void StateChanged() {
+    m_state_changes++;
+  }
+
+  bool UpdateSummary() {
+    Summary summary;
+    summary.clients = m_clients.size();
+    summary.state_changes = m_state_changes;
+    vector<MasterClient*>::const_iterator iter = m_clients.begin();
+    for (; iter != m_clients.end(); ++iter) {
+      summary.messages += (*iter)->MessagesReceived();
+      summary.stats.Merge((*iter)->GetStats());
+      const IPV4SocketAddress reported = (*iter)->ReportedMaster();
+      if (reported == IPV4SocketAddress()) {
+        continue;
+      }
+      summary.masters[reported]++;
+      if ((*iter)->ElectedMaster() == reported) {
+        summary.converged++;
       }
-    }
-    if (iter == m_masters.end()) {
-      OLA_WARN << "Can't find master for " << peer_v4;
-      socket->Close();
-      delete socket;
     }
 
-    if (iter->socket) {
-      OLA_WARN << "Sockets collision for " << peer_v4;
-      iter->socket->Close();
-      delete iter->socket;
-    }
-    iter->socket = socket;
+    MutexLocker lock(&m_mu);
+    m_summary = summary;
+    return true;
+  }
 
-    socket->SetOnData(
-        NewCallback(this, &Client::ReceiveTCPData, socket, peer_v4));
-    socket->SetOnClose(
-        NewSingleCallback(this, &Client::SocketClosed, peer_v4));
-    m_ss.AddReadDescriptor(socket);
+  DISALLOW_COPY_AND_ASSIGN(ClientThread);
+};
+
+/**
+ * @brief Runs many clients in one process.
+ *
+ * The clients share a single DiscoveryAgent through a DiscoveryHub, so the
+ * DNS-SD daemon only sees one browse. Each client has its own connections to
+ * the masters and tracks the master on its own.
+ */
+class LoadGenerator {
+ public:
+  explicit LoadGenerator(const MasterClient::Options &options)
+      : m_options(options),
+        m_hub(options.agent_factory, options.scope, options.browse_domain),
+        m_agent_factory(&m_hub),
+        m_last_messages(0),
+        m_converged(false),
+        m_reports(0) {
+    m_options.agent_factory = &m_agent_factory;
   }
 
-  void ReceiveTCPData(TCPSocket *socket, IPV4SocketAddress peer) {
-    uint8_t data;
-    unsigned int length;
-    if (socket->Receive(&data, sizeof(data), length)) {
-      OLA_INFO << "Failed to read from " << peer;
+  ~LoadGenerator() {
+    vector<ClientThread*>::iterator iter = m_threads.begin();
+    for (; iter != m_threads.end(); ++iter) {
+      if ((*iter)->IsRunning()) {
+        (*iter)->Stop();
+      }
     }
+    // The clients must detach from the hub before it's stopped.
+    ola::STLDeleteElements(&m_threads);
+    m_hub.Stop();
+  }
 
-    switch (data) {
-      case 'b':
-        if (m_reported_master == peer) {
-          OLA_INFO << peer << " is no longer reporting as master";
-          m_reported_master = IPV4SocketAddress();
-        }
-        break;
-      case 'm':
-        if (m_reported_master != peer) {
-          LOG_INFO << peer << " stole mastership from " << m_reported_master;
-          m_reported_master = peer;
-        }
-        break;
-      default:
-        OLA_WARN << "Unknown status " << ToHex(data) << " from " << peer;
+  bool Init();
+
+  void Stop() {
+    m_ss.Terminate();
+  }
+
+  void Run() {
+    m_ss.Run();
+  }
+
+ private:
+  MasterClient::Options m_options;
+  SelectServer m_ss;
+  DiscoveryHub m_hub;
+  SharedAgentFactory m_agent_factory;
+  vector<ClientThread*> m_threads;
+  ola::TimeStamp m_start_time;
+  ola::TimeStamp m_change_time;
+  uint64_t m_last_messages;
+  bool m_converged;
+  unsigned int m_reports;
+
+  bool Report();
+};
+
+bool LoadGenerator::Init() {
+  if (!m_hub.Start()) {
+    return false;
+  }
+
+  const unsigned int thread_count = FLAGS_io_threads ? FLAGS_io_threads : 1;
+  for (unsigned int i = 0; i < thread_count; i++) {
+    m_threads.push_back(new ClientThread());
+  }
+  for (unsigned int i = 0; i < FLAGS_virtual_clients; i++) {
+    if (!m_threads[i % thread_count]->AddClient(m_options)) {
+      OLA_WARN << "Failed to start client " << i;
+      return false;
     }
   }
 
-  void SocketClosed(IPV4SocketAddress peer) {
-    OLA_INFO << "Socket to " << peer << " was closed";
-    vector<Master>::iterator iter = m_masters.begin();
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->address == peer) {
-        iter->socket->Close();
-        delete iter->socket;
-        iter->socket = NULL;
-        m_connector.Disconnect(peer);
-      }
+  vector<ClientThread*>::iterator iter = m_threads.begin();
+  for (; iter != m_threads.end(); ++iter) {
+    if (!(*iter)->Start()) {
+      return false;
     }
   }
 
-  void DumpMasterState() {
-    vector<Master>::iterator iter = m_masters.begin();
-    cout << "--------------" << endl;
-    for (; iter != m_masters.end(); ++iter) {
-      cout << iter->name << " @ " << iter->address << ", priority "
-           << static_cast<int>(iter->priority) << ", "
-           << (iter->socket ? "connected" : " disconnected")
-           << endl;
+  m_start_time = GetTime();
+  m_change_time = m_start_time;
+  m_ss.RegisterRepeatingTimeout(
+      1000, NewCallback(this, &LoadGenerator::Report));
+  cout << "time\tconverged\tmasters\tmessages/s\tstate changes" << endl;
+  return true;
+}
+
+bool LoadGenerator::Report() {
+  ClientThread::Summary total;
+  vector<ClientThread*>::iterator iter = m_threads.begin();
+  for (; iter != m_threads.end(); ++iter) {
+    ClientThread::Summary summary = (*iter)->GetSummary();
+    total.clients += summary.clients;
+    total.converged += summary.converged;
+    total.state_changes += summary.state_changes;
+    total.messages += summary.messages;
+    total.stats.Merge(summary.stats);
+    map<IPV4SocketAddress, unsigned int>::const_iterator master_iter =
+        summary.masters.begin();
+    for (; master_iter != summary.masters.end(); ++master_iter) {
+      total.masters[master_iter->first] += master_iter->second;
     }
-    cout << "Reported Master is " << m_reported_master << endl;
-    cout << "--------------" << endl;
   }
 
-  void ShowHelp() {
-    cout << "--------------" << endl;
-    cout << "h - Show Help" << endl;
-    cout << "m - Dump Master State" << endl;
-    cout << "t - Print timestamp" << endl;
-    cout << "q - Quit" << endl;
-    cout << "--------------" << endl;
+  const ola::TimeStamp now = GetTime();
+  cout << (now - m_start_time) << "\t" << total.converged << " / "
+       << FLAGS_virtual_clients << "\t" << total.masters.size() << "\t\t"
+       << (total.messages - m_last_messages) << "\t\t"
+       << total.state_changes << endl;
+  m_last_messages = total.messages;
+
+  // Converged means every client agrees on the same master, or in sharded
+  // mode that every client is being served by the master for its shard.
+  const bool converged = total.converged == FLAGS_virtual_clients &&
+                         (FLAGS_sharded || total.masters.size() == 1);
+  if (converged && !m_converged) {
+    if (FLAGS_sharded) {
+      cout << "All clients converged on " << total.masters.size()
+           << " masters in " << (now - m_change_time) << endl;
+    } else {
+      cout << "All clients converged on " << total.masters.begin()->first
+           << " in " << (now - m_change_time) << endl;
+    }
+  } else if (!converged && m_converged) {
+    m_change_time = now;
   }
-};
+  m_converged = converged;
+
+  m_reports++;
+  if (FLAGS_stats_interval && m_reports % FLAGS_stats_interval == 0) {
+    cout << "{\"time\": \"" << now << "\", \"clients\": "
+         << total.clients << ", \"stats\": ";
+    total.stats.ToJson(&cout);
+    cout << "}" << endl;
+  }
+  return true;
+}
 
 Client *g_client = NULL;
+LoadGenerator *g_load_generator = NULL;
 
 static void InteruptSignal(OLA_UNUSED int signal) {
   if (g_client) {
     g_client->Stop();
   }
+  if (g_load_generator) {
+    g_load_generator->Stop();
+  }
 }
 
 int main(int argc, char *argv[]) {
   ola::AppInit(&argc, argv, "[options]", "Dummy Master");
 
-  Client client;
+  MasterClient::Options options;
+  options.scope = FLAGS_scope.str();
+  options.browse_domain = FLAGS_browse_domain.str();
+  options.tcp_connect_timeout = TimeInterval(FLAGS_tcp_connect_timeout, 0);
+  options.backoff_options.maximum = TimeInterval(FLAGS_tcp_retry_interval, 0);
+  options.backoff_options.initial = TimeInterval(
+      FLAGS_tcp_min_retry_interval / 1000,
+      (FLAGS_tcp_min_retry_interval % 1000) * 1000);
+  options.backoff_options.fast_retry = TimeInterval(
+      FLAGS_tcp_fast_retry / 1000, (FLAGS_tcp_fast_retry % 1000) * 1000);
+  options.failure_check_interval = TimeInterval(
+      FLAGS_failure_check_interval / 1000,
+      (FLAGS_failure_check_interval % 1000) * 1000);
+  options.detector_options.threshold = FLAGS_failure_threshold;
+  options.standby_masters = FLAGS_standby_masters;
+  if (!FLAGS_multicast_group.str().empty() &&
+      !IPV4Address::FromString(FLAGS_multicast_group,
+                               &options.multicast_group)) {
+    ola::DisplayUsage();
+    exit(ola::EXIT_USAGE);
+  }
+  options.multicast_port = FLAGS_multicast_port;
+  options.sharded = FLAGS_sharded;
+  options.shard_key = FLAGS_shard_key.str();
+
+  std::auto_ptr<MasterTableAgentFactory> table_factory;
+  if (!FLAGS_master_table.str().empty()) {
+    table_factory.reset(new MasterTableAgentFactory(FLAGS_master_table.str()));
+    options.agent_factory = table_factory.get();
+  }
+
+  if (FLAGS_virtual_clients) {
+    LoadGenerator generator(options);
+    if (!generator.Init()) {
+      exit(ola::EXIT_UNAVAILABLE);
+    }
+
+    g_load_generator = &generator;
+    ola::InstallSignal(SIGINT, InteruptSignal);
+    generator.Run();
+    g_load_generator = NULL;
+    return ola::EXIT_OK;
+  }
+
+  Client client(options);
   if (!client.Init()) {
     exit(ola::EXIT_UNAVAILABLE);
   }
@@ -0,0 +1,525 @@
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/base/Flags.h>
+#include <ola/base/Init.h>
+#include <ola/base/SysExits.h>
+#include <ola/io/Descriptor.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/SocketAddress.h>
+#include <ola/network/TCPSocket.h>
+#include <ola/stl/STLUtils.h>
+#include <ola/thread/Thread.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/InProcessDiscoveryAgent.h"
+#include "src/MasterProtocol.h"
+#include "src/MasterServer.h"
+
+DEFINE_uint32(connections, 10000, "The number of client connections to open.");
+DEFINE_uint16(connect_batch, 200,
+              "The number of connections to open every 10ms.");
+DEFINE_uint32(duration, 10,
+              "The time in seconds to measure each stage for, once its "
+              "clients are connected.");
+DEFINE_uint16(stages, 4,
+              "The number of stages to open the connections in. Each stage "
+              "adds the same number of connections.");
+DEFINE_uint32(max_tick_stddev, 20,
+              "Fail if the standard deviation of the per tick CPU time in a "
+              "stage is more than this percentage of the mean.");
+DEFINE_uint32(max_tick_spike, 200,
+              "Fail if the largest per tick CPU time in a stage is more than "
+              "this percentage of the mean.");
+DEFINE_uint32(max_scaling, 50,
+              "Fail if the CPU time per connection per tick in the last "
+              "stage is more than this percentage above the first stage.");
+DEFINE_uint32(heartbeat_interval, 100,
+              "How often the master sends heartbeats in ms.");
+DEFINE_uint32(keepalive_interval, 1000,
+              "How often the master resends its status in ms.");
+DEFINE_uint32(listen_backlog, 1024,
+              "The maximum length of the master's pending connection queue.");
+DEFINE_uint16(workers, 0,
+              "The number of worker threads for the master, 0 runs "
+              "everything on the master's main thread.");
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::io::SelectServer;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using ola::network::TCPSocket;
+using std::auto_ptr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+int64_t CPUTime(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+}  // namespace
+
+/**
+ * @brief Runs a master in its own thread and samples the CPU time it uses.
+ *
+ * The master may have worker threads, so the CPU time is that of the whole
+ * process less the thread running the clients.
+ */
+class MasterThread : public ola::thread::Thread {
+ public:
+  explicit MasterThread(pthread_t client_thread)
+      : m_registry(&m_ss),
+        m_agent_factory(&m_registry),
+        m_last_cpu_time(0) {
+    pthread_getcpuclockid(client_thread, &m_client_clock);
+  }
+
+  bool Init() {
+    MasterServer::Options options;
+    options.service_name = "LoadTest";
+    options.listen_ip = IPV4Address::Loopback();
+    options.scope = "load-test";
+    options.keepalive_interval = FLAGS_keepalive_interval;
+    options.heartbeat_interval = FLAGS_heartbeat_interval;
+    options.listen_backlog = FLAGS_listen_backlog;
+    options.expected_connections = FLAGS_connections;
+    options.worker_threads = FLAGS_workers;
+    options.agent_factory = &m_agent_factory;
+    m_master.reset(new MasterServer(&m_ss, options));
+    return m_master->Init();
+  }
+
+  IPV4SocketAddress ListenAddress() const { return m_master->ListenAddress(); }
+
+  void Stop() { m_ss.Terminate(); }
+
+  struct Sample {
+    unsigned int connections;
+    int64_t cpu_time;  // in microseconds
+  };
+
+  // Only valid once the thread has been joined.
+  const vector<Sample> &Samples() const { return m_samples; }
+
+ protected:
+  void *Run() {
+    m_last_cpu_time = MasterCPUTime();
+    m_ss.RegisterRepeatingTimeout(
+        1000, NewCallback(this, &MasterThread::TakeSample));
+    m_ss.Run();
+    m_master.reset();
+    return NULL;
+  }
+
+ private:
+  SelectServer m_ss;
+  InProcessRegistry m_registry;
+  InProcessAgentFactory m_agent_factory;
+  auto_ptr<MasterServer> m_master;
+  clockid_t m_client_clock;
+  int64_t m_last_cpu_time;
+  vector<Sample> m_samples;
+
+  int64_t MasterCPUTime() const {
+    return CPUTime(CLOCK_PROCESS_CPUTIME_ID) - CPUTime(m_client_clock);
+  }
+
+  bool TakeSample() {
+    int64_t now = MasterCPUTime();
+    Sample sample = {m_master->ConnectionCount(), now - m_last_cpu_time};
+    m_samples.push_back(sample);
+    m_last_cpu_time = now;
+    return true;
+  }
+};
+
+/**
+ * @brief A client connection, which counts the frames it receives.
+ */
+class LoadClient {
+ public:
+  LoadClient(SelectServer *ss, TCPSocket *socket, unsigned int *disconnects)
+      : m_ss(ss),
+        m_socket(socket),
+        m_reader(NewCallback(this, &LoadClient::HandleFrame)),
+        m_disconnects(disconnects),
+        m_frames(0) {
+    ola::io::ConnectedDescriptor::SetNonBlocking(m_socket->ReadDescriptor());
+    m_socket->SetOnData(NewCallback(this, &LoadClient::ReceiveData));
+    m_socket->SetOnClose(NewSingleCallback(this, &LoadClient::SocketClosed));
+    m_ss->AddReadDescriptor(m_socket.get());
+  }
+
+  ~LoadClient() {
+    if (m_socket.get()) {
+      m_ss->RemoveReadDescriptor(m_socket.get());
+      m_socket->Close();
+    }
+  }
+
+  uint64_t Frames() const { return m_frames; }
+
+ private:
+  SelectServer *m_ss;
+  auto_ptr<TCPSocket> m_socket;
+  FrameReader m_reader;
+  unsigned int *m_disconnects;
+  uint64_t m_frames;
+
+  void ReceiveData() {
+    if (!m_reader.ReadFrom(m_socket.get())) {
+      OLA_WARN << "Bad data from master";
+    }
+  }
+
+  void HandleFrame(uint8_t, const uint8_t*, unsigned int) {
+    m_frames++;
+  }
+
+  void SocketClosed() {
+    m_ss->RemoveReadDescriptor(m_socket.get());
+    m_socket->Close();
+    m_socket.reset();
+    (*m_disconnects)++;
+  }
+};
+
+/**
+ * @brief Opens the client connections in stages and checks the results.
+ *
+ * The per tick CPU time must be steady within each stage, and the time per
+ * connection mustn't grow much from the first stage to the last, which would
+ * mean some per tick work is worse than linear in the number of
+ * connections.
+ */
+class LoadTest {
+ public:
+  LoadTest(SelectServer *ss, MasterThread *master)
+      : m_ss(ss),
+        m_master(master),
+        m_stage(0),
+        m_connect_failures(0),
+        m_disconnects(0) {
+  }
+
+  ~LoadTest() {
+    ola::STLDeleteElements(&m_clients);
+  }
+
+  void Start() {
+    m_clients.reserve(FLAGS_connections);
+    StartStage();
+  }
+
+  bool PrintResults() const;
+
+ private:
+  struct StageResult {
+    unsigned int connections;
+    unsigned int samples;
+    double mean;  // CPU time per tick, in microseconds
+    double max;
+    double stddev;
+  };
+
+  SelectServer *m_ss;
+  MasterThread *m_master;
+  vector<LoadClient*> m_clients;
+  unsigned int m_stage;
+  unsigned int m_connect_failures;
+  unsigned int m_disconnects;
+
+  unsigned int StageTarget(unsigned int stage) const;
+  void StartStage();
+  void EndStage();
+  bool OpenConnections();
+  StageResult AnalyseStage(unsigned int stage, double ticks_per_sample) const;
+  bool CheckStage(const StageResult &result, string *error) const;
+};
+
+unsigned int LoadTest::StageTarget(unsigned int stage) const {
+  return static_cast<unsigned int>(
+      static_cast<uint64_t>(FLAGS_connections) * (stage + 1) / FLAGS_stages);
+}
+
+void LoadTest::StartStage() {
+  m_ss->RegisterRepeatingTimeout(
+      10, NewCallback(this, &LoadTest::OpenConnections));
+}
+
+void LoadTest::EndStage() {
+  m_stage++;
+  if (m_stage < FLAGS_stages) {
+    StartStage();
+  } else {
+    m_ss->Terminate();
+  }
+}
+
+bool LoadTest::OpenConnections() {
+  const IPV4SocketAddress master_address = m_master->ListenAddress();
+  const unsigned int target = StageTarget(m_stage);
+  for (unsigned int i = 0;
+       i < FLAGS_connect_batch && m_clients.size() < target; i++) {
+    TCPSocket *socket = TCPSocket::Connect(master_address);
+    if (!socket) {
+      m_connect_failures++;
+      continue;
+    }
+    m_clients.push_back(new LoadClient(m_ss, socket, &m_disconnects));
+  }
+
+  if (m_connect_failures > FLAGS_connections) {
+    OLA_WARN << "Too many connect failures, giving up";
+    m_ss->Terminate();
+    return false;
+  }
+
+  if (m_clients.size() < target) {
+    return true;
+  }
+
+  OLA_INFO << "Opened " << m_clients.size() << " connections";
+  m_ss->RegisterSingleTimeout(
+      FLAGS_duration * 1000,
+      NewSingleCallback(this, &LoadTest::EndStage));
+  return false;
+}
+
+/*
+ * Only the samples taken with all of the stage's clients connected count.
+ * The first of those may include some of the ramp up.
+ */
+LoadTest::StageResult LoadTest::AnalyseStage(unsigned int stage,
+                                             double ticks_per_sample) const {
+  StageResult result = {StageTarget(stage), 0, 0, 0, 0};
+  vector<double> steady;
+  bool seen_full = false;
+  const vector<MasterThread::Sample> &samples = m_master->Samples();
+  vector<MasterThread::Sample>::const_iterator iter = samples.begin();
+  for (; iter != samples.end(); ++iter) {
+    if (iter->connections == result.connections) {
+      if (seen_full) {
+        steady.push_back(iter->cpu_time / ticks_per_sample);
+      }
+      seen_full = true;
+    }
+  }
+  if (steady.empty()) {
+    return result;
+  }
+
+  double total = 0;
+  vector<double>::const_iterator steady_iter = steady.begin();
+  for (; steady_iter != steady.end(); ++steady_iter) {
+    total += *steady_iter;
+    result.max = std::max(result.max, *steady_iter);
+  }
+  result.samples = steady.size();
+  result.mean = total / steady.size();
+  double variance = 0;
+  for (steady_iter = steady.begin(); steady_iter != steady.end();
+       ++steady_iter) {
+    variance += (*steady_iter - result.mean) * (*steady_iter - result.mean);
+  }
+  result.stddev = sqrt(variance / steady.size());
+  return result;
+}
+
+/*
+ * Returns false if the per tick CPU time wasn't steady.
+ */
+bool LoadTest::CheckStage(const StageResult &result, string *error) const {
+  std::ostringstream str;
+  if (result.samples < 2) {
+    str << "only " << result.samples << " samples at " << result.connections
+        << " connections, increase --duration";
+  } else if (result.stddev * 100 > result.mean * FLAGS_max_tick_stddev) {
+    str << "stddev is " << result.stddev * 100 / result.mean
+        << "% of the mean at " << result.connections << " connections";
+  } else if (result.max * 100 > result.mean * FLAGS_max_tick_spike) {
+    str << "max is " << result.max * 100 / result.mean
+        << "% of the mean at " << result.connections << " connections";
+  } else {
+    return true;
+  }
+  *error = str.str();
+  return false;
+}
+
+/*
+ * Returns false if the test failed.
+ */
+bool LoadTest::PrintResults() const {
+  uint64_t frames = 0;
+  vector<LoadClient*>::const_iterator iter = m_clients.begin();
+  for (; iter != m_clients.end(); ++iter) {
+    frames += (*iter)->Frames();
+  }
+
+  const double ticks_per_sample = FLAGS_heartbeat_interval ?
+      1000.0 / FLAGS_heartbeat_interval : 1.0;
+
+  cout << "--------------" << endl;
+  cout << "Connections: " << m_clients.size() << " / " << FLAGS_connections
+       << ", connect failures: " << m_connect_failures
+       << ", disconnects: " << m_disconnects << endl;
+  cout << "Frames received: " << frames << endl;
+  cout << "connections\tcpu ms/s\tcpu us/tick\tcpu ns/conn/tick" << endl;
+
+  const vector<MasterThread::Sample> &samples = m_master->Samples();
+  vector<MasterThread::Sample>::const_iterator sample_iter = samples.begin();
+  for (; sample_iter != samples.end(); ++sample_iter) {
+    const double per_tick = sample_iter->cpu_time / ticks_per_sample;
+    cout << sample_iter->connections << "\t\t"
+         << sample_iter->cpu_time / 1000.0 << "\t\t" << per_tick << "\t\t";
+    if (sample_iter->connections) {
+      cout << per_tick * 1000 / sample_iter->connections;
+    }
+    cout << endl;
+  }
+
+  vector<string> errors;
+  if (m_clients.size() != FLAGS_connections) {
+    errors.push_back("not every connection was opened");
+  }
+  if (m_disconnects) {
+    errors.push_back("the master closed connections");
+  }
+
+  cout << "Steady state per tick:" << endl;
+  vector<StageResult> results;
+  for (unsigned int stage = 0; stage < FLAGS_stages; stage++) {
+    const StageResult result = AnalyseStage(stage, ticks_per_sample);
+    results.push_back(result);
+    cout << result.connections << " connections: mean " << result.mean
+         << " us, max " << result.max << " us, stddev " << result.stddev
+         << " us";
+    if (result.connections) {
+      cout << ", " << result.mean * 1000 / result.connections
+           << " ns/conn";
+    }
+    cout << endl;
+
+    string error;
+    if (!CheckStage(result, &error)) {
+      errors.push_back(error);
+    }
+  }
+
+  const StageResult &first = results.front();
+  const StageResult &last = results.back();
+  if (results.size() > 1 && first.connections && first.mean > 0) {
+    const double growth = (last.mean / last.connections) /
+                          (first.mean / first.connections);
+    cout << "Per connection cost from " << first.connections << " to "
+         << last.connections << " connections: x" << growth << endl;
+    if (growth * 100 > 100 + FLAGS_max_scaling) {
+      std::ostringstream str;
+      str << "per connection cost grew by x" << growth;
+      errors.push_back(str.str());
+    }
+  }
+
+  vector<string>::const_iterator error_iter = errors.begin();
+  for (; error_iter != errors.end(); ++error_iter) {
+    cout << "FAILED: " << *error_iter << endl;
+  }
+  cout << "--------------" << endl;
+  return errors.empty();
+}
+
+/*
+ * Each connection uses a descriptor at each end, and both ends are in this
+ * process.
+ */
+bool RaiseDescriptorLimit() {
+  const rlim_t required = 2 * static_cast<rlim_t>(FLAGS_connections) + 64;
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit)) {
+    OLA_WARN << "getrlimit failed: " << strerror(errno);
+    return false;
+  }
+  if (limit.rlim_cur >= required) {
+    return true;
+  }
+  if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < required) {
+    OLA_WARN << "Need " << required << " descriptors but the hard limit is "
+             << limit.rlim_max;
+    return false;
+  }
+  limit.rlim_cur = required;
+  if (setrlimit(RLIMIT_NOFILE, &limit)) {
+    OLA_WARN << "setrlimit failed: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+SelectServer *g_ss = NULL;
+
+static void InteruptSignal(OLA_UNUSED int signal) {
+  if (g_ss) {
+    g_ss->Terminate();
+  }
+}
+
+/*
+ * The SelectServer must use epoll (or kqueue), select() can't handle more
+ * than FD_SETSIZE descriptors.
+ */
+int main(int argc, char *argv[]) {
+  ola::AppInit(&argc, argv, "[options]",
+               "Measure the CPU used by a master with many connected clients");
+
+  if (FLAGS_stages == 0 || FLAGS_stages > FLAGS_connections) {
+    OLA_WARN << "--stages must be between 1 and --connections";
+    exit(ola::EXIT_USAGE);
+  }
+
+  if (!RaiseDescriptorLimit()) {
+    exit(ola::EXIT_OSERR);
+  }
+
+  MasterThread master(pthread_self());
+  if (!master.Init()) {
+    exit(ola::EXIT_UNAVAILABLE);
+  }
+  master.Start();
+
+  bool ok;
+  {
+    SelectServer ss;
+    LoadTest test(&ss, &master);
+    test.Start();
+
+    g_ss = &ss;
+    ola::InstallSignal(SIGINT, InteruptSignal);
+    ss.Run();
+    g_ss = NULL;
+
+    master.Stop();
+    master.Join();
+    ok = test.PrintResults();
+  }
+  exit(ok ? ola::EXIT_OK : ola::EXIT_SOFTWARE);
+}
@@ -0,0 +1,145 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * election_sim.cpp
+ * Measure election convergence in virtual time.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include <ola/Logging.h>
+#include <ola/base/Flags.h>
+#include <ola/base/Init.h>
+#include <ola/base/SysExits.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "src/ElectionSimulator.h"
+
+DEFINE_string(script, "",
+              "Run the events from this file, rather than random churn.");
+DEFINE_uint32(masters, 10000, "The number of masters for random churn.");
+DEFINE_uint32(events, 1000, "The number of random churn events.");
+DEFINE_uint32(event_interval, 100,
+              "The mean time between random churn events in ms.");
+DEFINE_uint32(seed, 1, "The seed for random churn.");
+DEFINE_uint32(clients, 10, "The number of clients to simulate.");
+DEFINE_uint32(propagation_delay, 5,
+              "The time in ms for registration changes to reach the "
+              "clients.");
+DEFINE_uint32(tick, 1,
+              "How far to move the clock in ms while the clients are "
+              "converging.");
+DEFINE_uint32(convergence_timeout, 10000,
+              "The time in ms to wait for the clients to converge.");
+DEFINE_default_bool(mixed_failures, false,
+                    "Split the random removals between removes, crashes and "
+                    "handoffs.");
+DEFINE_uint32(record_expiry, 5000,
+              "The time in ms a crashed master stays registered.");
+DEFINE_default_bool(full_stack, false,
+                    "Run MasterServers and MasterClients connected over "
+                    "loopback, rather than just the election.");
+DEFINE_uint32(keepalive_interval, 1000,
+              "How often the masters resend their status in ms, with "
+              "--full_stack.");
+DEFINE_uint32(heartbeat_interval, 100,
+              "How often the masters send heartbeats in ms, with "
+              "--full_stack.");
+DEFINE_uint32(handoff_timeout, 2000,
+              "How long a master waits for another to take over in ms, with "
+              "--full_stack.");
+DEFINE_uint32(failure_check_interval, 50,
+              "How often the clients check for failed masters in ms, with "
+              "--full_stack.");
+DEFINE_uint32(standby_masters, 2,
+              "The number of standby masters each client connects to, with "
+              "--full_stack.");
+DEFINE_uint16(tcp_retry_interval, 5,
+              "The maximum time in seconds between TCP connection attempts");
+DEFINE_uint32(tcp_min_retry_interval, 500,
+              "The minimum time in ms between TCP connection attempts");
+DEFINE_uint32(tcp_fast_retry, 100,
+              "The maximum time in ms before the first retry after a TCP "
+              "connection is lost, 0 to disable.");
+
+using ola::TimeInterval;
+
+// Each master and client has its own sockets.
+static const unsigned int MAX_FULL_STACK_MASTERS = 100;
+
+static TimeInterval MillisToInterval(unsigned int ms) {
+  return TimeInterval(ms / 1000, (ms % 1000) * 1000);
+}
+
+int main(int argc, char *argv[]) {
+  ola::AppInit(&argc, argv, "[options]",
+               "Run discovery & election scenarios in virtual time.");
+
+  Scenario scenario;
+  if (FLAGS_script.str().empty()) {
+    Scenario::ChurnOptions churn_options;
+    churn_options.masters = FLAGS_masters;
+    churn_options.events = FLAGS_events;
+    churn_options.mean_interval_ms = FLAGS_event_interval;
+    churn_options.seed = FLAGS_seed;
+    churn_options.mixed_failures = FLAGS_mixed_failures;
+    scenario.GenerateChurn(churn_options);
+  } else if (!scenario.Load(FLAGS_script.str())) {
+    exit(ola::EXIT_USAGE);
+  }
+
+  ElectionSimulator::Options options;
+  options.clients = FLAGS_clients;
+  options.propagation_delay_ms = FLAGS_propagation_delay;
+  options.tick_ms = FLAGS_tick;
+  options.convergence_timeout_ms = FLAGS_convergence_timeout;
+  options.record_expiry_ms = FLAGS_record_expiry;
+  options.full_stack = FLAGS_full_stack;
+  options.server_options.keepalive_interval = FLAGS_keepalive_interval;
+  options.server_options.heartbeat_interval = FLAGS_heartbeat_interval;
+  options.server_options.handoff_timeout = FLAGS_handoff_timeout;
+  options.client_options.failure_check_interval = MillisToInterval(
+      FLAGS_failure_check_interval);
+  options.client_options.standby_masters = FLAGS_standby_masters;
+  options.client_options.backoff_options.maximum = TimeInterval(
+      FLAGS_tcp_retry_interval, 0);
+  options.client_options.backoff_options.initial = MillisToInterval(
+      FLAGS_tcp_min_retry_interval);
+  options.client_options.backoff_options.fast_retry = MillisToInterval(
+      FLAGS_tcp_fast_retry);
+
+  if (options.full_stack) {
+    unsigned int masters = 0;
+    std::vector<ScenarioEvent>::const_iterator iter =
+        scenario.Events().begin();
+    for (; iter != scenario.Events().end(); ++iter) {
+      masters = std::max(masters, iter->master + 1);
+    }
+    if (masters > MAX_FULL_STACK_MASTERS) {
+      OLA_WARN << "--full_stack is limited to " << MAX_FULL_STACK_MASTERS
+               << " masters, the scenario has " << masters;
+      exit(ola::EXIT_USAGE);
+    }
+  }
+
+  ElectionSimulator simulator(options);
+  ElectionSimulator::Results results;
+  if (!simulator.Run(scenario, &results)) {
+    exit(ola::EXIT_SOFTWARE);
+  }
+  results.Print(&std::cout);
+}
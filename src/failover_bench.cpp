@@ -0,0 +1,350 @@
+
+#include <signal.h>
+#include <ola/Callback.h>
+#include <ola/Clock.h>
+#include <ola/Logging.h>
+#include <ola/base/Flags.h>
+#include <ola/base/Init.h>
+#include <ola/base/SysExits.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/stl/STLUtils.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "src/DiscoveryAgent.h"
+#include "src/InProcessDiscoveryAgent.h"
+#include "src/MasterClient.h"
+#include "src/MasterServer.h"
+
+DEFINE_uint16(masters, 3, "The number of masters to run per trial.");
+DEFINE_uint16(clients, 5, "The number of clients to run per trial.");
+DEFINE_uint16(trials, 10, "The number of trials to run.");
+DEFINE_string(registry, "inprocess",
+              "The discovery backend, either 'inprocess' or 'dnssd'.");
+DEFINE_string(failure, "kill",
+              "How to fail the master, either 'kill' or 'demote'.");
+DEFINE_uint16(propagation_delay, 0,
+              "The delay in ms for in-process registry events.");
+DEFINE_uint32(trial_timeout, 30000,
+              "The time in ms to wait for the clients to converge.");
+DEFINE_uint32(settle_time, 2000, "The time in ms to wait between trials.");
+DEFINE_uint16(tcp_retry_interval, 5,
+              "The maximum time in seconds between TCP connection attempts");
+DEFINE_uint32(tcp_min_retry_interval, 500,
+              "The minimum time in ms between TCP connection attempts");
+DEFINE_uint32(tcp_fast_retry, 100,
+              "The maximum time in ms before the first retry after a TCP "
+              "connection is lost, 0 to disable.");
+DEFINE_uint32(keepalive_interval, 1000,
+              "How often the masters resend their status in ms.");
+DEFINE_uint32(heartbeat_interval, 100,
+              "How often the masters send heartbeats in ms.");
+DEFINE_string(scope, "failover-bench", "The scope to use.");
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::TimeInterval;
+using ola::TimeStamp;
+using ola::io::SelectServer;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using std::auto_ptr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+ * @brief Runs repeated failover trials and reports the convergence time.
+ *
+ * Each trial starts a set of masters and clients, waits for every client to
+ * agree on the highest priority master, then kills or demotes that master.
+ * The time is measured from the failure until every client's elected and
+ * reported master are the new master.
+ */
+class FailoverBench {
+ public:
+  FailoverBench(SelectServer *ss, DiscoveryAgentFactory *agent_factory,
+                const IPV4Address &listen_ip)
+      : m_ss(ss),
+        m_agent_factory(agent_factory),
+        m_listen_ip(listen_ip),
+        m_state(IDLE),
+        m_trial(0),
+        m_failures(0),
+        m_trial_timeout(ola::thread::INVALID_TIMEOUT) {
+  }
+
+  ~FailoverBench() {
+    TearDown();
+  }
+
+  void Start() {
+    StartTrial();
+  }
+
+  void PrintResults() const;
+
+ private:
+  enum State {
+    IDLE,
+    WAITING_FOR_INITIAL,
+    WAITING_FOR_FAILOVER,
+  };
+
+  typedef vector<MasterServer*> Masters;
+  typedef vector<MasterClient*> Clients;
+
+  SelectServer *m_ss;
+  DiscoveryAgentFactory *m_agent_factory;
+  const IPV4Address m_listen_ip;
+  ola::Clock m_clock;
+
+  State m_state;
+  unsigned int m_trial;
+  unsigned int m_failures;
+  ola::thread::timeout_id m_trial_timeout;
+  Masters m_masters;
+  Clients m_clients;
+  MasterServer *m_expected_master;
+  TimeStamp m_failure_time;
+  vector<int64_t> m_latencies;  // in microseconds
+
+  void StartTrial();
+  void ClientChanged();
+  bool HasConverged() const;
+  void InjectFailure();
+  void TrialTimeout();
+  void EndTrial();
+  void TearDown();
+  void NextTrial();
+};
+
+void FailoverBench::StartTrial() {
+  m_trial++;
+  OLA_INFO << "Starting trial " << m_trial;
+
+  // Priorities are unique so the expected winner is well defined.
+  for (unsigned int i = 0; i < FLAGS_masters; i++) {
+    std::ostringstream name;
+    name << "Bench" << i;
+    MasterServer::Options options;
+    options.service_name = name.str();
+    options.listen_ip = m_listen_ip;
+    options.priority = 100 + i;
+    options.scope = FLAGS_scope.str();
+    options.keepalive_interval = FLAGS_keepalive_interval;
+    options.heartbeat_interval = FLAGS_heartbeat_interval;
+    options.agent_factory = m_agent_factory;
+
+    auto_ptr<MasterServer> master(new MasterServer(m_ss, options));
+    if (!master->Init()) {
+      OLA_WARN << "Failed to start master " << i;
+      m_ss->Terminate();
+      return;
+    }
+    m_masters.push_back(master.release());
+  }
+  m_expected_master = m_masters.back();
+
+  for (unsigned int i = 0; i < FLAGS_clients; i++) {
+    MasterClient::Options options;
+    options.scope = FLAGS_scope.str();
+    options.backoff_options.maximum = TimeInterval(FLAGS_tcp_retry_interval,
+                                                   0);
+    options.backoff_options.initial = TimeInterval(
+        FLAGS_tcp_min_retry_interval / 1000,
+        (FLAGS_tcp_min_retry_interval % 1000) * 1000);
+    options.backoff_options.fast_retry = TimeInterval(
+        FLAGS_tcp_fast_retry / 1000, (FLAGS_tcp_fast_retry % 1000) * 1000);
+    options.agent_factory = m_agent_factory;
+    options.state_change_callback = NewCallback(
+        this, &FailoverBench::ClientChanged);
+
+    auto_ptr<MasterClient> client(new MasterClient(m_ss, options));
+    if (!client->Init()) {
+      OLA_WARN << "Failed to start client " << i;
+      m_ss->Terminate();
+      return;
+    }
+    m_clients.push_back(client.release());
+  }
+
+  m_state = WAITING_FOR_INITIAL;
+  m_trial_timeout = m_ss->RegisterSingleTimeout(
+      FLAGS_trial_timeout,
+      NewSingleCallback(this, &FailoverBench::TrialTimeout));
+}
+
+void FailoverBench::ClientChanged() {
+  if (m_state == IDLE || !HasConverged()) {
+    return;
+  }
+
+  if (m_state == WAITING_FOR_INITIAL) {
+    m_state = IDLE;
+    // Don't destroy masters from within a client callback.
+    m_ss->Execute(NewSingleCallback(this, &FailoverBench::InjectFailure));
+    return;
+  }
+
+  TimeStamp now;
+  m_clock.CurrentTime(&now);
+  TimeInterval latency = now - m_failure_time;
+  m_latencies.push_back(latency.AsInt());
+  cout << "Trial " << m_trial << ": converged in "
+       << latency.AsInt() / 1000.0 << " ms" << endl;
+  EndTrial();
+}
+
+bool FailoverBench::HasConverged() const {
+  // Masters on the same host are distinguished by port, the host part
+  // depends on how the backend resolved the address.
+  const uint16_t port = m_expected_master->ListenAddress().Port();
+  Clients::const_iterator iter = m_clients.begin();
+  for (; iter != m_clients.end(); ++iter) {
+    IPV4SocketAddress elected = (*iter)->ElectedMaster();
+    if (elected.Port() != port || elected != (*iter)->ReportedMaster()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FailoverBench::InjectFailure() {
+  MasterServer *leader = m_masters.back();
+  m_masters.pop_back();
+  m_expected_master = m_masters.back();
+
+  m_clock.CurrentTime(&m_failure_time);
+  m_state = WAITING_FOR_FAILOVER;
+  if (FLAGS_failure.str() == "demote") {
+    leader->SetPriority(1);
+    m_masters.insert(m_masters.begin(), leader);
+  } else {
+    delete leader;
+  }
+}
+
+void FailoverBench::TrialTimeout() {
+  m_trial_timeout = ola::thread::INVALID_TIMEOUT;
+  cout << "Trial " << m_trial << ": timed out "
+       << (m_state == WAITING_FOR_INITIAL ? "before" : "after")
+       << " the failure" << endl;
+  m_failures++;
+  EndTrial();
+}
+
+void FailoverBench::EndTrial() {
+  m_state = IDLE;
+  if (m_trial_timeout != ola::thread::INVALID_TIMEOUT) {
+    m_ss->RemoveTimeout(m_trial_timeout);
+    m_trial_timeout = ola::thread::INVALID_TIMEOUT;
+  }
+  // We may be inside a client callback here.
+  m_ss->Execute(NewSingleCallback(this, &FailoverBench::NextTrial));
+}
+
+void FailoverBench::TearDown() {
+  ola::STLDeleteElements(&m_clients);
+  ola::STLDeleteElements(&m_masters);
+}
+
+void FailoverBench::NextTrial() {
+  TearDown();
+  if (m_trial >= FLAGS_trials) {
+    m_ss->Terminate();
+    return;
+  }
+  // Give the backend time to flush the goodbyes from the last trial.
+  m_ss->RegisterSingleTimeout(
+      FLAGS_settle_time,
+      NewSingleCallback(this, &FailoverBench::StartTrial));
+}
+
+void FailoverBench::PrintResults() const {
+  vector<int64_t> latencies(m_latencies);
+  std::sort(latencies.begin(), latencies.end());
+
+  cout << "--------------" << endl;
+  cout << "Trials: " << m_trial << ", converged: " << latencies.size()
+       << ", timed out: " << m_failures << endl;
+  if (latencies.empty()) {
+    return;
+  }
+
+  int64_t total = 0;
+  vector<int64_t>::const_iterator iter = latencies.begin();
+  for (; iter != latencies.end(); ++iter) {
+    total += *iter;
+  }
+
+  const double percentiles[] = {0.5, 0.9, 0.99};
+  cout << "min: " << latencies.front() / 1000.0 << " ms" << endl;
+  cout << "mean: " << total / latencies.size() / 1000.0 << " ms" << endl;
+  for (unsigned int i = 0; i < sizeof(percentiles) / sizeof(double); i++) {
+    unsigned int index = static_cast<unsigned int>(
+        percentiles[i] * (latencies.size() - 1) + 0.5);
+    cout << "p" << static_cast<int>(percentiles[i] * 100) << ": "
+         << latencies[index] / 1000.0 << " ms" << endl;
+  }
+  cout << "max: " << latencies.back() / 1000.0 << " ms" << endl;
+  cout << "--------------" << endl;
+}
+
+SelectServer *g_ss = NULL;
+
+static void InteruptSignal(OLA_UNUSED int signal) {
+  if (g_ss) {
+    g_ss->Terminate();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ola::AppInit(&argc, argv, "[options]",
+               "Measure the time for clients to converge after a failover");
+
+  if (FLAGS_masters < 2 || FLAGS_masters > 155) {
+    OLA_WARN << "--masters must be between 2 and 155";
+    exit(ola::EXIT_USAGE);
+  }
+
+  if (FLAGS_failure.str() != "kill" && FLAGS_failure.str() != "demote") {
+    ola::DisplayUsage();
+    exit(ola::EXIT_USAGE);
+  }
+
+  SelectServer ss;
+  auto_ptr<InProcessRegistry> registry;
+  auto_ptr<DiscoveryAgentFactory> agent_factory;
+  IPV4Address listen_ip;
+
+  if (FLAGS_registry.str() == "inprocess") {
+    registry.reset(new InProcessRegistry(&ss, FLAGS_propagation_delay));
+    agent_factory.reset(new InProcessAgentFactory(registry.get()));
+    listen_ip = IPV4Address::Loopback();
+  } else if (FLAGS_registry.str() == "dnssd") {
+    agent_factory.reset(new DiscoveryAgentFactory());
+  } else {
+    ola::DisplayUsage();
+    exit(ola::EXIT_USAGE);
+  }
+
+  {
+    FailoverBench bench(&ss, agent_factory.get(), listen_ip);
+    bench.Start();
+
+    g_ss = &ss;
+    ola::InstallSignal(SIGINT, InteruptSignal);
+    ss.Run();
+    g_ss = NULL;
+
+    bench.PrintResults();
+  }
+}
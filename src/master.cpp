@@ -1,281 +1,247 @@
 
 #include <signal.h>
 #include <ola/Callback.h>
+#include <ola/Clock.h>
 #include <ola/Logging.h>
 #include <ola/base/Flags.h>
 #include <ola/base/Init.h>
+#include <ola/base/Macro.h>
 #include <ola/base/SysExits.h>
 #include <ola/io/SelectServer.h>
-#include <ola/network/TCPSocket.h>
-#include <ola/network/InterfacePicker.h>
-#include <ola/network/TCPSocketFactory.h>
-#include <ola/strings/Format.h>
-#include <ola/stl/STLUtils.h>
+#include <ola/network/IPV4Address.h>
 
+#include <algorithm>
 #include <memory>
-#include <vector>
-#include <set>
 #include <string>
 
-#include "DiscoveryAgent.h"
-#include "MasterEntry.h"
+#include "src/CPUTime.h"
+#include "src/LoadPriority.h"
+#include "src/MasterServer.h"
 
 DEFINE_int8(priority, 50, "Initial Master Priority");
+DEFINE_string(service_name, "Master", "The DNS-SD instance name.");
+DEFINE_default_bool(unique_name, true,
+                    "Add the host name and port to the instance name.");
 DEFINE_string(listen_ip, "", "The IP Address to listen on");
 DEFINE_uint16(listen_port, 0, "The port to listen on");
 DEFINE_string(scope, "default", "The scope to use.");
+DEFINE_string(browse_domain, "",
+              "The DNS-SD domain to browse for masters, empty uses the "
+              "system default.");
+DEFINE_string(registration_domain, "",
+              "The DNS-SD domain to register in, empty uses the system "
+              "default. Not supported with Avahi.");
 DEFINE_default_bool(watch_masters, true, "Watch for master changes");
+DEFINE_uint32(keepalive_interval, 1000,
+              "How often to resend the master status in ms, 0 to disable.");
+DEFINE_uint32(heartbeat_interval, 100,
+              "How often to send heartbeats in ms, 0 to disable.");
+DEFINE_uint32(listen_backlog, 128,
+              "The maximum length of the pending connection queue.");
+DEFINE_uint32(expected_clients, 0,
+              "The number of clients to reserve space for.");
+DEFINE_uint16(workers, 0,
+              "The number of threads to handle clients, 0 handles them on "
+              "the main thread.");
+DEFINE_uint32(max_queued_bytes, 65536,
+              "The number of bytes to queue for a client before dropping it.");
+DEFINE_string(multicast_group, "",
+              "The multicast group to announce the status to. If set, TCP is "
+              "only used to find the master.");
+DEFINE_uint16(multicast_port, 5570, "The port to multicast the status to.");
+DEFINE_uint32(multicast_interval, 100,
+              "How often to multicast the status in ms.");
+DEFINE_uint32(initial_browse_timeout, 2000,
+              "How long to wait for the existing masters to be found before "
+              "registering, in ms. 0 doesn't wait.");
+DEFINE_uint32(handoff_timeout, 2000,
+              "On SIGINT, how long to wait for another master to take over "
+              "before exiting, in ms. 0 exits straight away.");
+DEFINE_uint32(load_interval, 1000,
+              "How often to sample the load and adjust the priority in ms, "
+              "0 keeps the priority fixed.");
+DEFINE_uint8(min_priority, 1, "The priority to advertise at full load.");
+DEFINE_uint32(client_capacity, 0,
+              "The number of clients that counts as full load, 0 to ignore.");
+DEFINE_uint32(lag_limit, 50,
+              "The event loop lag that counts as full load in ms, 0 to "
+              "ignore.");
+DEFINE_uint8(cpu_limit, 80,
+             "The CPU use that counts as full load, as a percentage of the "
+             "event loop and worker threads, 0 to ignore.");
+DEFINE_uint8(shed_threshold, 70,
+             "The load, as a percentage, at which the priority starts to "
+             "fall.");
+DEFINE_uint8(priority_hysteresis, 10,
+             "The smallest change in priority to advertise.");
+DEFINE_uint32(priority_change_interval, 5000,
+              "The minimum time between priority changes in ms.");
 
 using ola::io::SelectServer;
-using ola::network::Interface;
-using ola::network::InterfacePicker;
 using ola::network::IPV4Address;
-using ola::network::IPV4SocketAddress;
-using ola::network::TCPSocket;
-using ola::NewCallback;
-using ola::NewSingleCallback;
-using ola::STLContains;
-using ola::strings::ToHex;
-using std::auto_ptr;
-using std::set;
-using std::vector;
 
-class Server {
+/**
+ * @brief Samples the master's load and adjusts its priority.
+ *
+ * The process CPU time is divided by the number of threads that do the
+ * master's work, the event loop plus any workers, so a master saturating
+ * its threads counts as fully loaded however many cores the machine has.
+ */
+class LoadMonitor {
  public:
-  explicit Server(const IPV4Address &listen_ip)
-      : m_listen_ip(listen_ip),
-        m_tcp_socket_factory(
-            ola::NewCallback(this, &Server::OnTCPConnect)),
-        m_listen_socket(&m_tcp_socket_factory),
-        m_is_master(false),
-        m_update_timeout(ola::thread::INVALID_TIMEOUT) {
-    m_update_timeout = m_ss.RegisterRepeatingTimeout(
-        1000,
-        NewCallback(this, &Server::UpdateClients));
+  LoadMonitor(SelectServer *ss, MasterServer *server,
+              const LoadPriorityPolicy::Options &options,
+              unsigned int interval,
+              unsigned int threads)
+      : m_ss(ss),
+        m_server(server),
+        m_policy(options),
+        m_interval(interval / 1000, (interval % 1000) * 1000),
+        m_threads(std::max(threads, 1u)),
+        m_timeout(ola::thread::INVALID_TIMEOUT) {
   }
 
-  ~Server() {
-    if (m_update_timeout != ola::thread::INVALID_TIMEOUT) {
-      m_ss.RemoveTimeout(m_update_timeout);
-      m_update_timeout = ola::thread::INVALID_TIMEOUT;
-    }
-
-    m_ss.RemoveReadDescriptor(&m_listen_socket);
-
-    vector<TCPSocket*>::iterator iter = m_sockets.begin();
-    for (; iter != m_sockets.end(); ++iter) {
-      m_ss.RemoveReadDescriptor(*iter);
-      (*iter)->Close();
-      delete *iter;
+  ~LoadMonitor() {
+    if (m_timeout != ola::thread::INVALID_TIMEOUT) {
+      m_ss->RemoveTimeout(m_timeout);
     }
   }
 
-  bool Init() {
-    auto_ptr<InterfacePicker> picker(InterfacePicker::NewPicker());
-    vector<Interface> interfaces = picker->GetInterfaces(false);
-    vector<Interface>::const_iterator iter = interfaces.begin();
-    for (; iter != interfaces.end(); ++iter) {
-      m_local_ips.insert(iter->ip_address);
-    }
-
-    // Start the agent.
-    DiscoveryAgentFactory factory;
-    DiscoveryAgentInterface::Options options;
-    options.scope = FLAGS_scope.str();
-    if (FLAGS_watch_masters) {
-      options.master_callback = ola::NewCallback(this, &Server::MasterChanged);
-    }
-    auto_ptr<DiscoveryAgentInterface> agent(factory.New(options));
-
-    if (!agent->Start()) {
-      return false;
-    }
-
-    const IPV4SocketAddress listen_address(m_listen_ip, FLAGS_listen_port);
-    OLA_INFO << listen_address;
-    if (!m_listen_socket.Listen(listen_address, 10)) {
-      return false;
-    }
-
-    ola::network::GenericSocketAddress actual_address =
-        m_listen_socket.GetLocalAddress();
-    if (actual_address.Family() != AF_INET) {
-      OLA_WARN << "Invalid socket family";
-      return false;
-    }
-    OLA_INFO << "Listening on " << actual_address;
-    m_listen_address = actual_address.V4Addr();
-
-    // Register as a master
-    MasterEntry master_entry;
-    master_entry.service_name = "Master";
-    master_entry.address = m_listen_address;
-    master_entry.priority = FLAGS_priority;
-    master_entry.scope = FLAGS_scope.str();
-    agent->RegisterMaster(master_entry);
-
-    m_ss.AddReadDescriptor(&m_listen_socket);
-    m_discovery_agent.reset(agent.release());
-    return true;
-  }
-
-  void Terminate() {
-    m_ss.Terminate();
-  }
-
-  void Run() {
-    m_ss.Run();
+  void Start() {
+    m_clock.CurrentTime(&m_last_sample);
+    m_last_cpu = ProcessCPUTime();
+    m_timeout = m_ss->RegisterRepeatingTimeout(
+        m_interval, ola::NewCallback(this, &LoadMonitor::Sample));
   }
 
  private:
-  struct Master {
-    std::string name;
-    ola::network::IPV4SocketAddress address;
-    uint8_t priority;
-  };
-
-  SelectServer m_ss;
-
-  IPV4Address m_listen_ip;
-  ola::network::TCPSocketFactory m_tcp_socket_factory;
-  ola::network::TCPAcceptingSocket m_listen_socket;
-  IPV4SocketAddress m_listen_address;
-  auto_ptr<DiscoveryAgentInterface> m_discovery_agent;
-
-  vector<TCPSocket*> m_sockets;
-  set<IPV4Address> m_local_ips;
-  bool m_is_master;
-  ola::thread::timeout_id m_update_timeout;
-  std::vector<Master> m_masters;
-
-  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
-                     const MasterEntry &entry) {
-    OLA_INFO << "Got event "
-             << (event == DiscoveryAgentInterface::MASTER_ADDED ?
-                 "Add / Update" : "Remove") << entry;
-    UpdateMasterList(event, entry);
-    bool am_master = CheckIfMaster();
-    if (am_master != m_is_master) {
-      if (am_master) {
-        OLA_INFO << "I'm now the master!";
-      } else {
-        OLA_INFO << "I'm no longer the master!";
-      }
-      m_is_master = am_master;
+  SelectServer *m_ss;
+  MasterServer *m_server;
+  LoadPriorityPolicy m_policy;
+  const ola::TimeInterval m_interval;
+  const unsigned int m_threads;
+  ola::Clock m_clock;
+  ola::thread::timeout_id m_timeout;
+  ola::TimeStamp m_last_sample;
+  ola::TimeInterval m_last_cpu;
+
+  bool Sample() {
+    ola::TimeStamp now;
+    m_clock.CurrentTime(&now);
+    const ola::TimeInterval elapsed = now - m_last_sample;
+    const ola::TimeInterval cpu = ProcessCPUTime();
+
+    LoadPriorityPolicy::Sample sample;
+    sample.clients = m_server->ConnectionCount();
+    // A busy event loop runs the timer late.
+    if (elapsed > m_interval) {
+      sample.lag = elapsed - m_interval;
     }
-  }
-
-  void UpdateMasterList(DiscoveryAgentInterface::MasterEvent event,
-                        const MasterEntry &entry) {
-    vector<Master>::iterator iter = m_masters.begin();
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->name == entry.service_name) {
-        if (event == DiscoveryAgentInterface::MASTER_REMOVED) {
-          iter = m_masters.erase(iter);
-        } else {
-          iter->priority = entry.priority;
-          iter->address = entry.address;
-        }
-        return;
-      }
-    }
-    // not in the list.
-    Master master = {
-      entry.service_name,
-      entry.address,
-      entry.priority,
-    };
-    m_masters.push_back(master);
-    OLA_INFO << "Added new master";
-  }
-
-  bool CheckIfMaster() {
-    vector<Master>::iterator iter = m_masters.begin();
-    uint8_t priority = 0;
-    Master *preferred_master = NULL;
-    for (; iter != m_masters.end(); ++iter) {
-      if (iter->priority > priority &&
-          iter->address.Host() != IPV4Address::WildCard()) {
-        preferred_master = &(*iter);
-        priority = iter->priority;
-      }
-    }
-    return (preferred_master &&
-            preferred_master->address.Port() == m_listen_address.Port() &&
-            STLContains(m_local_ips, preferred_master->address.Host()));
-  }
-
-  void OnTCPConnect(TCPSocket *socket) {
-    OLA_INFO << "New connection: " << socket;
-    socket->SetOnData(
-        NewCallback(this, &Server::ReceiveTCPData, socket));
-    socket->SetOnClose(
-        NewSingleCallback(this, &Server::SocketClosed, socket));
-    m_ss.AddReadDescriptor(socket);
-    m_sockets.push_back(socket);
-  }
-
-  void ReceiveTCPData(TCPSocket *socket) {
-    uint8_t data;
-    unsigned int length;
-    if (socket->Receive(&data, sizeof(data), length)) {
-      OLA_INFO << "Failed to read";
-    }
-    OLA_INFO << "Socket had data: " << ToHex(data);
-  }
-
-  void SocketClosed(TCPSocket *socket) {
-    OLA_INFO << "Socket @ " << socket << " was closed";
-    vector<TCPSocket*>::iterator iter = m_sockets.begin();
-    for (; iter != m_sockets.end(); ++iter) {
-      if (*iter == socket) {
-        m_ss.RemoveReadDescriptor(socket);
-        socket->Close();
-        delete socket;
-        m_sockets.erase(iter);
-        break;
-      }
+    if (elapsed.AsInt() > 0) {
+      sample.cpu = static_cast<double>((cpu - m_last_cpu).AsInt()) /
+                   elapsed.AsInt() / m_threads;
     }
-  }
+    m_last_sample = now;
+    m_last_cpu = cpu;
 
-  bool UpdateClients() {
-    uint8_t data = m_is_master ? 'm' : 'b';
-    vector<TCPSocket*>::iterator iter = m_sockets.begin();
-    for (; iter != m_sockets.end(); ++iter) {
-      OLA_INFO << "Sending...";
-      (*iter)->Send(&data, sizeof(data));
+    uint8_t priority;
+    if (m_policy.Update(now, sample, &priority)) {
+      OLA_INFO << "Load is " << m_policy.Load() << ", clients: "
+               << sample.clients << ", lag: " << sample.lag << ", cpu: "
+               << sample.cpu;
+      m_server->SetPriority(priority);
     }
     return true;
   }
+
+  DISALLOW_COPY_AND_ASSIGN(LoadMonitor);
 };
 
-Server *g_server = NULL;
+SelectServer *g_ss = NULL;
+MasterServer *g_server = NULL;
+bool g_handing_off = false;
 
+/*
+ * The first SIGINT hands off mastership, a second one exits straight away.
+ */
 static void InteruptSignal(OLA_UNUSED int signal) {
-  if (g_server) {
-    g_server->Terminate();
+  if (!g_ss) {
+    return;
+  }
+  if (g_server && !g_handing_off) {
+    g_handing_off = true;
+    g_ss->Execute(ola::NewSingleCallback(
+        g_server, &MasterServer::Handoff,
+        ola::NewSingleCallback(g_ss, &SelectServer::Terminate)));
+  } else {
+    g_ss->Terminate();
   }
 }
 
 int main(int argc, char *argv[]) {
   ola::AppInit(&argc, argv, "[options]", "Dummy Master");
 
-  IPV4Address master_ip;
+  MasterServer::Options options;
   if (!FLAGS_listen_ip.str().empty() &&
-      !IPV4Address::FromString(FLAGS_listen_ip, &master_ip)) {
+      !IPV4Address::FromString(FLAGS_listen_ip, &options.listen_ip)) {
     ola::DisplayUsage();
     exit(ola::EXIT_USAGE);
   }
-
-
-
-  Server server(master_ip);
+  if (!FLAGS_multicast_group.str().empty() &&
+      !IPV4Address::FromString(FLAGS_multicast_group,
+                               &options.multicast_group)) {
+    ola::DisplayUsage();
+    exit(ola::EXIT_USAGE);
+  }
+  options.multicast_port = FLAGS_multicast_port;
+  options.multicast_interval = FLAGS_multicast_interval;
+  options.initial_browse_timeout = FLAGS_initial_browse_timeout;
+  options.handoff_timeout = FLAGS_handoff_timeout;
+  options.service_name = FLAGS_service_name.str();
+  options.unique_name = FLAGS_unique_name;
+  options.listen_port = FLAGS_listen_port;
+  options.priority = FLAGS_priority;
+  options.scope = FLAGS_scope.str();
+  options.browse_domain = FLAGS_browse_domain.str();
+  options.registration_domain = FLAGS_registration_domain.str();
+  options.watch_masters = FLAGS_watch_masters;
+  options.keepalive_interval = FLAGS_keepalive_interval;
+  options.heartbeat_interval = FLAGS_heartbeat_interval;
+  options.max_queued_bytes = FLAGS_max_queued_bytes;
+  options.listen_backlog = FLAGS_listen_backlog;
+  options.expected_connections = FLAGS_expected_clients;
+  options.worker_threads = FLAGS_workers;
+
+  SelectServer ss;
+  MasterServer server(&ss, options);
   if (!server.Init()) {
     exit(ola::EXIT_UNAVAILABLE);
   }
 
+  std::auto_ptr<LoadMonitor> load_monitor;
+  if (FLAGS_load_interval) {
+    LoadPriorityPolicy::Options load_options;
+    load_options.max_priority = options.priority;
+    load_options.min_priority = FLAGS_min_priority;
+    load_options.client_capacity = FLAGS_client_capacity;
+    load_options.lag_limit = ola::TimeInterval(
+        FLAGS_lag_limit / 1000, (FLAGS_lag_limit % 1000) * 1000);
+    load_options.cpu_limit = FLAGS_cpu_limit / 100.0;
+    load_options.shed_threshold = FLAGS_shed_threshold / 100.0;
+    load_options.hysteresis = FLAGS_priority_hysteresis;
+    load_options.min_change_interval = ola::TimeInterval(
+        FLAGS_priority_change_interval / 1000,
+        (FLAGS_priority_change_interval % 1000) * 1000);
+    load_monitor.reset(new LoadMonitor(&ss, &server, load_options,
+                                       FLAGS_load_interval,
+                                       1 + FLAGS_workers));
+    load_monitor->Start();
+  }
+
+  g_ss = &ss;
   g_server = &server;
   ola::InstallSignal(SIGINT, InteruptSignal);
-  server.Run();
+  ss.Run();
   g_server = NULL;
+  g_ss = NULL;
 }
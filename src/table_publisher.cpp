@@ -0,0 +1,71 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * table_publisher.cpp
+ * Browse for masters and publish them to a shared memory table.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include <signal.h>
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/base/Flags.h>
+#include <ola/base/Init.h>
+#include <ola/base/Macro.h>
+#include <ola/base/SysExits.h>
+#include <ola/io/SelectServer.h>
+
+#include "src/MasterTableAgent.h"
+#include "src/SharedDiscoveryAgent.h"
+
+using ola::io::SelectServer;
+
+DEFINE_string(scope, "default", "The scope to browse.");
+DEFINE_string(browse_domain, "",
+              "The DNS-SD domain to browse, empty uses the system default.");
+DEFINE_string(table, "/glowing-wookie-masters",
+              "The name of the shared memory table.");
+
+SelectServer *g_ss = NULL;
+
+static void InteruptSignal(OLA_UNUSED int signal) {
+  if (g_ss) {
+    g_ss->Terminate();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ola::AppInit(&argc, argv, "[options]",
+               "Publish the masters to shared memory.");
+
+  DiscoveryHub hub(NULL, FLAGS_scope.str(), FLAGS_browse_domain.str());
+  MasterTablePublisher publisher(&hub, FLAGS_table.str());
+  if (!publisher.Start()) {
+    exit(ola::EXIT_UNAVAILABLE);
+  }
+  if (!hub.Start()) {
+    publisher.Stop();
+    exit(ola::EXIT_UNAVAILABLE);
+  }
+
+  SelectServer ss;
+  g_ss = &ss;
+  ola::InstallSignal(SIGINT, InteruptSignal);
+  ss.Run();
+  g_ss = NULL;
+
+  hub.Stop();
+  publisher.Stop();
+}
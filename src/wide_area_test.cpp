@@ -0,0 +1,288 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * wide_area_test.cpp
+ * Check wide-area discovery & registration against a local DNS server.
+ * Copyright (C) 2015 Simon Newton
+ */
+
+#include <signal.h>
+#include <ola/Callback.h>
+#include <ola/Logging.h>
+#include <ola/base/Flags.h>
+#include <ola/base/Init.h>
+#include <ola/base/SysExits.h>
+#include <ola/io/SelectServer.h>
+#include <ola/network/IPV4Address.h>
+#include <ola/network/SocketAddress.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/DiscoveryAgent.h"
+#include "src/LocalDNSServer.h"
+#include "src/MasterEntry.h"
+
+DEFINE_string(domain, "dnssd.test.", "The zone the DNS server serves.");
+DEFINE_string(dns_ip, "127.0.0.1", "The IP address for the DNS server.");
+DEFINE_uint16(dns_port, 53, "The port for the DNS server.");
+DEFINE_string(scope, "wide-area-test", "The scope to use.");
+DEFINE_string(service_name, "WideAreaTest", "The master's service name.");
+DEFINE_uint16(master_port, 5569, "The port to register the master with.");
+DEFINE_default_bool(register_master, true,
+                    "Register the master with DNS UPDATE. If false the "
+                    "master is added to the zone directly, and only "
+                    "discovery is tested.");
+DEFINE_uint32(timeout, 30000,
+              "The time in ms to wait for the master to be registered and "
+              "discovered.");
+
+using ola::NewCallback;
+using ola::NewSingleCallback;
+using ola::io::SelectServer;
+using ola::network::IPV4Address;
+using ola::network::IPV4SocketAddress;
+using std::auto_ptr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+ * @brief Registers and browses for a master through a LocalDNSServer.
+ *
+ * The agent is the platform's DNS-SD implementation, with the browse and
+ * registration domains set to the server's zone. The test passes once the
+ * zone holds the master's SRV record, and the agent has reported the master
+ * after querying the server for it.
+ *
+ * The DNS-SD daemon sends wide-area queries and updates to the system's
+ * unicast DNS servers, so the host has to be set up to use the server, e.g.
+ * with "nameserver 127.0.0.1" in /etc/resolv.conf and the default port of
+ * 53. Avahi can't register in wide-area domains, so use --noregister_master
+ * there.
+ */
+class WideAreaTest {
+ public:
+  WideAreaTest(SelectServer *ss, LocalDNSServer *server)
+      : m_ss(ss),
+        m_server(server),
+        m_registered(false),
+        m_discovered(false),
+        m_passed(false) {
+  }
+
+  ~WideAreaTest();
+
+  bool Start();
+  bool Passed() const { return m_passed; }
+  void PrintResults() const;
+
+ private:
+  SelectServer *m_ss;
+  LocalDNSServer *m_server;
+  auto_ptr<DiscoveryAgentInterface> m_agent;
+  MasterEntry m_master;
+  bool m_registered;
+  bool m_discovered;
+  bool m_passed;
+
+  void MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                     const MasterEntry &entry);
+  void HandleMaster(DiscoveryAgentInterface::MasterEvent event,
+                    MasterEntry entry);
+  bool CheckRegistration();
+  void Finish();
+  void Timeout();
+};
+
+WideAreaTest::~WideAreaTest() {
+  if (m_agent.get()) {
+    if (FLAGS_register_master) {
+      m_agent->DeRegisterMaster(m_master.address);
+    }
+    m_agent->Stop();
+  }
+  // Run any events the agent queued, while we're still around.
+  m_ss->DrainCallbacks();
+}
+
+bool WideAreaTest::Start() {
+  m_master.service_name = FLAGS_service_name.str();
+  m_master.address = IPV4SocketAddress(m_server->ListenAddress().Host(),
+                                       FLAGS_master_port);
+  m_master.priority = 100;
+  m_master.scope = FLAGS_scope.str();
+
+  if (!FLAGS_register_master) {
+    m_server->AddMaster(m_master, "wide-area-test-host");
+    m_registered = true;
+  }
+
+  DiscoveryAgentInterface::Options options;
+  options.scope = m_master.scope;
+  options.browse_domain = m_server->Domain();
+  if (FLAGS_register_master) {
+    options.registration_domain = m_server->Domain();
+  }
+  options.master_callback = NewCallback(this, &WideAreaTest::MasterChanged);
+
+  DiscoveryAgentFactory factory;
+  m_agent.reset(factory.New(options));
+  if (!m_agent.get() || !m_agent->Start()) {
+    OLA_WARN << "Failed to start the discovery agent";
+    m_agent.reset();
+    return false;
+  }
+  if (FLAGS_register_master) {
+    m_agent->RegisterMaster(m_master);
+    m_ss->RegisterRepeatingTimeout(
+        100, NewCallback(this, &WideAreaTest::CheckRegistration));
+  }
+  m_ss->RegisterSingleTimeout(
+      FLAGS_timeout, NewSingleCallback(this, &WideAreaTest::Timeout));
+  return true;
+}
+
+void WideAreaTest::PrintResults() const {
+  cout << "Queries for " << m_server->ScopeServiceName(m_master.scope)
+       << ": " << m_server->QueryCount(m_server->ScopeServiceName(
+                                           m_master.scope)) << endl;
+  cout << "Updates: " << m_server->UpdateCount() << endl;
+  cout << "Registered: " << (m_registered ? "yes" : "no") << endl;
+  cout << "Discovered: " << (m_discovered ? "yes" : "no") << endl;
+  cout << (m_passed ? "PASSED" : "FAILED") << endl;
+}
+
+/*
+ * Runs on the DNS-SD thread.
+ */
+void WideAreaTest::MasterChanged(DiscoveryAgentInterface::MasterEvent event,
+                                 const MasterEntry &entry) {
+  m_ss->Execute(NewSingleCallback(this, &WideAreaTest::HandleMaster, event,
+                                  entry));
+}
+
+void WideAreaTest::HandleMaster(DiscoveryAgentInterface::MasterEvent event,
+                                MasterEntry entry) {
+  OLA_INFO << "Master " << (event == DiscoveryAgentInterface::MASTER_ADDED ?
+                            "added" : "removed")
+           << ": " << entry;
+  // The host part of the address depends on how the daemon registered the
+  // target, so only the port is checked.
+  if (event != DiscoveryAgentInterface::MASTER_ADDED ||
+      entry.service_name != m_master.service_name ||
+      entry.address.Port() != m_master.address.Port()) {
+    return;
+  }
+
+  // Make sure the browse went to our server, rather than being answered
+  // from mDNS.
+  if (m_server->QueryCount(m_server->ScopeServiceName(m_master.scope)) == 0) {
+    OLA_WARN << "Master reported without querying the DNS server";
+    return;
+  }
+  m_discovered = true;
+  Finish();
+}
+
+bool WideAreaTest::CheckRegistration() {
+  vector<LocalDNSServer::ResourceRecord> records;
+  m_server->GetRecords(m_server->InstanceName(m_master.service_name),
+                       LocalDNSServer::TYPE_SRV, &records);
+  vector<LocalDNSServer::ResourceRecord>::const_iterator iter =
+      records.begin();
+  for (; iter != records.end(); ++iter) {
+    // The SRV RDATA is priority, weight, port, target.
+    const string &rdata = iter->rdata;
+    if (rdata.size() > 6 &&
+        ((static_cast<uint8_t>(rdata[4]) << 8) |
+         static_cast<uint8_t>(rdata[5])) == m_master.address.Port()) {
+      OLA_INFO << m_master.service_name << " registered in "
+               << m_server->Domain();
+      m_registered = true;
+      Finish();
+      return false;
+    }
+  }
+  return true;
+}
+
+void WideAreaTest::Finish() {
+  if (m_registered && m_discovered && !m_passed) {
+    m_passed = true;
+    m_ss->Terminate();
+  }
+}
+
+void WideAreaTest::Timeout() {
+  if (!m_registered) {
+    OLA_WARN << "The master wasn't registered with " << m_server->Domain()
+             << ", is the DNS-SD daemon using " << m_server->ListenAddress()
+             << " for unicast DNS?";
+  }
+  if (!m_discovered) {
+    OLA_WARN << "The master wasn't discovered through "
+             << m_server->ListenAddress();
+  }
+  m_ss->Terminate();
+}
+
+SelectServer *g_ss = NULL;
+
+static void InteruptSignal(OLA_UNUSED int signal) {
+  if (g_ss) {
+    g_ss->Terminate();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  ola::AppInit(&argc, argv, "[options]",
+               "Check wide-area DNS-SD against a local DNS server.");
+
+  IPV4Address dns_ip;
+  if (!IPV4Address::FromString(FLAGS_dns_ip, &dns_ip)) {
+    ola::DisplayUsage();
+    exit(ola::EXIT_USAGE);
+  }
+
+  SelectServer ss;
+  LocalDNSServer server(&ss, FLAGS_domain.str());
+  if (!server.Start(IPV4SocketAddress(dns_ip, FLAGS_dns_port))) {
+    exit(ola::EXIT_UNAVAILABLE);
+  }
+
+  bool passed = false;
+  {
+    WideAreaTest test(&ss, &server);
+    if (!test.Start()) {
+      exit(ola::EXIT_UNAVAILABLE);
+    }
+
+    g_ss = &ss;
+    ola::InstallSignal(SIGINT, InteruptSignal);
+    ss.Run();
+    g_ss = NULL;
+
+    test.PrintResults();
+    passed = test.Passed();
+  }
+  server.Stop();
+  if (!passed) {
+    exit(ola::EXIT_SOFTWARE);
+  }
+}